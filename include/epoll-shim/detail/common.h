@@ -11,7 +11,13 @@
 #define EPOLL_SHIM_NO_VARIADICS
 #endif
 
+#include <epoll-shim/detail/fd_bitmap.h>
+
 extern int epoll_shim_close(int);
+/*
+ * 'close' always goes through the shim, even for plain descriptors: they
+ * have to be removed from any epoll instance they were registered with.
+ */
 #ifdef EPOLL_SHIM_NO_VARIADICS
 #define close(fd) epoll_shim_close((fd))
 #else
@@ -19,6 +25,10 @@ extern int epoll_shim_close(int);
 #endif
 
 extern int epoll_shim_fcntl(int, int, ...);
+/*
+ * 'fcntl' is not inlined: the type of its optional argument depends on 'cmd',
+ * so it cannot be forwarded from a variadic inline function.
+ */
 #ifdef EPOLL_SHIM_NO_VARIADICS
 #define fcntl epoll_shim_fcntl
 #else
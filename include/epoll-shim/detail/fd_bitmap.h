@@ -0,0 +1,43 @@
+#ifndef EPOLL_SHIM_DETAIL_FD_BITMAP_H_
+#define EPOLL_SHIM_DETAIL_FD_BITMAP_H_
+
+/*
+ * Bitmap of the file descriptors (below EPOLL_SHIM_FD_BITMAP_NR_FDS) that are
+ * currently backed by the shim. It is written by the library only. A set bit
+ * might be stale, but a shim fd always has its bit set before it is returned
+ * to the caller.
+ */
+#define EPOLL_SHIM_FD_BITMAP_NR_FDS 65536
+#define EPOLL_SHIM_FD_BITMAP_WORD_BITS (sizeof(unsigned long) * 8)
+
+extern volatile unsigned long epoll_shim_fd_bitmap[];
+
+/*
+ * The inline wrappers need 'inline' and variadic macros.
+ */
+#if !defined(EPOLL_SHIM_NO_VARIADICS) && /**/ \
+    (defined(__cplusplus) ||                  \
+	(defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L))
+#define EPOLL_SHIM_HAVE_INLINE_WRAPPERS
+
+/*
+ * Returns whether calls on 'fd' must go through the shim. Fds that are out of
+ * range of the bitmap always do.
+ */
+static inline int
+epoll_shim_fd_maybe_shimmed(int fd)
+{
+	if (fd < 0) {
+		return 0;
+	}
+	if (fd >= EPOLL_SHIM_FD_BITMAP_NR_FDS) {
+		return 1;
+	}
+	return (int)((epoll_shim_fd_bitmap[(unsigned)fd /
+			 EPOLL_SHIM_FD_BITMAP_WORD_BITS] >>
+		(unsigned)fd % EPOLL_SHIM_FD_BITMAP_WORD_BITS) &
+	    1);
+}
+#endif
+
+#endif
@@ -4,7 +4,17 @@
 #include <unistd.h>
 
 extern ssize_t epoll_shim_read(int, void *, size_t);
-#ifdef EPOLL_SHIM_NO_VARIADICS
+#ifdef EPOLL_SHIM_HAVE_INLINE_WRAPPERS
+static inline ssize_t
+epoll_shim_inline_read(int fd, void *buf, size_t count)
+{
+	if (epoll_shim_fd_maybe_shimmed(fd)) {
+		return epoll_shim_read(fd, buf, count);
+	}
+	return read(fd, buf, count);
+}
+#define read(...) epoll_shim_inline_read(__VA_ARGS__)
+#elif defined(EPOLL_SHIM_NO_VARIADICS)
 #define read(fd, buf, count) epoll_shim_read((fd), (buf), (count))
 #else
 #define read(...) epoll_shim_read(__VA_ARGS__)
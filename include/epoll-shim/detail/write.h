@@ -4,7 +4,17 @@
 #include <unistd.h>
 
 extern ssize_t epoll_shim_write(int, void const *, size_t);
-#ifdef EPOLL_SHIM_NO_VARIADICS
+#ifdef EPOLL_SHIM_HAVE_INLINE_WRAPPERS
+static inline ssize_t
+epoll_shim_inline_write(int fd, void const *buf, size_t count)
+{
+	if (epoll_shim_fd_maybe_shimmed(fd)) {
+		return epoll_shim_write(fd, buf, count);
+	}
+	return write(fd, buf, count);
+}
+#define write(...) epoll_shim_inline_write(__VA_ARGS__)
+#elif defined(EPOLL_SHIM_NO_VARIADICS)
 #define write(fd, buf, count) epoll_shim_write((fd), (buf), (count))
 #else
 #define write(...) epoll_shim_write(__VA_ARGS__)
@@ -0,0 +1,31 @@
+#ifndef EPOLL_SHIM_DUMP_H_
+#define EPOLL_SHIM_DUMP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+/*
+ * Non-standard: writes what the shim has registered in the epoll instance
+ * 'epfd' to 'out', for debugging. For each registered fd, this includes the
+ * node type, the requested events, the state of the kqueue filters, the EOF
+ * state, the number of events delivered and the time since the last one.
+ * The sizes of the internal buffers are summarised first.
+ *
+ * 'epoll_shim_dump' writes text for humans, 'epoll_shim_dump_json' a single
+ * line with a JSON object. The state is copied with the epoll instance
+ * locked and written after unlocking it, so a slow 'out' does not hold up
+ * other threads. Returns 0 on success, -1 with errno set on failure (EIO if
+ * writing to 'out' failed).
+ */
+
+int epoll_shim_dump(int, FILE *);
+int epoll_shim_dump_json(int, FILE *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
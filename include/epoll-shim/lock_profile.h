@@ -0,0 +1,63 @@
+#ifndef EPOLL_SHIM_LOCK_PROFILE_H_
+#define EPOLL_SHIM_LOCK_PROFILE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Non-standard: lock contention and hold time statistics of the shim's
+ * internal locks. These are only recorded if epoll-shim was built with
+ * ENABLE_LOCK_PROFILING. Otherwise, 'epoll_shim_lock_profile_get' fails with
+ * ENOTSUP. Such builds also print all statistics to stderr at exit.
+ */
+
+#define EPOLL_SHIM_LOCK_CLASS_RWLOCK_READ 0
+#define EPOLL_SHIM_LOCK_CLASS_RWLOCK_WRITE 1
+#define EPOLL_SHIM_LOCK_CLASS_DESC_MUTEX 2
+#define EPOLL_SHIM_LOCK_CLASS_POLLING_THREADS_MUTEX 3
+#define EPOLL_SHIM_LOCK_CLASS_COUNT 4
+
+#define EPOLL_SHIM_LOCK_PROFILE_BUCKETS 32
+
+struct epoll_shim_lock_profile {
+	uint64_t acquisitions;
+	uint64_t contended_acquisitions;
+	uint64_t wait_ns; /* Only contended acquisitions wait. */
+	uint64_t hold_ns;
+	/*
+	 * Bucket 'i' counts durations of [2^i, 2^(i+1)) nanoseconds, the last
+	 * bucket also all longer ones.
+	 */
+	uint64_t wait_histogram[EPOLL_SHIM_LOCK_PROFILE_BUCKETS];
+	uint64_t hold_histogram[EPOLL_SHIM_LOCK_PROFILE_BUCKETS];
+};
+
+/*
+ * Time spent in some hot code paths of 'epoll_wait', recorded in the same
+ * builds. Phases may nest: the time of 'EPOLL_SHIM_PHASE_FEED_EVENT' includes
+ * the 'EPOLL_SHIM_PHASE_GET_NEEDED_FILTERS' calls made from there.
+ */
+
+#define EPOLL_SHIM_PHASE_GET_NEEDED_FILTERS 0
+#define EPOLL_SHIM_PHASE_FEED_EVENT 1
+#define EPOLL_SHIM_PHASE_TRANSLATE 2
+#define EPOLL_SHIM_PHASE_COUNT 3
+
+struct epoll_shim_phase_profile {
+	uint64_t calls;
+	uint64_t ns;
+};
+
+int epoll_shim_lock_profile_get(int, struct epoll_shim_lock_profile *);
+int epoll_shim_phase_profile_get(int, struct epoll_shim_phase_profile *);
+/* Resets both the lock and the phase statistics. */
+void epoll_shim_lock_profile_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
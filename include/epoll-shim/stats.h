@@ -0,0 +1,56 @@
+#ifndef EPOLL_SHIM_STATS_H_
+#define EPOLL_SHIM_STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Non-standard: counters of what the shim does internally. They are kept per
+ * thread and summed up on read, so counting does not add contention.
+ */
+
+struct epoll_shim_stats {
+	uint64_t epoll_wait_calls;
+	/* 'epoll_wait' woke up from poll, but found no events. */
+	uint64_t empty_wakeups;
+	/* The kqueue returned events that did not map to any epoll event. */
+	uint64_t wait_retries;
+	/*
+	 * Calls to 'kevent' made by the epoll implementation, and the number
+	 * of changes passed to them.
+	 */
+	uint64_t kevent_calls;
+	uint64_t kevent_changes;
+	/* Temporary kqueues created to complete edge triggered events. */
+	uint64_t completion_kqueues;
+	/* Filter re-registrations after a descriptor reached EOF. */
+	uint64_t eof_reregistrations;
+	/* Descriptors that can only be polled and had to be polled again. */
+	uint64_t repolls;
+	/* 'epoll_ctl' calls that had to wait for polling threads. */
+	uint64_t repoll_waits;
+	/*
+	 * Reads and writes of the shim's own eventfds, timerfds (including
+	 * 'timerfd_settime') and signalfds.
+	 */
+	uint64_t eventfd_ops;
+	uint64_t timerfd_ops;
+	uint64_t signalfd_ops;
+};
+
+/* Counters of the whole process. */
+int epoll_shim_get_stats(struct epoll_shim_stats *);
+/*
+ * Counters of a single epoll instance. The eventfd, timerfd and signalfd
+ * operations are not attributed to epoll instances and are always zero.
+ */
+int epoll_shim_get_epollfd_stats(int, struct epoll_shim_stats *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
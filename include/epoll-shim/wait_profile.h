@@ -0,0 +1,54 @@
+#ifndef EPOLL_SHIM_WAIT_PROFILE_H_
+#define EPOLL_SHIM_WAIT_PROFILE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Non-standard: distributions of what happens inside 'epoll_wait', per epoll
+ * instance. Like the lock profile, they are only recorded if epoll-shim was
+ * built with ENABLE_LOCK_PROFILING. Otherwise,
+ * 'epoll_shim_get_wait_histogram' fails with ENOTSUP. Such builds also print
+ * percentiles of all epoll instances to stderr at exit.
+ */
+
+/* Time spent sleeping in poll per wakeup, in ns. */
+#define EPOLL_SHIM_WAIT_HISTOGRAM_BLOCK 0
+/* Events returned per 'epoll_wait' call. */
+#define EPOLL_SHIM_WAIT_HISTOGRAM_EVENTS 1
+/*
+ * Time from the wakeup of poll until 'epoll_wait' returns the events, in ns.
+ * Calls that did not have to block are not counted.
+ */
+#define EPOLL_SHIM_WAIT_HISTOGRAM_WAKEUP_TO_RETURN 2
+/* Time 'epoll_wait' waits for the mutex of the epoll instance, in ns. */
+#define EPOLL_SHIM_WAIT_HISTOGRAM_MUTEX_WAIT 3
+#define EPOLL_SHIM_WAIT_HISTOGRAM_COUNT 4
+
+/*
+ * Values below 4 have their own bucket. Above that, each power of two is
+ * split into 4 buckets of equal width. The last bucket also counts all larger
+ * values. 'epoll_shim_wait_histogram_bucket_min' returns the smallest value
+ * of a bucket.
+ */
+#define EPOLL_SHIM_WAIT_HISTOGRAM_BUCKETS 160
+
+struct epoll_shim_wait_histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[EPOLL_SHIM_WAIT_HISTOGRAM_BUCKETS];
+};
+
+int epoll_shim_get_wait_histogram(int, int,
+    struct epoll_shim_wait_histogram *);
+uint64_t epoll_shim_wait_histogram_bucket_min(int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
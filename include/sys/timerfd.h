@@ -11,6 +11,14 @@ extern "C" {
 #define TFD_NONBLOCK O_NONBLOCK
 #define TFD_CLOEXEC O_CLOEXEC
 
+/*
+ * Non-standard 'timerfd_create' flag: keep the timer on a process wide timer
+ * wheel driven by a single kernel timer, instead of giving it its own kernel
+ * timer. Re-arming such timers is cheap, but they have a resolution of one
+ * millisecond. Absolute CLOCK_REALTIME timers are not affected.
+ */
+#define TFD_WHEEL 0x40000000
+
 #define TFD_TIMER_ABSTIME 1
 #define TFD_TIMER_CANCEL_ON_SET (1 << 1)
 
@@ -20,6 +28,26 @@ int timerfd_create(int, int);
 int timerfd_settime(int, int, struct itimerspec const *, struct itimerspec *);
 int timerfd_gettime(int, struct itimerspec *);
 
+/*
+ * Non-standard: arm or disarm 'n' timers at once, as if by calling
+ * 'timerfd_settime(fds[i], flags, &new[i], NULL)' for each of them. The clock
+ * is read only once, so all relative timers start at the same time. If
+ * 'errors' is not NULL, it receives the error number of each timer (or 0).
+ * Returns -1 and sets errno to the first error if any timer failed.
+ */
+int timerfd_settime_many(int const *, int, struct itimerspec const *, int *,
+    size_t);
+
+/*
+ * Non-standard: allow expirations of the timer to be delayed by up to the
+ * given amount. Deadlines are rounded up to a multiple of the slack, so timers
+ * with overlapping windows expire together. Timers with a slack of at least
+ * one millisecond are moved to the timer wheel (see TFD_WHEEL) the next time
+ * they are armed. Lowering the slack below that takes them off the wheel again,
+ * unless they were created with TFD_WHEEL.
+ */
+int timerfd_set_slack(int, struct timespec const *);
+
 
 #ifndef EPOLL_SHIM_DISABLE_WRAPPER_MACROS
 #include <epoll-shim/detail/common.h>
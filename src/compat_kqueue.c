@@ -0,0 +1,1258 @@
+#include "compat_kqueue.h"
+
+/*
+ * A userspace kqueue on top of Linux primitives. This is not meant as a
+ * general purpose kqueue library. It implements just enough of the BSD
+ * semantics (EVFILT_READ/WRITE/EXCEPT/USER/TIMER/SIGNAL together with
+ * EV_CLEAR/ONESHOT/RECEIPT/DISPATCH) so that the shim itself can be built,
+ * tested and benchmarked on Linux.
+ *
+ * Every kqueue is a native epoll instance. Because epoll only allows one
+ * registration per file descriptor, the fd based filters each get their own
+ * child epoll instance which is nested into the kqueue's epoll instance.
+ * Timers and signals are backed by one timerfd/signalfd per knote and
+ * EVFILT_USER knotes share one eventfd per kqueue.
+ *
+ * The native interfaces are called with syscall(2) directly, because the
+ * libc symbols are interposed by the shim itself.
+ */
+
+#include <sys/types.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/queue.h>
+#include <sys/tree.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "errno_return.h"
+#include "timespec_util.h"
+#include "wrap.h"
+
+#define NR_FD_FILTERS 3
+
+typedef enum {
+	KNOTE_FD_OTHER,
+	KNOTE_FD_FIFO,
+	KNOTE_FD_SOCKET,
+} KNoteFDType;
+
+struct knote_;
+typedef struct knote_ KNote;
+
+struct knote_ {
+	RB_ENTRY(knote_) entry;
+	LIST_ENTRY(knote_) active_entry;
+
+	uintptr_t ident;
+	short filter;
+	unsigned short flags;
+	unsigned int fflags;
+	int64_t data;
+	void *udata;
+
+	bool is_disabled;
+	bool is_active;
+	bool is_on_active_list;
+	bool is_parked;
+
+	/* Native timerfd/signalfd backing EVFILT_TIMER/EVFILT_SIGNAL. */
+	int fd;
+	KNoteFDType fd_type;
+};
+
+typedef RB_HEAD(knote_set_, knote_) KNoteSet;
+typedef LIST_HEAD(knote_list_, knote_) KNoteList;
+
+static int
+knote_cmp(KNote *a, KNote *b)
+{
+	if (a->filter != b->filter) {
+		return a->filter < b->filter ? -1 : 1;
+	}
+	return a->ident < b->ident ? -1 : a->ident > b->ident ? 1 : 0;
+}
+
+RB_PROTOTYPE_STATIC(knote_set_, knote_, entry, knote_cmp);
+RB_GENERATE_STATIC(knote_set_, knote_, entry, knote_cmp);
+
+typedef struct {
+	pthread_mutex_t mutex;
+	unsigned long refcount;
+	bool is_closed;
+
+	int fd;
+	int filter_fds[NR_FD_FILTERS];
+	int user_fd;
+
+	KNoteSet knotes;
+	KNoteList active_user_knotes;
+
+	/* Knotes whose native registration could not be removed. */
+	KNoteList zombie_knotes;
+} KQueue;
+
+static pthread_mutex_t kqueues_mutex = PTHREAD_MUTEX_INITIALIZER;
+static KQueue **kqueues;
+static size_t kqueues_length;
+static pthread_once_t kqueues_atfork_once = PTHREAD_ONCE_INIT;
+
+/**/
+
+static int
+sys_epoll_create1(int flags)
+{
+	return (int)syscall(SYS_epoll_create1, flags);
+}
+
+static int
+sys_epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+	return (int)syscall(SYS_epoll_ctl, epfd, op, fd, ev);
+}
+
+static int
+sys_epoll_poll(int epfd, struct epoll_event *evs, int maxevents)
+{
+	return (int)syscall(SYS_epoll_pwait, epfd, evs, maxevents, 0, NULL,
+	    (size_t)(_NSIG / 8));
+}
+
+static int
+sys_eventfd(unsigned int count, int flags)
+{
+	return (int)syscall(SYS_eventfd2, count, flags);
+}
+
+static int
+sys_timerfd_create(clockid_t clockid, int flags)
+{
+	return (int)syscall(SYS_timerfd_create, clockid, flags);
+}
+
+static int
+sys_timerfd_settime(int fd, int flags, struct itimerspec const *new)
+{
+	return (int)syscall(SYS_timerfd_settime, fd, flags, new, NULL);
+}
+
+static int
+sys_signalfd(sigset_t const *mask, int flags)
+{
+	return (int)syscall(SYS_signalfd4, -1, mask, (size_t)(_NSIG / 8),
+	    flags);
+}
+
+/**/
+
+static int
+filter_index(short filter)
+{
+	switch (filter) {
+	case EVFILT_READ:
+		return 0;
+	case EVFILT_WRITE:
+		return 1;
+	case EVFILT_EXCEPT:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+static void
+kqueue_user_knote_update(KQueue *kq, KNote *kn)
+{
+	bool should_be_listed = kn->is_active && !kn->is_disabled;
+
+	if (should_be_listed == kn->is_on_active_list) {
+		return;
+	}
+
+	bool was_empty = LIST_EMPTY(&kq->active_user_knotes);
+
+	if (should_be_listed) {
+		LIST_INSERT_HEAD(&kq->active_user_knotes, kn, active_entry);
+	} else {
+		LIST_REMOVE(kn, active_entry);
+	}
+	kn->is_on_active_list = should_be_listed;
+
+	bool is_empty = LIST_EMPTY(&kq->active_user_knotes);
+
+	/* The eventfd is readable exactly if there are active knotes. */
+	if (was_empty && !is_empty) {
+		uint64_t one = 1;
+		(void)real_write(kq->user_fd, &one, sizeof(one));
+	} else if (!was_empty && is_empty) {
+		uint64_t value;
+		(void)real_read(kq->user_fd, &value, sizeof(value));
+	}
+}
+
+static void
+kqueue_knote_destroy(KQueue *kq, KNote *kn)
+{
+	RB_REMOVE(knote_set_, &kq->knotes, kn);
+
+	if (kn->filter == EVFILT_USER) {
+		kn->is_active = false;
+		kqueue_user_knote_update(kq, kn);
+	}
+
+	int idx = filter_index(kn->filter);
+	if (idx >= 0) {
+		if (sys_epoll_ctl(kq->filter_fds[idx], EPOLL_CTL_DEL,
+			(int)kn->ident, NULL) < 0 &&
+		    errno == EBADF) {
+			/*
+			 * The fd is gone, but the file might still be alive
+			 * through a duplicate. Keep the knote around so that
+			 * stale events never point to freed memory.
+			 */
+			LIST_INSERT_HEAD(&kq->zombie_knotes, kn, active_entry);
+			return;
+		}
+	}
+
+	if (kn->fd >= 0) {
+		(void)real_close(kn->fd);
+	}
+	free(kn);
+}
+
+static void
+kqueue_destroy(KQueue *kq)
+{
+	KNote *kn, *kn_tmp;
+
+	RB_FOREACH_SAFE (kn, knote_set_, &kq->knotes, kn_tmp) {
+		RB_REMOVE(knote_set_, &kq->knotes, kn);
+		if (kn->fd >= 0) {
+			(void)real_close(kn->fd);
+		}
+		free(kn);
+	}
+	LIST_FOREACH_SAFE (kn, &kq->zombie_knotes, active_entry, kn_tmp) {
+		free(kn);
+	}
+
+	for (int i = 0; i < NR_FD_FILTERS; ++i) {
+		if (kq->filter_fds[i] >= 0) {
+			(void)real_close(kq->filter_fds[i]);
+		}
+	}
+	if (kq->user_fd >= 0) {
+		(void)real_close(kq->user_fd);
+	}
+
+	(void)pthread_mutex_destroy(&kq->mutex);
+	free(kq);
+}
+
+static void
+kqueue_unref(KQueue *kq)
+{
+	(void)pthread_mutex_lock(&kqueues_mutex);
+	bool is_last = --kq->refcount == 0;
+	(void)pthread_mutex_unlock(&kqueues_mutex);
+
+	if (is_last) {
+		kqueue_destroy(kq);
+	}
+}
+
+static KQueue *
+kqueue_find(int fd)
+{
+	KQueue *kq = NULL;
+
+	(void)pthread_mutex_lock(&kqueues_mutex);
+	if (fd >= 0 && (size_t)fd < kqueues_length && kqueues[fd] != NULL) {
+		kq = kqueues[fd];
+		++kq->refcount;
+	}
+	(void)pthread_mutex_unlock(&kqueues_mutex);
+
+	return kq;
+}
+
+/* Must be called with "kqueues_mutex" held. */
+static KQueue *
+kqueue_unregister_locked(int fd)
+{
+	if (fd < 0 || (size_t)fd >= kqueues_length || kqueues[fd] == NULL) {
+		return NULL;
+	}
+
+	KQueue *kq = kqueues[fd];
+	kqueues[fd] = NULL;
+
+	(void)pthread_mutex_lock(&kq->mutex);
+	kq->is_closed = true;
+	(void)pthread_mutex_unlock(&kq->mutex);
+
+	return kq;
+}
+
+static void
+kqueues_atfork_prepare(void)
+{
+	(void)pthread_mutex_lock(&kqueues_mutex);
+}
+
+static void
+kqueues_atfork_parent(void)
+{
+	(void)pthread_mutex_unlock(&kqueues_mutex);
+}
+
+static void
+kqueues_atfork_child(void)
+{
+	/*
+	 * Like on BSD, kqueues are not inherited by the child. The memory is
+	 * leaked as other threads of the parent might have held references.
+	 */
+	kqueues = NULL;
+	kqueues_length = 0;
+	(void)pthread_mutex_init(&kqueues_mutex, NULL);
+}
+
+static void
+kqueues_atfork_init(void)
+{
+	(void)pthread_atfork(kqueues_atfork_prepare, kqueues_atfork_parent,
+	    kqueues_atfork_child);
+}
+
+static errno_t
+kqueue_register(KQueue *kq)
+{
+	KQueue *stale_kq;
+
+	(void)pthread_mutex_lock(&kqueues_mutex);
+
+	size_t fd = (size_t)kq->fd;
+	if (fd >= kqueues_length) {
+		size_t new_length = kqueues_length == 0 ? 64 : kqueues_length;
+		while (new_length <= fd) {
+			new_length *= 2;
+		}
+
+		KQueue **new_kqueues = realloc(kqueues,
+		    new_length * sizeof(KQueue *));
+		if (new_kqueues == NULL) {
+			(void)pthread_mutex_unlock(&kqueues_mutex);
+			return ENOMEM;
+		}
+		memset(new_kqueues + kqueues_length, 0,
+		    (new_length - kqueues_length) * sizeof(KQueue *));
+		kqueues = new_kqueues;
+		kqueues_length = new_length;
+	}
+
+	/*
+	 * If the previous kqueue with this fd number was closed behind our
+	 * back (i.e. not through compat_kqueue_close), clean up now.
+	 */
+	stale_kq = kqueue_unregister_locked(kq->fd);
+	kqueues[fd] = kq;
+
+	(void)pthread_mutex_unlock(&kqueues_mutex);
+
+	if (stale_kq != NULL) {
+		kqueue_unref(stale_kq);
+	}
+
+	return 0;
+}
+
+static errno_t
+compat_kqueue_impl(int *fd_out)
+{
+	errno_t ec;
+
+	(void)pthread_once(&kqueues_atfork_once, kqueues_atfork_init);
+
+	KQueue *kq = calloc(1, sizeof(KQueue));
+	if (kq == NULL) {
+		return errno;
+	}
+
+	if ((ec = pthread_mutex_init(&kq->mutex, NULL)) != 0) {
+		free(kq);
+		return ec;
+	}
+
+	kq->refcount = 1;
+	for (int i = 0; i < NR_FD_FILTERS; ++i) {
+		kq->filter_fds[i] = -1;
+	}
+	kq->user_fd = -1;
+	RB_INIT(&kq->knotes);
+	LIST_INIT(&kq->active_user_knotes);
+	LIST_INIT(&kq->zombie_knotes);
+
+	if ((kq->fd = sys_epoll_create1(0)) < 0) {
+		ec = errno;
+		kqueue_destroy(kq);
+		return ec;
+	}
+
+	if ((ec = kqueue_register(kq)) != 0) {
+		(void)real_close(kq->fd);
+		kqueue_destroy(kq);
+		return ec;
+	}
+
+	*fd_out = kq->fd;
+	return 0;
+}
+
+int
+compat_kqueue(void)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	int fd;
+	ec = compat_kqueue_impl(&fd);
+
+	ERRNO_RETURN(ec, -1, fd);
+}
+
+int
+compat_kqueue_close(int fd)
+{
+	(void)pthread_mutex_lock(&kqueues_mutex);
+	KQueue *kq = kqueue_unregister_locked(fd);
+	(void)pthread_mutex_unlock(&kqueues_mutex);
+
+	int rv = real_close(fd);
+
+	if (kq != NULL) {
+		int const oe = errno;
+		kqueue_unref(kq);
+		errno = oe;
+	}
+
+	return rv;
+}
+
+/**/
+
+static errno_t
+kqueue_ensure_fd(KQueue *kq, int *fd, int new_fd)
+{
+	if (*fd >= 0) {
+		if (new_fd >= 0) {
+			(void)real_close(new_fd);
+		}
+		return 0;
+	}
+
+	if (new_fd < 0) {
+		return errno;
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = fd,
+	};
+	if (sys_epoll_ctl(kq->fd, EPOLL_CTL_ADD, new_fd, &ev) < 0) {
+		errno_t ec = errno;
+		(void)real_close(new_fd);
+		return ec;
+	}
+
+	*fd = new_fd;
+	return 0;
+}
+
+static uint32_t
+knote_epoll_events(KNote const *kn)
+{
+	uint32_t events;
+
+	switch (kn->filter) {
+	case EVFILT_READ:
+		events = EPOLLIN | EPOLLRDHUP;
+		break;
+	case EVFILT_WRITE:
+		events = EPOLLOUT;
+		/* Needed to tell apart unconnected sockets, see below. */
+		if (kn->fd_type == KNOTE_FD_SOCKET) {
+			events |= EPOLLRDHUP;
+		}
+		break;
+	case EVFILT_EXCEPT:
+		events = EPOLLPRI;
+		break;
+	default:
+		__builtin_unreachable();
+	}
+
+	if (kn->flags & EV_CLEAR) {
+		events |= EPOLLET;
+	}
+	if (kn->flags & (EV_ONESHOT | EV_DISPATCH)) {
+		events |= EPOLLONESHOT;
+	}
+
+	return events;
+}
+
+static errno_t
+knote_fd_arm(KQueue *kq, KNote *kn, bool is_new)
+{
+	int epfd = kq->filter_fds[filter_index(kn->filter)];
+	struct epoll_event ev = {
+		.events = knote_epoll_events(kn),
+		.data.ptr = kn,
+	};
+
+	kn->is_parked = false;
+
+	if (!is_new &&
+	    sys_epoll_ctl(epfd, EPOLL_CTL_MOD, (int)kn->ident, &ev) == 0) {
+		return 0;
+	}
+	if (sys_epoll_ctl(epfd, EPOLL_CTL_ADD, (int)kn->ident, &ev) < 0) {
+		return errno;
+	}
+	return 0;
+}
+
+static errno_t
+knote_fd_disarm(KQueue *kq, KNote *kn)
+{
+	int epfd = kq->filter_fds[filter_index(kn->filter)];
+
+	if (sys_epoll_ctl(epfd, EPOLL_CTL_DEL, (int)kn->ident, NULL) < 0 &&
+	    errno != ENOENT) {
+		return errno;
+	}
+	return 0;
+}
+
+static errno_t
+knote_timer_arm(KNote *kn)
+{
+	int64_t mult;
+
+	switch (kn->fflags &
+	    (NOTE_SECONDS | NOTE_MSECONDS | NOTE_USECONDS | NOTE_NSECONDS)) {
+	case NOTE_SECONDS:
+		mult = 1000000000;
+		break;
+	case 0:
+	case NOTE_MSECONDS:
+		mult = 1000000;
+		break;
+	case NOTE_USECONDS:
+		mult = 1000;
+		break;
+	case NOTE_NSECONDS:
+		mult = 1;
+		break;
+	default:
+		return EINVAL;
+	}
+
+	if (kn->data < 0) {
+		return EINVAL;
+	}
+
+	int64_t nanos;
+	if (__builtin_mul_overflow(kn->data, mult, &nanos)) {
+		nanos = INT64_MAX;
+	}
+
+	/* A zero it_value would disarm the timerfd. */
+	if (nanos == 0) {
+		nanos = 1;
+	}
+
+	struct timespec ts = {
+		.tv_sec = nanos / 1000000000,
+		.tv_nsec = nanos % 1000000000,
+	};
+	struct itimerspec its = { .it_value = ts };
+	int flags = 0;
+
+	if (kn->fflags & NOTE_ABSTIME) {
+		flags = TFD_TIMER_ABSTIME;
+	} else if (!(kn->flags & EV_ONESHOT)) {
+		its.it_interval = ts;
+	}
+
+	if (sys_timerfd_settime(kn->fd, flags, &its) < 0) {
+		return errno;
+	}
+
+	return 0;
+}
+
+static errno_t
+knote_top_arm(KQueue *kq, KNote *kn)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = kn,
+	};
+
+	/* Signals are reported on delivery, not while pending. */
+	if (kn->filter == EVFILT_SIGNAL) {
+		ev.events |= EPOLLET;
+	}
+
+	if (sys_epoll_ctl(kq->fd, EPOLL_CTL_ADD, kn->fd, &ev) < 0 &&
+	    errno != EEXIST) {
+		return errno;
+	}
+	return 0;
+}
+
+static void
+knote_top_disarm(KQueue *kq, KNote *kn)
+{
+	(void)sys_epoll_ctl(kq->fd, EPOLL_CTL_DEL, kn->fd, NULL);
+}
+
+static errno_t
+knote_create(KQueue *kq, struct kevent const *kev, KNote **kn_out)
+{
+	errno_t ec;
+
+	int idx = filter_index(kev->filter);
+
+	KNoteFDType fd_type = KNOTE_FD_OTHER;
+
+	if (idx >= 0) {
+		struct stat sb;
+		if (kev->ident > INT_MAX || fstat((int)kev->ident, &sb) < 0) {
+			return EBADF;
+		}
+		if (S_ISFIFO(sb.st_mode)) {
+			fd_type = KNOTE_FD_FIFO;
+		} else if (S_ISSOCK(sb.st_mode)) {
+			fd_type = KNOTE_FD_SOCKET;
+		}
+
+		if ((ec = kqueue_ensure_fd(kq, &kq->filter_fds[idx],
+			 kq->filter_fds[idx] >= 0 ?
+			     -1 :
+			     sys_epoll_create1(EPOLL_CLOEXEC))) != 0) {
+			return ec;
+		}
+	} else if (kev->filter == EVFILT_USER) {
+		if ((ec = kqueue_ensure_fd(kq, &kq->user_fd,
+			 kq->user_fd >= 0 ?
+			     -1 :
+			     sys_eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))) !=
+		    0) {
+			return ec;
+		}
+	} else if (kev->filter == EVFILT_SIGNAL) {
+		if (kev->ident == 0 || kev->ident >= _NSIG) {
+			return EINVAL;
+		}
+	} else if (kev->filter != EVFILT_TIMER) {
+		return EINVAL;
+	}
+
+	KNote *kn = calloc(1, sizeof(KNote));
+	if (kn == NULL) {
+		return errno;
+	}
+	kn->ident = kev->ident;
+	kn->filter = kev->filter;
+	kn->fd = -1;
+	kn->fd_type = fd_type;
+
+	if (kev->filter == EVFILT_TIMER) {
+		kn->fd = sys_timerfd_create((kev->fflags & NOTE_ABSTIME) ?
+			CLOCK_REALTIME :
+			CLOCK_MONOTONIC,
+		    TFD_CLOEXEC | TFD_NONBLOCK);
+	} else if (kev->filter == EVFILT_SIGNAL) {
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, (int)kev->ident);
+		kn->fd = sys_signalfd(&mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	}
+	if ((kev->filter == EVFILT_TIMER || kev->filter == EVFILT_SIGNAL) &&
+	    kn->fd < 0) {
+		ec = errno;
+		free(kn);
+		return ec;
+	}
+
+	void *colliding = RB_INSERT(knote_set_, &kq->knotes, kn);
+	(void)colliding;
+	assert(colliding == NULL);
+
+	*kn_out = kn;
+	return 0;
+}
+
+static errno_t
+knote_modify(KQueue *kq, KNote *kn, struct kevent const *kev, bool is_new)
+{
+	errno_t ec;
+
+	if (kev->flags & EV_ADD) {
+		kn->flags = kev->flags &
+		    (EV_ONESHOT | EV_CLEAR | EV_DISPATCH | EV_RECEIPT);
+		kn->udata = kev->udata;
+	}
+
+	if (kev->flags & EV_DISABLE) {
+		kn->is_disabled = true;
+	} else if (kev->flags & (EV_ENABLE | EV_ADD)) {
+		kn->is_disabled = false;
+	}
+
+	switch (kn->filter) {
+	case EVFILT_READ:
+	case EVFILT_WRITE:
+	case EVFILT_EXCEPT:
+		if (kev->flags & EV_ADD) {
+			kn->fflags = kev->fflags;
+		}
+		if (kn->is_disabled) {
+			return is_new ? 0 : knote_fd_disarm(kq, kn);
+		}
+		return knote_fd_arm(kq, kn, is_new);
+
+	case EVFILT_USER: {
+		unsigned int ffctrl = kev->fflags & NOTE_FFCTRLMASK;
+		unsigned int ffl = kev->fflags & NOTE_FFLAGSMASK;
+
+		switch (ffctrl) {
+		case NOTE_FFAND:
+			kn->fflags &= ffl;
+			break;
+		case NOTE_FFOR:
+			kn->fflags |= ffl;
+			break;
+		case NOTE_FFCOPY:
+			kn->fflags = ffl;
+			break;
+		default:
+			break;
+		}
+
+		if (kev->flags & EV_ADD) {
+			kn->data = kev->data;
+		}
+		if (kev->fflags & NOTE_TRIGGER) {
+			kn->is_active = true;
+		}
+
+		kqueue_user_knote_update(kq, kn);
+		return 0;
+	}
+
+	case EVFILT_TIMER:
+		if (kev->flags & EV_ADD) {
+			if ((kev->fflags ^ kn->fflags) & NOTE_ABSTIME &&
+			    !is_new) {
+				/* The timerfd has to be on the right clock. */
+				int fd = sys_timerfd_create(
+				    (kev->fflags & NOTE_ABSTIME) ?
+					CLOCK_REALTIME :
+					CLOCK_MONOTONIC,
+				    TFD_CLOEXEC | TFD_NONBLOCK);
+				if (fd < 0) {
+					return errno;
+				}
+				knote_top_disarm(kq, kn);
+				(void)real_close(kn->fd);
+				kn->fd = fd;
+			}
+			kn->fflags = kev->fflags;
+			kn->data = kev->data;
+			if ((ec = knote_timer_arm(kn)) != 0) {
+				return ec;
+			}
+		}
+		/* FALLTHROUGH */
+	case EVFILT_SIGNAL:
+		if (kn->is_disabled) {
+			knote_top_disarm(kq, kn);
+			return 0;
+		}
+		return knote_top_arm(kq, kn);
+
+	default:
+		return EINVAL;
+	}
+}
+
+static errno_t
+kqueue_apply_change(KQueue *kq, struct kevent const *kev)
+{
+	errno_t ec;
+
+	KNote key = { .ident = kev->ident, .filter = kev->filter };
+	KNote *kn = RB_FIND(knote_set_, &kq->knotes, &key);
+
+	if (kev->flags & EV_DELETE) {
+		if (kn == NULL) {
+			return ENOENT;
+		}
+		kqueue_knote_destroy(kq, kn);
+		return 0;
+	}
+
+	bool is_new = false;
+	if (kn == NULL) {
+		if (!(kev->flags & EV_ADD)) {
+			return ENOENT;
+		}
+		if ((ec = knote_create(kq, kev, &kn)) != 0) {
+			return ec;
+		}
+		is_new = true;
+	}
+
+	if ((ec = knote_modify(kq, kn, kev, is_new)) != 0) {
+		if (is_new) {
+			kqueue_knote_destroy(kq, kn);
+		}
+		return ec;
+	}
+
+	return 0;
+}
+
+/**/
+
+static void
+knote_fill_fd_event(KNote *kn, uint32_t revents, struct kevent *kev)
+{
+	*kev = (struct kevent) {
+		.ident = kn->ident,
+		.filter = kn->filter,
+		.flags = kn->flags,
+		.udata = kn->udata,
+	};
+
+	int fd = (int)kn->ident;
+
+	if (kn->filter == EVFILT_READ) {
+		if (revents & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+			kev->flags |= EV_EOF;
+		}
+
+		int nread;
+		if (kn->fd_type != KNOTE_FD_OTHER &&
+		    ioctl(fd, FIONREAD, &nread) == 0) {
+			kev->data = nread;
+		}
+	} else if (kn->filter == EVFILT_WRITE) {
+		if (revents & (EPOLLHUP | EPOLLERR)) {
+			kev->flags |= EV_EOF;
+		}
+
+		int queued;
+		if (kn->fd_type == KNOTE_FD_FIFO) {
+			int size = real_fcntl(fd, F_GETPIPE_SZ);
+			if (size > 0 && ioctl(fd, FIONREAD, &queued) == 0) {
+				kev->data = size - queued;
+			}
+		} else if (kn->fd_type == KNOTE_FD_SOCKET) {
+			int size;
+			if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size,
+				&(socklen_t) { sizeof(size) }) == 0 &&
+			    ioctl(fd, TIOCOUTQ, &queued) == 0) {
+				kev->data = size - queued;
+			}
+		}
+	} else {
+		kev->fflags = NOTE_OOB;
+	}
+
+	/*
+	 * BSD reports the pending socket error in "fflags". Reading
+	 * SO_ERROR would clear it, so only signal its presence.
+	 */
+	if ((revents & EPOLLERR) && kn->fd_type == KNOTE_FD_SOCKET) {
+		kev->fflags = EIO;
+	}
+}
+
+/*
+ * Linux signals EPOLLHUP (and EPOLLOUT) on sockets that are not connected
+ * yet, while on BSD such sockets are neither readable nor writable. The
+ * same holds for a socket whose peer shut down while its send buffer is
+ * full, which Linux reports as EPOLLRDHUP to a write filter.
+ */
+static bool
+knote_should_report(KNote const *kn, uint32_t revents)
+{
+	if (kn->fd_type != KNOTE_FD_SOCKET) {
+		return true;
+	}
+
+	if ((revents & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) == EPOLLHUP) {
+		return false;
+	}
+
+	if (kn->filter == EVFILT_WRITE &&
+	    (revents & (EPOLLOUT | EPOLLHUP | EPOLLERR)) == 0) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * While a knote should not be reported, switch its native registration to
+ * edge triggered mode so that the kqueue does not stay readable. It is
+ * switched back on the next state change of the socket.
+ */
+static void
+knote_fd_park(KQueue *kq, KNote *kn)
+{
+	if (kn->is_parked) {
+		return;
+	}
+
+	struct epoll_event ev = {
+		.events = knote_epoll_events(kn) | EPOLLET,
+		.data.ptr = kn,
+	};
+	if (sys_epoll_ctl(kq->filter_fds[filter_index(kn->filter)],
+		EPOLL_CTL_MOD, (int)kn->ident, &ev) == 0) {
+		kn->is_parked = true;
+	}
+}
+
+static void
+kqueue_knote_delivered(KQueue *kq, KNote *kn)
+{
+	if (kn->flags & EV_ONESHOT) {
+		kqueue_knote_destroy(kq, kn);
+	} else if (kn->flags & EV_DISPATCH) {
+		kn->is_disabled = true;
+		if (filter_index(kn->filter) >= 0) {
+			(void)knote_fd_disarm(kq, kn);
+		} else if (kn->filter == EVFILT_USER) {
+			kqueue_user_knote_update(kq, kn);
+		} else if (kn->filter == EVFILT_TIMER ||
+		    kn->filter == EVFILT_SIGNAL) {
+			knote_top_disarm(kq, kn);
+		}
+	}
+}
+
+static bool
+knote_is_zombie(KQueue *kq, KNote *kn)
+{
+	KNote *zombie;
+
+	LIST_FOREACH (zombie, &kq->zombie_knotes, active_entry) {
+		if (zombie == kn) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+kqueue_harvest_fd_filter(KQueue *kq, int idx, struct kevent *eventlist,
+    int nevents)
+{
+	struct epoll_event evs[32];
+	int n = 0;
+
+	while (n < nevents) {
+		int max = nevents - n;
+		if (max > 32) {
+			max = 32;
+		}
+
+		int nr = sys_epoll_poll(kq->filter_fds[idx], evs, max);
+		if (nr <= 0) {
+			break;
+		}
+
+		for (int i = 0; i < nr; ++i) {
+			KNote *kn = evs[i].data.ptr;
+			if (knote_is_zombie(kq, kn) || kn->is_disabled) {
+				continue;
+			}
+
+			if (!knote_should_report(kn, evs[i].events)) {
+				if (kn->flags & (EV_ONESHOT | EV_DISPATCH)) {
+					/* Undo the native one-shot. */
+					(void)knote_fd_arm(kq, kn, false);
+				}
+				knote_fd_park(kq, kn);
+				continue;
+			}
+
+			knote_fill_fd_event(kn, evs[i].events, &eventlist[n++]);
+			if (kn->is_parked) {
+				(void)knote_fd_arm(kq, kn, false);
+			}
+			kqueue_knote_delivered(kq, kn);
+		}
+
+		if (nr < max) {
+			break;
+		}
+	}
+
+	return n;
+}
+
+static int
+kqueue_harvest_user(KQueue *kq, struct kevent *eventlist, int nevents)
+{
+	int n = 0;
+	KNote *kn, *kn_tmp;
+
+	LIST_FOREACH_SAFE (kn, &kq->active_user_knotes, active_entry, kn_tmp) {
+		if (n == nevents) {
+			break;
+		}
+
+		eventlist[n++] = (struct kevent) {
+			.ident = kn->ident,
+			.filter = EVFILT_USER,
+			.flags = kn->flags,
+			.fflags = kn->fflags,
+			.data = kn->data,
+			.udata = kn->udata,
+		};
+
+		if (kn->flags & EV_CLEAR) {
+			kn->is_active = false;
+			kn->fflags = 0;
+			kn->data = 0;
+			kqueue_user_knote_update(kq, kn);
+		}
+		kqueue_knote_delivered(kq, kn);
+	}
+
+	return n;
+}
+
+static int
+kqueue_harvest(KQueue *kq, struct kevent *eventlist, int nevents)
+{
+	struct epoll_event evs[32];
+	int max = nevents < 32 ? nevents : 32;
+
+	int nr = sys_epoll_poll(kq->fd, evs, max);
+	if (nr <= 0) {
+		return 0;
+	}
+
+	int n = 0;
+	bool fd_filter_ready[NR_FD_FILTERS] = { false };
+	bool user_ready = false;
+
+	/*
+	 * Timers and signals produce at most one event each, and signals are
+	 * edge triggered. Handle them first so they are never dropped for
+	 * lack of space. The others are level triggered and will show up
+	 * again.
+	 */
+	for (int i = 0; i < nr; ++i) {
+		void *ptr = evs[i].data.ptr;
+
+		if (ptr == &kq->user_fd) {
+			user_ready = true;
+			continue;
+		}
+
+		bool is_fd_filter = false;
+		for (int j = 0; j < NR_FD_FILTERS; ++j) {
+			if (ptr == &kq->filter_fds[j]) {
+				fd_filter_ready[j] = true;
+				is_fd_filter = true;
+			}
+		}
+		if (is_fd_filter) {
+			continue;
+		}
+
+		KNote *kn = ptr;
+		int64_t data = 1;
+
+		if (kn->filter == EVFILT_TIMER) {
+			uint64_t expirations;
+			if (real_read(kn->fd, &expirations,
+				sizeof(expirations)) != sizeof(expirations)) {
+				continue;
+			}
+			data = expirations > INT64_MAX ? INT64_MAX :
+							 (int64_t)expirations;
+		}
+
+		eventlist[n++] = (struct kevent) {
+			.ident = kn->ident,
+			.filter = kn->filter,
+			.flags = kn->flags,
+			.fflags = kn->fflags,
+			.data = data,
+			.udata = kn->udata,
+		};
+		kqueue_knote_delivered(kq, kn);
+	}
+
+	for (int j = 0; j < NR_FD_FILTERS && n < nevents; ++j) {
+		if (fd_filter_ready[j]) {
+			n += kqueue_harvest_fd_filter(kq, j, eventlist + n,
+			    nevents - n);
+		}
+	}
+
+	if (user_ready && n < nevents) {
+		n += kqueue_harvest_user(kq, eventlist + n, nevents - n);
+	}
+
+	return n;
+}
+
+static errno_t
+compat_kevent_impl(int fd, struct kevent const *changelist, int nchanges,
+    struct kevent *eventlist, int nevents, struct timespec const *timeout,
+    int *n_out)
+{
+	errno_t ec = 0;
+
+	if (nchanges < 0 || nevents < 0 ||
+	    (timeout != NULL &&
+		(timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+		    timeout->tv_nsec >= 1000000000))) {
+		return EINVAL;
+	}
+
+	KQueue *kq = kqueue_find(fd);
+	if (kq == NULL) {
+		return EBADF;
+	}
+
+	(void)pthread_mutex_lock(&kq->mutex);
+
+	int nerrors = 0;
+	for (int i = 0; i < nchanges; ++i) {
+		/* "changelist" and "eventlist" may alias. */
+		struct kevent kev = changelist[i];
+
+		errno_t change_ec = kqueue_apply_change(kq, &kev);
+		if (change_ec == 0 && !(kev.flags & EV_RECEIPT)) {
+			continue;
+		}
+
+		if (nerrors < nevents) {
+			kev.flags = EV_ERROR;
+			kev.data = change_ec;
+			eventlist[nerrors++] = kev;
+		} else if (change_ec != 0) {
+			ec = change_ec;
+			(void)pthread_mutex_unlock(&kq->mutex);
+			goto out;
+		}
+	}
+
+	if (nerrors > 0 || nevents == 0) {
+		(void)pthread_mutex_unlock(&kq->mutex);
+		*n_out = nerrors;
+		goto out;
+	}
+
+	(void)pthread_mutex_unlock(&kq->mutex);
+
+	struct timespec deadline;
+	if (timeout != NULL) {
+		if (clock_gettime(CLOCK_MONOTONIC, &deadline) < 0) {
+			ec = errno;
+			goto out;
+		}
+		if (!timespecadd_safe(&deadline, timeout, &deadline)) {
+			timeout = NULL;
+		}
+	}
+
+	for (;;) {
+		(void)pthread_mutex_lock(&kq->mutex);
+		int n = kq->is_closed ? -1 : kqueue_harvest(kq, eventlist,
+						 nevents);
+		(void)pthread_mutex_unlock(&kq->mutex);
+
+		if (n < 0) {
+			ec = EBADF;
+			goto out;
+		}
+		if (n > 0) {
+			*n_out = n;
+			goto out;
+		}
+
+		struct timespec remaining;
+		if (timeout != NULL) {
+			struct timespec now;
+			if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+				ec = errno;
+				goto out;
+			}
+			timespecsub(&deadline, &now, &remaining);
+			if (remaining.tv_sec < 0 ||
+			    (remaining.tv_sec == 0 && remaining.tv_nsec == 0)) {
+				*n_out = 0;
+				goto out;
+			}
+		}
+
+		struct pollfd pfd = { .fd = kq->fd, .events = POLLIN };
+		if (real_ppoll(&pfd, 1, timeout != NULL ? &remaining : NULL,
+			NULL) < 0) {
+			ec = errno;
+			goto out;
+		}
+	}
+
+out:
+	kqueue_unref(kq);
+	return ec;
+}
+
+int
+compat_kevent(int kq, struct kevent const *changelist, int nchanges,
+    struct kevent *eventlist, int nevents, struct timespec const *timeout)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	int n = 0;
+	ec = compat_kevent_impl(kq, changelist, nchanges, eventlist, nevents,
+	    timeout, &n);
+
+	ERRNO_RETURN(ec, -1, n);
+}
@@ -0,0 +1,28 @@
+#ifndef COMPAT_KQUEUE_H
+#define COMPAT_KQUEUE_H
+
+#include <sys/types.h>
+
+#include <sys/event.h>
+
+#include <time.h>
+
+/*
+ * These stand in for the system calls and are exported, so that tests can
+ * interpose them just like 'kqueue' and 'kevent' from libc on the BSDs.
+ */
+__attribute__((visibility("default"))) int compat_kqueue(void);
+__attribute__((visibility("default"))) int compat_kevent(int kq,
+    struct kevent const *changelist, int nchanges, struct kevent *eventlist,
+    int nevents, struct timespec const *timeout);
+__attribute__((visibility("default"))) int compat_kqueue_close(int fd);
+
+#ifdef COMPAT_ENABLE_KQUEUE
+/* Function-like, so that "struct kevent" is left alone. */
+#define kqueue() compat_kqueue()
+#define kevent(...) compat_kevent(__VA_ARGS__)
+/* Closing a kqueue must release the state behind it. */
+#define real_close compat_kqueue_close
+#endif
+
+#endif
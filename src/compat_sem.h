@@ -12,6 +12,8 @@
 	(*(sem) = dispatch_semaphore_create(value))
 #define sem_post(sem) dispatch_semaphore_signal(*(sem))
 #define sem_wait(sem) dispatch_semaphore_wait(*(sem), DISPATCH_TIME_FOREVER)
+#define sem_trywait(sem) \
+	(dispatch_semaphore_wait(*(sem), DISPATCH_TIME_NOW) == 0 ? 0 : -1)
 #define sem_destroy(sem) dispatch_release(*(sem))
 #endif
 
@@ -51,4 +51,34 @@ compat_sigandset(sigset_t *dest, sigset_t const *left, sigset_t const *right)
 	}
 	return 0;
 }
+#else
+#ifndef _SIG_MAXSIG
+#define _SIG_MAXSIG (8 * sizeof(sigset_t))
+#endif
+
+int
+compat_sigisemptyset(sigset_t const *set)
+{
+	for (int i = 1; i <= (int)_SIG_MAXSIG; ++i) {
+		if (sigismember(set, i) == 1) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int
+compat_sigandset(sigset_t *dest, sigset_t const *left, sigset_t const *right)
+{
+	sigset_t result;
+
+	sigemptyset(&result);
+	for (int i = 1; i <= (int)_SIG_MAXSIG; ++i) {
+		if (sigismember(left, i) == 1 && sigismember(right, i) == 1) {
+			(void)sigaddset(&result, i);
+		}
+	}
+	memcpy(dest, &result, sizeof(sigset_t));
+	return 0;
+}
 #endif
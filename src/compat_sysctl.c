@@ -0,0 +1,137 @@
+#include "compat_sysctl.h"
+
+#include <sys/types.h>
+
+#include <sys/syscall.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timespec_util.h"
+#include "wrap.h"
+
+/*
+ * "kern.boottime" is used to detect steps of CLOCK_REALTIME. On Linux, the
+ * offset between CLOCK_REALTIME and CLOCK_MONOTONIC is computed once and
+ * cached. A TFD_TIMER_CANCEL_ON_SET timerfd tells us when the clock was set
+ * and the offset must be recomputed. This way, callers comparing the value
+ * for equality never see spurious steps.
+ *
+ * The timerfd lives for the whole process. It is moved to a high fd number
+ * so that it does not get in the way of tests checking for fd leaks.
+ */
+
+#define BOOTTIME_TIMERFD_MIN_FD 256
+
+static pthread_mutex_t boottime_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int boottime_timerfd = -1;
+static struct timeval boottime;
+
+static errno_t
+boottime_timerfd_create(void)
+{
+	int fd = (int)syscall(SYS_timerfd_create, CLOCK_REALTIME,
+	    TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		return errno;
+	}
+
+	int high_fd = real_fcntl(fd, F_DUPFD_CLOEXEC, BOOTTIME_TIMERFD_MIN_FD);
+	if (high_fd >= 0) {
+		(void)real_close(fd);
+		fd = high_fd;
+	}
+
+	boottime_timerfd = fd;
+	return 0;
+}
+
+static errno_t
+boottime_update(void)
+{
+	struct timespec realtime, monotonic, offset;
+
+	/* Arm first, so that no clock change can slip through. */
+	struct itimerspec its = { .it_value = { .tv_sec = INT32_MAX } };
+	if (syscall(SYS_timerfd_settime, boottime_timerfd,
+		TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+		return errno;
+	}
+
+	if (clock_gettime(CLOCK_REALTIME, &realtime) < 0 ||
+	    clock_gettime(CLOCK_MONOTONIC, &monotonic) < 0) {
+		return errno;
+	}
+
+	timespecsub(&realtime, &monotonic, &offset);
+	boottime = (struct timeval) {
+		.tv_sec = offset.tv_sec,
+		.tv_usec = offset.tv_nsec / 1000,
+	};
+	return 0;
+}
+
+static errno_t
+compat_sysctl_boottime(struct timeval *tv)
+{
+	errno_t ec = 0;
+
+	(void)pthread_mutex_lock(&boottime_mutex);
+
+	if (boottime_timerfd < 0) {
+		if ((ec = boottime_timerfd_create()) != 0 ||
+		    (ec = boottime_update()) != 0) {
+			goto out;
+		}
+	} else {
+		uint64_t expirations;
+		if (real_read(boottime_timerfd, &expirations,
+			sizeof(expirations)) < 0 &&
+		    errno == ECANCELED && (ec = boottime_update()) != 0) {
+			goto out;
+		}
+	}
+
+	*tv = boottime;
+
+out:
+	(void)pthread_mutex_unlock(&boottime_mutex);
+	return ec;
+}
+
+int
+compat_sysctl(int const *name, unsigned int namelen, void *oldp,
+    size_t *oldlenp, void const *newp, size_t newlen)
+{
+	errno_t ec;
+
+	if (namelen != 2 || name[0] != CTL_KERN || name[1] != KERN_BOOTTIME ||
+	    newp != NULL || newlen != 0) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (oldp == NULL || *oldlenp < sizeof(struct timeval)) {
+		*oldlenp = sizeof(struct timeval);
+		if (oldp != NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		return 0;
+	}
+
+	if ((ec = compat_sysctl_boottime(oldp)) != 0) {
+		errno = ec;
+		return -1;
+	}
+	*oldlenp = sizeof(struct timeval);
+	return 0;
+}
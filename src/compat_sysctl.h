@@ -0,0 +1,13 @@
+#ifndef COMPAT_SYSCTL_H
+#define COMPAT_SYSCTL_H
+
+#include <stddef.h>
+
+int compat_sysctl(int const *name, unsigned int namelen, void *oldp,
+    size_t *oldlenp, void const *newp, size_t newlen);
+
+#ifdef COMPAT_ENABLE_SYSCTL
+#define sysctl compat_sysctl
+#endif
+
+#endif
@@ -10,11 +10,18 @@
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#include <epoll-shim/dump.h>
+#include <epoll-shim/stats.h>
+#include <epoll-shim/wait_profile.h>
+
 #include "epoll_shim_ctx.h"
 #include "epoll_shim_export.h"
 #include "errno_return.h"
+#include "probes.h"
+#include "stats.h"
 #include "timespec_util.h"
 #include "wrap.h"
 
@@ -38,7 +45,7 @@ void
 epollfd_lock(FileDescription *desc)
 {
 	if (desc->vtable == &epollfd_vtable) {
-		(void)pthread_mutex_lock(&desc->mutex);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	}
 }
 
@@ -46,7 +53,7 @@ void
 epollfd_unlock(FileDescription *desc)
 {
 	if (desc->vtable == &epollfd_vtable) {
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	}
 }
 
@@ -156,10 +163,12 @@ epoll_ctl_impl(int fd, int op, int fd2, struct epoll_event *ev)
 	    epoll_shim_ctx_find_desc(epoll_shim_ctx, fd2) :
 	    NULL;
 
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+	stats_attribute_begin(&desc->ctx.epollfd.stats);
 	ec = epollfd_ctx_ctl(&desc->ctx.epollfd, fd, op, fd2,
 	    fd_as_pollable_desc(fd2_desc), ev);
-	(void)pthread_mutex_unlock(&desc->mutex);
+	stats_attribute_end();
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 
 	if (fd2_desc) {
 		(void)file_description_unref(&fd2_desc);
@@ -178,7 +187,9 @@ epoll_ctl(int fd, int op, int fd2, struct epoll_event *ev)
 	ERRNO_SAVE;
 	errno_t ec;
 
+	EPOLL_SHIM_EPOLL_CTL_ENTRY(fd, op, fd2, ev ? ev->events : 0);
 	ec = epoll_ctl_impl(fd, op, fd2, ev);
+	EPOLL_SHIM_EPOLL_CTL_RETURN(fd, op, fd2, ec);
 
 	ERRNO_RETURN(ec, -1, 0);
 }
@@ -192,22 +203,54 @@ epollfd_ctx_wait_or_block(FileDescription *desc, int kq, /**/
 	errno_t ec;
 
 	EpollFDCtx *epollfd = &desc->ctx.epollfd;
+	bool is_first_try = true;
+	bool has_woken_up = false;
+	/* Only used by profiling builds. */
+	uint64_t block_begin = 0;
+	uint64_t block_end = 0;
 
 	for (;;) {
-		(void)pthread_mutex_lock(&desc->mutex);
+		uint64_t lock_begin = lock_profile_now();
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+		wait_profile_record(&epollfd->wait_profile,
+		    WAIT_HISTOGRAM_MUTEX_WAIT, lock_profile_now() - lock_begin);
+		if (block_end != 0) {
+			wait_profile_record(&epollfd->wait_profile,
+			    WAIT_HISTOGRAM_BLOCK, block_end - block_begin);
+		}
+		stats_attribute_begin(&epollfd->stats);
+		if (is_first_try) {
+			stats_add(STAT_EPOLL_WAIT_CALLS, 1);
+			is_first_try = false;
+		}
 		ec = epollfd_ctx_wait(epollfd, kq, ev, cnt, actual_cnt);
-		(void)pthread_mutex_unlock(&desc->mutex);
+		if (ec == 0 && *actual_cnt == 0 && has_woken_up) {
+			stats_add(STAT_EMPTY_WAKEUPS, 1);
+		}
+		stats_attribute_end();
+		bool is_done = ec == 0 &&
+		    (*actual_cnt ||
+			(timeout && timeout->tv_sec == 0 &&
+			    timeout->tv_nsec == 0));
+		if (is_done) {
+			wait_profile_record(&epollfd->wait_profile,
+			    WAIT_HISTOGRAM_EVENTS, (uint64_t)*actual_cnt);
+			if (*actual_cnt && has_woken_up) {
+				wait_profile_record(&epollfd->wait_profile,
+				    WAIT_HISTOGRAM_WAKEUP_TO_RETURN,
+				    lock_profile_now() - block_end);
+			}
+		}
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		if (ec != 0) {
 			return ec;
 		}
 
-		if (*actual_cnt ||
-		    (timeout && timeout->tv_sec == 0 &&
-			timeout->tv_nsec == 0)) {
+		if (is_done) {
 			return 0;
 		}
 
-		(void)pthread_mutex_lock(&desc->mutex);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 
 		nfds_t nfds = (nfds_t)(1 + epollfd->poll_fds_size);
 
@@ -215,24 +258,28 @@ epollfd_ctx_wait_or_block(FileDescription *desc, int kq, /**/
 		if (__builtin_mul_overflow(nfds, sizeof(struct pollfd),
 			&size)) {
 			ec = ENOMEM;
-			(void)pthread_mutex_unlock(&desc->mutex);
+			profiled_mutex_unlock(&desc->mutex,
+			    LOCK_CLASS_DESC_MUTEX);
 			return ec;
 		}
 
 		struct pollfd *pfds = malloc(size);
 		if (!pfds) {
 			ec = errno;
-			(void)pthread_mutex_unlock(&desc->mutex);
+			profiled_mutex_unlock(&desc->mutex,
+			    LOCK_CLASS_DESC_MUTEX);
 			return ec;
 		}
 
 		epollfd_ctx_fill_pollfds(epollfd, kq, pfds);
 
-		(void)pthread_mutex_lock(&epollfd->nr_polling_threads_mutex);
+		profiled_mutex_lock(&epollfd->nr_polling_threads_mutex,
+		    LOCK_CLASS_POLLING_THREADS_MUTEX);
 		++epollfd->nr_polling_threads;
-		(void)pthread_mutex_unlock(&epollfd->nr_polling_threads_mutex);
+		profiled_mutex_unlock(&epollfd->nr_polling_threads_mutex,
+		    LOCK_CLASS_POLLING_THREADS_MUTEX);
 
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 
 		/*
 		 * This surfaced a race condition when
@@ -243,20 +290,27 @@ epollfd_ctx_wait_or_block(FileDescription *desc, int kq, /**/
 		usleep(500000);
 #endif
 
+		EPOLL_SHIM_BLOCK_ENTRY(epollfd, (int)nfds);
+		block_begin = lock_profile_now();
 		int n = real_ppoll(pfds, nfds, timeout, sigs);
 		if (n < 0) {
 			ec = errno;
 		}
+		block_end = lock_profile_now();
+		EPOLL_SHIM_BLOCK_RETURN(epollfd, n);
+		has_woken_up = n > 0;
 
 		free(pfds);
 
-		(void)pthread_mutex_lock(&epollfd->nr_polling_threads_mutex);
+		profiled_mutex_lock(&epollfd->nr_polling_threads_mutex,
+		    LOCK_CLASS_POLLING_THREADS_MUTEX);
 		--epollfd->nr_polling_threads;
 		if (epollfd->nr_polling_threads == 0) {
 			(void)pthread_cond_signal(
 			    &epollfd->nr_polling_threads_cond);
 		}
-		(void)pthread_mutex_unlock(&epollfd->nr_polling_threads_mutex);
+		profiled_mutex_unlock(&epollfd->nr_polling_threads_mutex,
+		    LOCK_CLASS_POLLING_THREADS_MUTEX);
 
 		if (n < 0) {
 			return ec;
@@ -363,3 +417,169 @@ epoll_wait(int fd, struct epoll_event *ev, int cnt, int to)
 {
 	return epoll_pwait(fd, ev, cnt, to, NULL);
 }
+
+static errno_t
+epoll_shim_get_epollfd_stats_impl(int fd, struct epoll_shim_stats *stats)
+{
+	errno_t ec;
+
+	if (!stats) {
+		return EFAULT;
+	}
+
+	EpollShimCtx *epoll_shim_ctx;
+	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
+		return ec;
+	}
+
+	FileDescription *desc = epoll_shim_ctx_find_desc(epoll_shim_ctx, fd);
+	if (!desc || desc->vtable != &epollfd_vtable) {
+		struct stat sb;
+		ec = (fd < 0 || fstat(fd, &sb) < 0) ? EBADF : EINVAL;
+		goto out;
+	}
+
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+	memcpy(stats, &desc->ctx.epollfd.stats, sizeof(*stats));
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+
+out:
+	if (desc) {
+		(void)file_description_unref(&desc);
+	}
+	return ec;
+}
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_get_epollfd_stats(int fd, struct epoll_shim_stats *stats)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	ec = epoll_shim_get_epollfd_stats_impl(fd, stats);
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
+_Static_assert(sizeof(struct epoll_shim_wait_histogram) ==
+	sizeof(WaitHistogram),
+    "");
+_Static_assert(EPOLL_SHIM_WAIT_HISTOGRAM_COUNT == WAIT_HISTOGRAM_COUNT, "");
+
+static errno_t
+epoll_shim_get_wait_histogram_impl(int fd, int kind,
+    struct epoll_shim_wait_histogram *histogram)
+{
+	errno_t ec;
+
+	if (!histogram) {
+		return EFAULT;
+	}
+
+	EpollShimCtx *epoll_shim_ctx;
+	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
+		return ec;
+	}
+
+	FileDescription *desc = epoll_shim_ctx_find_desc(epoll_shim_ctx, fd);
+	if (!desc || desc->vtable != &epollfd_vtable) {
+		struct stat sb;
+		ec = (fd < 0 || fstat(fd, &sb) < 0) ? EBADF : EINVAL;
+		goto out;
+	}
+
+	WaitHistogram result;
+	ec = wait_profile_get(&desc->ctx.epollfd.wait_profile, kind, &result);
+	if (ec == 0) {
+		memcpy(histogram, &result, sizeof(*histogram));
+	}
+
+out:
+	if (desc) {
+		(void)file_description_unref(&desc);
+	}
+	return ec;
+}
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_get_wait_histogram(int fd, int kind,
+    struct epoll_shim_wait_histogram *histogram)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	ec = epoll_shim_get_wait_histogram_impl(fd, kind, histogram);
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
+static errno_t
+epoll_shim_dump_impl(int fd, FILE *out, bool is_json)
+{
+	errno_t ec;
+
+	if (!out) {
+		return EFAULT;
+	}
+
+	EpollShimCtx *epoll_shim_ctx;
+	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
+		return ec;
+	}
+
+	FileDescription *desc = epoll_shim_ctx_find_desc(epoll_shim_ctx, fd);
+	if (!desc || desc->vtable != &epollfd_vtable) {
+		struct stat sb;
+		ec = (fd < 0 || fstat(fd, &sb) < 0) ? EBADF : EINVAL;
+		goto out;
+	}
+
+	/*
+	 * Writing to 'out' might block (or even call back into the shim), so
+	 * it must not happen with the mutex held.
+	 */
+	EpollFDCtxSnapshot snapshot;
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+	ec = epollfd_ctx_snapshot(&desc->ctx.epollfd, &snapshot);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+
+	if (ec == 0) {
+		epollfd_ctx_snapshot_dump(&snapshot, fd, out, is_json);
+		if (ferror(out)) {
+			ec = EIO;
+		}
+	}
+	epollfd_ctx_snapshot_terminate(&snapshot);
+
+out:
+	if (desc) {
+		(void)file_description_unref(&desc);
+	}
+	return ec;
+}
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_dump(int fd, FILE *out)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	ec = epoll_shim_dump_impl(fd, out, false);
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_dump_json(int fd, FILE *out)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	ec = epoll_shim_dump_impl(fd, out, true);
+
+	ERRNO_RETURN(ec, -1, 0);
+}
@@ -20,8 +20,14 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <epoll-shim/detail/fd_bitmap.h>
+#include <epoll-shim/lock_profile.h>
+#include <epoll-shim/stats.h>
+#include <epoll-shim/wait_profile.h>
+
 #include "epoll_shim_export.h"
 #include "errno_return.h"
+#include "stats.h"
 #include "timespec_util.h"
 #include "wrap.h"
 
@@ -183,6 +189,7 @@ struct epoll_shim_ctx {
 
 	/* members for realtime timer change detection */
 	pthread_mutex_t step_detector_mutex;
+	LIST_HEAD(, file_description_) realtime_change_descs;
 	uint64_t nr_fds_for_realtime_step_detector;
 	uint64_t realtime_step_detector_generation;
 };
@@ -193,6 +200,7 @@ epoll_shim_ctx_init(EpollShimCtx *epoll_shim_ctx)
 	errno_t ec;
 
 	*epoll_shim_ctx = (EpollShimCtx) {};
+	LIST_INIT(&epoll_shim_ctx->realtime_change_descs);
 
 	if ((ec = pthread_mutex_init(/**/
 		 &epoll_shim_ctx->step_detector_mutex, NULL)) != 0) {
@@ -234,6 +242,34 @@ epoll_shim_ctx_global(EpollShimCtx **epoll_shim_ctx_out)
 
 /**/
 
+EPOLL_SHIM_EXPORT
+volatile unsigned long epoll_shim_fd_bitmap[EPOLL_SHIM_FD_BITMAP_NR_FDS /
+    EPOLL_SHIM_FD_BITMAP_WORD_BITS];
+
+/*
+ * Must be called with the write lock held. The bit of a new descriptor is set
+ * before it is handed out, so the inline wrappers in the headers never bypass
+ * the shim for it.
+ */
+static void
+epoll_shim_ctx_mark_fd(int fd, bool is_shimmed)
+{
+	if (fd < 0 || fd >= EPOLL_SHIM_FD_BITMAP_NR_FDS) {
+		return;
+	}
+
+	volatile unsigned long *word = &epoll_shim_fd_bitmap[(unsigned)fd /
+	    EPOLL_SHIM_FD_BITMAP_WORD_BITS];
+	unsigned long mask = 1UL
+	    << (unsigned)fd % EPOLL_SHIM_FD_BITMAP_WORD_BITS;
+
+	if (is_shimmed) {
+		(void)__atomic_fetch_or(word, mask, __ATOMIC_RELEASE);
+	} else {
+		(void)__atomic_fetch_and(word, ~mask, __ATOMIC_RELAXED);
+	}
+}
+
 errno_t
 epoll_shim_ctx_create_desc(EpollShimCtx *epoll_shim_ctx, int flags, /**/
     int *fd, FileDescription **desc)
@@ -311,6 +347,7 @@ epoll_shim_ctx_install_desc(EpollShimCtx *epoll_shim_ctx, /**/
 {
 	assert((unsigned int)fd < epoll_shim_ctx->open_files_length);
 	epoll_shim_ctx->open_files[fd] = desc;
+	epoll_shim_ctx_mark_fd(fd, true);
 	rwlock_unlock_write(&epoll_shim_ctx->rwlock);
 }
 
@@ -394,6 +431,7 @@ epoll_shim_ctx_remove_desc(EpollShimCtx *epoll_shim_ctx, int fd)
 		desc = epoll_shim_ctx_find_desc_impl(epoll_shim_ctx, fd);
 		if (desc) {
 			epoll_shim_ctx->open_files[fd] = NULL;
+			epoll_shim_ctx_mark_fd(fd, false);
 		}
 	}
 	rwlock_downgrade(&epoll_shim_ctx->rwlock);
@@ -437,6 +475,54 @@ trigger_realtime_change_notification(FileDescription *desc, int kq, void *arg)
 	}
 }
 
+/*
+ * Must be called with the read lock held, so that the monitored descriptors
+ * stay in the file table.
+ */
+static void
+epoll_shim_ctx_notify_realtime_change(EpollShimCtx *epoll_shim_ctx)
+{
+	/*
+	 * The notification callbacks take the descriptor mutex, which is held
+	 * while calling 'epoll_shim_ctx_update_realtime_change_monitoring'.
+	 * Therefore, collect the descriptors first and call the callbacks
+	 * without holding the step detector mutex.
+	 */
+	(void)pthread_mutex_lock(&epoll_shim_ctx->step_detector_mutex);
+	uint64_t nr_descs = epoll_shim_ctx->nr_fds_for_realtime_step_detector;
+	int *kqs = nr_descs <= SIZE_MAX / sizeof(int) ?
+	    malloc((size_t)nr_descs * sizeof(int)) :
+	    NULL;
+	size_t nr_kqs = 0;
+	if (kqs != NULL) {
+		FileDescription *desc;
+		LIST_FOREACH (desc, &epoll_shim_ctx->realtime_change_descs,
+		    realtime_change_entry) {
+			assert(nr_kqs < nr_descs);
+			kqs[nr_kqs++] = desc->realtime_change_kq;
+		}
+	}
+	(void)pthread_mutex_unlock(&epoll_shim_ctx->step_detector_mutex);
+
+	if (kqs == NULL) {
+		/* Out of memory, fall back to notifying everyone. */
+		epoll_shim_ctx_for_each_unlocked(epoll_shim_ctx,
+		    trigger_realtime_change_notification, NULL);
+		return;
+	}
+
+	for (size_t i = 0; i < nr_kqs; ++i) {
+		FileDescription *desc = epoll_shim_ctx_find_desc_impl(
+		    epoll_shim_ctx, kqs[i]);
+		if (desc != NULL) {
+			trigger_realtime_change_notification(desc, kqs[i],
+			    NULL);
+		}
+	}
+
+	free(kqs);
+}
+
 struct realtime_step_detection_args {
 	EpollShimCtx *epoll_shim_ctx;
 	uint64_t generation;
@@ -481,8 +567,7 @@ realtime_step_detection(void *arg)
 			monotonic_offset = new_monotonic_offset;
 
 			rwlock_lock_read(&epoll_shim_ctx->rwlock);
-			epoll_shim_ctx_for_each_unlocked(epoll_shim_ctx,
-			    trigger_realtime_change_notification, NULL);
+			epoll_shim_ctx_notify_realtime_change(epoll_shim_ctx);
 			rwlock_unlock_read(&epoll_shim_ctx->rwlock);
 		}
 	}
@@ -538,33 +623,35 @@ out:
 
 void
 epoll_shim_ctx_update_realtime_change_monitoring(EpollShimCtx *epoll_shim_ctx,
-    int change)
+    FileDescription *desc, int kq, bool needs_monitoring)
 {
-	if (change == 0) {
-		return;
-	}
-
 	(void)pthread_mutex_lock(&epoll_shim_ctx->step_detector_mutex);
-	uint64_t old_nr_fds = epoll_shim_ctx->nr_fds_for_realtime_step_detector;
-	if (change < 0) {
-		assert(old_nr_fds >= (uint64_t)-change);
-
-		epoll_shim_ctx->nr_fds_for_realtime_step_detector -=
-		    (uint64_t)-change;
+	if (desc->is_realtime_change_monitored == needs_monitoring) {
+		goto out;
+	}
 
-		if (epoll_shim_ctx->nr_fds_for_realtime_step_detector == 0) {
-			++epoll_shim_ctx->realtime_step_detector_generation;
-		}
-	} else {
-		epoll_shim_ctx->nr_fds_for_realtime_step_detector += /**/
-		    (uint64_t)change;
+	if (needs_monitoring) {
+		desc->realtime_change_kq = kq;
+		LIST_INSERT_HEAD(&epoll_shim_ctx->realtime_change_descs, desc,
+		    realtime_change_entry);
 
-		if (old_nr_fds == 0) {
+		if (epoll_shim_ctx->nr_fds_for_realtime_step_detector++ == 0) {
 			/* best effort */
 			(void)epoll_shim_ctx_start_realtime_step_detection(
 			    epoll_shim_ctx);
 		}
+	} else {
+		assert(epoll_shim_ctx->nr_fds_for_realtime_step_detector > 0);
+
+		LIST_REMOVE(desc, realtime_change_entry);
+
+		if (--epoll_shim_ctx->nr_fds_for_realtime_step_detector == 0) {
+			++epoll_shim_ctx->realtime_step_detector_generation;
+		}
 	}
+	desc->is_realtime_change_monitored = needs_monitoring;
+
+out:
 	(void)pthread_mutex_unlock(&epoll_shim_ctx->step_detector_mutex);
 }
 #endif
@@ -817,7 +904,7 @@ epoll_shim_fcntl(int fd, int cmd, ...)
 		int arg = va_arg(ap, int);
 		va_end(ap);
 
-		(void)pthread_mutex_lock(&desc->mutex);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		{
 			int opt = (arg & O_NONBLOCK) ? 1 : 0;
 			ec = ioctl(fd, FIONBIO, &opt) < 0 ? errno : 0;
@@ -827,11 +914,11 @@ epoll_shim_fcntl(int fd, int cmd, ...)
 				desc->flags = arg & O_NONBLOCK;
 			}
 		}
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	} else {
 		assert(cmd == F_GETFL);
 
-		(void)pthread_mutex_lock(&desc->mutex);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		{
 			result = real_fcntl(fd, F_GETFL, 0);
 			ec = result < 0 ? errno : 0;
@@ -844,9 +931,97 @@ epoll_shim_fcntl(int fd, int cmd, ...)
 				result |= desc->flags & O_NONBLOCK;
 			}
 		}
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	}
 
 	(void)file_description_unref(&desc);
 	ERRNO_RETURN(ec, -1, result);
 }
+
+_Static_assert(sizeof(struct epoll_shim_lock_profile) == sizeof(LockProfile),
+    "");
+_Static_assert(EPOLL_SHIM_LOCK_CLASS_COUNT == LOCK_CLASS_COUNT, "");
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_lock_profile_get(int lock_class,
+    struct epoll_shim_lock_profile *profile)
+{
+	ERRNO_SAVE;
+
+	LockProfile lock_profile;
+	errno_t ec = lock_profile_get(lock_class, &lock_profile);
+	if (ec == 0) {
+		*profile = (struct epoll_shim_lock_profile) {
+			.acquisitions = lock_profile.acquisitions,
+			.contended_acquisitions =
+			    lock_profile.contended_acquisitions,
+			.wait_ns = lock_profile.wait_ns,
+			.hold_ns = lock_profile.hold_ns,
+		};
+		memcpy(profile->wait_histogram, lock_profile.wait_histogram,
+		    sizeof(profile->wait_histogram));
+		memcpy(profile->hold_histogram, lock_profile.hold_histogram,
+		    sizeof(profile->hold_histogram));
+	}
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
+_Static_assert(sizeof(struct epoll_shim_phase_profile) ==
+	sizeof(PhaseProfile),
+    "");
+_Static_assert(EPOLL_SHIM_PHASE_COUNT == PROFILE_PHASE_COUNT, "");
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_phase_profile_get(int phase,
+    struct epoll_shim_phase_profile *profile)
+{
+	ERRNO_SAVE;
+
+	PhaseProfile phase_profile;
+	errno_t ec = lock_profile_phase_get(phase, &phase_profile);
+	if (ec == 0) {
+		*profile = (struct epoll_shim_phase_profile) {
+			.calls = phase_profile.calls,
+			.ns = phase_profile.ns,
+		};
+	}
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
+EPOLL_SHIM_EXPORT
+void
+epoll_shim_lock_profile_reset(void)
+{
+	lock_profile_reset();
+}
+
+EPOLL_SHIM_EXPORT
+int
+epoll_shim_get_stats(struct epoll_shim_stats *stats)
+{
+	ERRNO_SAVE;
+	errno_t ec = stats ? 0 : EFAULT;
+
+	if (ec == 0) {
+		Stats result;
+		stats_get(&result);
+		memcpy(stats, &result, sizeof(*stats));
+	}
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
+EPOLL_SHIM_EXPORT
+uint64_t
+epoll_shim_wait_histogram_bucket_min(int bucket)
+{
+	if (bucket < 0 || bucket >= EPOLL_SHIM_WAIT_HISTOGRAM_BUCKETS) {
+		return 0;
+	}
+
+	return wait_profile_bucket_min((unsigned int)bucket);
+}
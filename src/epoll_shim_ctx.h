@@ -1,6 +1,7 @@
 #ifndef EPOLL_SHIM_CTX_H_
 #define EPOLL_SHIM_CTX_H_
 
+#include <sys/queue.h>
 #include <sys/tree.h>
 
 #include <stdatomic.h>
@@ -13,10 +14,11 @@
 #include "signalfd_ctx.h"
 #include "timerfd_ctx.h"
 
+#include "lock_profile.h"
 #include "rwlock.h"
 
 struct file_description_vtable;
-typedef struct {
+typedef struct file_description_ {
 	atomic_int refcount;
 	pthread_mutex_t mutex;
 	int flags; /* Only for O_NONBLOCK right now. */
@@ -27,6 +29,14 @@ typedef struct {
 		SignalFDCtx signalfd;
 	} ctx;
 	struct file_description_vtable const *vtable;
+
+	/*
+	 * Membership in the list of descriptors that must be notified of
+	 * realtime clock steps. Protected by the step detector mutex.
+	 */
+	LIST_ENTRY(file_description_) realtime_change_entry;
+	bool is_realtime_change_monitored;
+	int realtime_change_kq;
 } FileDescription;
 
 errno_t file_description_unref(FileDescription **desc);
@@ -70,7 +80,7 @@ void epoll_shim_ctx_drop_desc(EpollShimCtx *epoll_shim_ctx, /**/
 
 void
 epoll_shim_ctx_update_realtime_change_monitoring(EpollShimCtx *epoll_shim_ctx,
-    int change);
+    FileDescription *desc, int kq, bool needs_monitoring);
 
 /**/
 
@@ -19,10 +19,33 @@
 
 #include <limits.h>
 #include <poll.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "lock_profile.h"
+#include "probes.h"
+#include "stats.h"
 #include "wrap.h"
 
+static int
+counted_kevent(int kq, struct kevent const *changelist, int nchanges,
+    struct kevent *eventlist, int nevents, struct timespec const *timeout)
+{
+	stats_add(STAT_KEVENT_CALLS, 1);
+	stats_add(STAT_KEVENT_CHANGES, (uint64_t)nchanges);
+	return kevent(kq, changelist, nchanges, eventlist, nevents, timeout);
+}
+
+static uint64_t
+monotonic_now_ns(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
 static RegisteredFDsNode *
 registered_fds_node_create(int fd)
 {
@@ -62,6 +85,7 @@ typedef struct {
 static NeededFilters
 get_needed_filters(RegisteredFDsNode *fd2_node)
 {
+	uint64_t phase_begin = lock_profile_now();
 	NeededFilters needed_filters;
 
 	needed_filters.evfilt_except = 0;
@@ -209,6 +233,7 @@ out:
 	    needed_filters.evfilt_except == 1 ||
 	    needed_filters.evfilt_except == EV_CLEAR);
 
+	lock_profile_phase_end(PROFILE_PHASE_GET_NEEDED_FILTERS, phase_begin);
 	return needed_filters;
 }
 
@@ -258,7 +283,7 @@ registered_fds_node_add_self_trigger(RegisteredFDsNode *fd2_node, int kq)
 	    EV_ADD | EV_CLEAR, 0, 0, fd2_node);
 #endif
 
-	if (kevent(kq, kevs, 1, NULL, 0, NULL) < 0) {
+	if (counted_kevent(kq, kevs, 1, NULL, 0, NULL) < 0) {
 		return errno;
 	}
 
@@ -272,7 +297,7 @@ registered_fds_node_trigger_self(RegisteredFDsNode *fd2_node, int kq)
 	struct kevent kevs[1];
 	EV_SET(&kevs[0], (uintptr_t)fd2_node, EVFILT_USER, /**/
 	    0, NOTE_TRIGGER, 0, fd2_node);
-	(void)kevent(kq, kevs, 1, NULL, 0, NULL);
+	(void)counted_kevent(kq, kevs, 1, NULL, 0, NULL);
 #else
 	(void)kq;
 	assert(fd2_node->self_pipe[1] >= 0);
@@ -304,6 +329,7 @@ registered_fds_node_feed_event(RegisteredFDsNode *fd2_node, int kq,
 			.events = (short)fd2_node->events,
 		};
 
+		stats_add(STAT_REPOLLS, 1);
 		revents = real_poll(&pfd, 1, 0) < 0 ? EPOLLERR : pfd.revents;
 
 		fd2_node->revents = revents & POLLNVAL ? 0 : (uint32_t)revents;
@@ -339,7 +365,7 @@ registered_fds_node_feed_event(RegisteredFDsNode *fd2_node, int kq,
 			(needed_filters.evfilt_write & EV_CLEAR) | EV_RECEIPT),
 		    0, 0, fd2_node);
 
-		if (kevent(kq, nkev, 1, nkev, 1, NULL) != 1 ||
+		if (counted_kevent(kq, nkev, 1, nkev, 1, NULL) != 1 ||
 		    nkev[0].data != 0) {
 			revents = EPOLLERR | EPOLLOUT;
 
@@ -402,9 +428,9 @@ registered_fds_node_feed_event(RegisteredFDsNode *fd2_node, int kq,
 
 				bool need_reset = false;
 
-				if (kevent(tmp_kq, &kev, 1, NULL, 0, NULL) ==
-					0 &&
-				    kevent(tmp_kq, NULL, 0, &kev, 1,
+				if (counted_kevent(tmp_kq, &kev, 1, NULL, 0,
+					NULL) == 0 &&
+				    counted_kevent(tmp_kq, NULL, 0, &kev, 1,
 					&(struct timespec) { 0, 0 }) == 1 &&
 				    (kev.fflags & NOTE_OOB)) {
 					revents |= EPOLLPRI;
@@ -425,13 +451,13 @@ registered_fds_node_feed_event(RegisteredFDsNode *fd2_node, int kq,
 				if (need_reset) {
 					EV_SET(&kev, fd2_node->fd,
 					    EVFILT_EXCEPT, EV_DELETE, 0, 0, 0);
-					(void)kevent(kq, &kev, 1, NULL, 0,
-					    NULL);
+					(void)counted_kevent(kq, &kev, 1, NULL,
+					    0, NULL);
 					EV_SET(&kev, fd2_node->fd,
 					    EVFILT_EXCEPT, EV_ADD | EV_CLEAR,
 					    NOTE_OOB, 0, fd2_node);
-					(void)kevent(kq, &kev, 1, NULL, 0,
-					    NULL);
+					(void)counted_kevent(kq, &kev, 1, NULL,
+					    0, NULL);
 				}
 			}
 		}
@@ -582,6 +608,9 @@ maybe_translate_rdhup:
 		fd2_node->revents &= ~EPOLLRDHUP;
 		fd2_node->revents |= 0x2000;
 	}
+
+	EPOLL_SHIM_FEED_EVENT((int)kev->ident, kev->filter, kev->flags,
+	    fd2_node->revents);
 }
 
 static void
@@ -614,10 +643,11 @@ registered_fds_node_register_for_completion(int *kq,
 
 	if (*kq < 0) {
 		*kq = kqueue1(O_CLOEXEC);
+		stats_add(STAT_COMPLETION_KQUEUES, 1);
 	}
 
 	if (*kq >= 0) {
-		(void)kevent(*kq, kev, n, kev, n, NULL);
+		(void)counted_kevent(*kq, kev, n, kev, n, NULL);
 	}
 }
 
@@ -631,13 +661,16 @@ registered_fds_node_complete(int kq)
 	struct kevent kevs[32];
 	int n;
 
-	while ((n = kevent(kq, /**/
+	while ((n = counted_kevent(kq, /**/
 		    NULL, 0, kevs, 32, &(struct timespec) { 0, 0 })) > 0) {
 		for (int i = 0; i < n; ++i) {
 			RegisteredFDsNode *fd2_node =
 			    (RegisteredFDsNode *)kevs[i].udata;
 
+			uint64_t phase_begin = lock_profile_now();
 			registered_fds_node_feed_event(fd2_node, -1, &kevs[i]);
+			lock_profile_phase_end(PROFILE_PHASE_FEED_EVENT,
+			    phase_begin);
 		}
 	}
 
@@ -676,6 +709,8 @@ epollfd_ctx_init(EpollFDCtx *epollfd)
 		return ec;
 	}
 
+	wait_profile_init(&epollfd->wait_profile);
+
 	return 0;
 }
 
@@ -685,6 +720,8 @@ epollfd_ctx_terminate(EpollFDCtx *epollfd)
 	errno_t ec = 0;
 	errno_t ec_local;
 
+	wait_profile_terminate(&epollfd->wait_profile);
+
 	ec_local = pthread_cond_destroy(&epollfd->nr_polling_threads_cond);
 	ec = ec ? ec : ec_local;
 	ec_local = pthread_mutex_destroy(&epollfd->nr_polling_threads_mutex);
@@ -782,7 +819,7 @@ epollfd_ctx__add_self_trigger(EpollFDCtx *epollfd, int kq)
 	    EV_ADD | EV_CLEAR, 0, 0, 0);
 #endif
 
-	if (kevent(kq, kevs, 1, NULL, 0, NULL) < 0) {
+	if (counted_kevent(kq, kevs, 1, NULL, 0, NULL) < 0) {
 		return errno;
 	}
 
@@ -796,7 +833,7 @@ epollfd_ctx__trigger_self(EpollFDCtx *epollfd, int kq)
 	(void)epollfd;
 	struct kevent kevs[1];
 	EV_SET(&kevs[0], 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
-	(void)kevent(kq, kevs, 1, NULL, 0, NULL);
+	(void)counted_kevent(kq, kevs, 1, NULL, 0, NULL);
 #else
 	assert(epollfd->self_pipe[0] >= 0);
 	assert(epollfd->self_pipe[1] >= 0);
@@ -809,22 +846,28 @@ epollfd_ctx__trigger_self(EpollFDCtx *epollfd, int kq)
 static void
 epollfd_ctx__trigger_repoll(EpollFDCtx *epollfd, int kq)
 {
-	(void)pthread_mutex_lock(&epollfd->nr_polling_threads_mutex);
+	profiled_mutex_lock(&epollfd->nr_polling_threads_mutex,
+	    LOCK_CLASS_POLLING_THREADS_MUTEX);
 	unsigned long nr_polling_threads = epollfd->nr_polling_threads;
-	(void)pthread_mutex_unlock(&epollfd->nr_polling_threads_mutex);
+	profiled_mutex_unlock(&epollfd->nr_polling_threads_mutex,
+	    LOCK_CLASS_POLLING_THREADS_MUTEX);
 
 	if (nr_polling_threads == 0) {
 		return;
 	}
 
+	stats_add(STAT_REPOLL_WAITS, 1);
 	epollfd_ctx__trigger_self(epollfd, kq);
 
-	(void)pthread_mutex_lock(&epollfd->nr_polling_threads_mutex);
+	profiled_mutex_lock(&epollfd->nr_polling_threads_mutex,
+	    LOCK_CLASS_POLLING_THREADS_MUTEX);
 	while (epollfd->nr_polling_threads != 0) {
-		pthread_cond_wait(&epollfd->nr_polling_threads_cond,
-		    &epollfd->nr_polling_threads_mutex);
+		(void)profiled_cond_wait(&epollfd->nr_polling_threads_cond,
+		    &epollfd->nr_polling_threads_mutex,
+		    LOCK_CLASS_POLLING_THREADS_MUTEX);
 	}
-	(void)pthread_mutex_unlock(&epollfd->nr_polling_threads_mutex);
+	profiled_mutex_unlock(&epollfd->nr_polling_threads_mutex,
+	    LOCK_CLASS_POLLING_THREADS_MUTEX);
 
 #ifndef EVFILT_USER
 	char c[32];
@@ -850,7 +893,7 @@ epollfd_ctx__remove_node_from_kq(EpollFDCtx *epollfd, int kq,
 		struct kevent kevs[1];
 		EV_SET(&kevs[0], (unsigned int)fd2_node->self_pipe[0],
 		    EVFILT_READ, EV_DELETE, 0, 0, 0);
-		(void)kevent(kq, kevs, 1, NULL, 0, NULL);
+		(void)counted_kevent(kq, kevs, 1, NULL, 0, NULL);
 
 		char c[32];
 		while (real_read(fd2_node->self_pipe[0], c, sizeof(c)) >= 0) {
@@ -862,7 +905,7 @@ epollfd_ctx__remove_node_from_kq(EpollFDCtx *epollfd, int kq,
 		struct kevent kevs[1];
 		EV_SET(&kevs[0], (uintptr_t)fd2_node, EVFILT_USER, /**/
 		    EV_DELETE, 0, 0, 0);
-		(void)kevent(kq, kevs, 1, NULL, 0, NULL);
+		(void)counted_kevent(kq, kevs, 1, NULL, 0, NULL);
 #endif
 	} else {
 		struct kevent kevs[3];
@@ -876,7 +919,7 @@ epollfd_ctx__remove_node_from_kq(EpollFDCtx *epollfd, int kq,
 		EV_SET(&kevs[2], (uintptr_t)fd2_node, EVFILT_USER, /**/
 		    EV_DELETE | EV_RECEIPT, 0, 0, 0);
 #endif
-		(void)kevent(kq, kevs, 3, kevs, 3, NULL);
+		(void)counted_kevent(kq, kevs, 3, kevs, 3, NULL);
 
 		fd2_node->has_evfilt_read = false;
 		fd2_node->has_evfilt_write = false;
@@ -970,7 +1013,7 @@ epollfd_ctx__register_events(EpollFDCtx *epollfd, int kq,
 			kev[i].flags |= EV_RECEIPT;
 		}
 
-		int ret = kevent(kq, kev, n, kev, n, NULL);
+		int ret = counted_kevent(kq, kev, n, kev, n, NULL);
 		if (ret < 0) {
 			ec = errno;
 			goto out;
@@ -1121,7 +1164,7 @@ epollfd_ctx_add_node(EpollFDCtx *epollfd, int kq, int fd2,
 			 * On FreeBSD we need to distinguish between kqueues
 			 * and native eventfds.
 			 */
-			if (kevent(fd2_node->fd, NULL, 0, NULL, 0,
+			if (counted_kevent(fd2_node->fd, NULL, 0, NULL, 0,
 				&(struct timespec) { 0, 0 }) == 0) {
 				fd2_node->node_type = NODE_TYPE_KQUEUE;
 			} else {
@@ -1166,6 +1209,18 @@ epollfd_ctx_add_node(EpollFDCtx *epollfd, int kq, int fd2,
 		}
 	} else if (S_ISSOCK(statbuf->st_mode)) {
 		fd2_node->node_type = NODE_TYPE_SOCKET;
+#ifdef COMPAT_ENABLE_KQUEUE
+	} else if (counted_kevent(fd2_node->fd, NULL, 0, NULL, 0,
+		       &(struct timespec) { 0, 0 }) == 0) {
+		/*
+		 * The userspace kqueue is an epoll instance and does not look
+		 * like a FIFO.
+		 */
+		fd2_node->node_type = NODE_TYPE_KQUEUE;
+		fd2_node->node_data.kqueue.pollable_desc = pollable_desc;
+		pollable_desc_ref(pollable_desc);
+		pollable_desc_poll(pollable_desc, fd2, NULL);
+#endif
 	} else {
 		/* May also be NODE_TYPE_POLL,
 		   will be checked when registering. */
@@ -1374,7 +1429,7 @@ again:;
 	struct kevent *kevs = epollfd->kevs;
 	assert(kevs != NULL);
 
-	n = kevent(kq, NULL, 0, kevs, cnt, &(struct timespec) { 0, 0 });
+	n = counted_kevent(kq, NULL, 0, kevs, cnt, &(struct timespec) { 0, 0 });
 	if (n < 0) {
 		return errno;
 	}
@@ -1398,7 +1453,9 @@ again:;
 		uint32_t old_revents = fd2_node->revents;
 		NeededFilters old_needed_filters = get_needed_filters(fd2_node);
 
+		uint64_t phase_begin = lock_profile_now();
 		registered_fds_node_feed_event(fd2_node, kq, &kevs[i]);
+		lock_profile_phase_end(PROFILE_PHASE_FEED_EVENT, phase_begin);
 
 		if (fd2_node->node_type != NODE_TYPE_POLL &&
 		    !(fd2_node->is_edge_triggered &&
@@ -1414,6 +1471,7 @@ again:;
 			    old_needed_filters.evfilt_write !=
 				needed_filters.evfilt_write) {
 
+				stats_add(STAT_EOF_REREGISTRATIONS, 1);
 				if (epollfd_ctx__register_events(epollfd, kq,
 					fd2_node) != 0) {
 					epollfd_ctx__remove_node_from_kq(
@@ -1443,10 +1501,16 @@ again:;
 		registered_fds_node_complete(completion_kq);
 	}
 
+	uint64_t now_ns = j > 0 ? monotonic_now_ns() : 0;
+
+	uint64_t phase_begin = lock_profile_now();
 	for (int i = 0; i < j; ++i) {
 		RegisteredFDsNode *fd2_node =
 		    (RegisteredFDsNode *)ev[i].data.ptr;
 
+		++fd2_node->nr_delivered;
+		fd2_node->last_delivered_ns = now_ns;
+
 		ev[i].events = fd2_node->revents;
 		ev[i].data = fd2_node->data;
 
@@ -1459,11 +1523,222 @@ again:;
 			epollfd_ctx__remove_node_from_kq(epollfd, kq, fd2_node);
 		}
 	}
+	lock_profile_phase_end(PROFILE_PHASE_TRANSLATE, phase_begin);
+
+	EPOLL_SHIM_WAIT_HARVEST(epollfd, n, j);
 
 	if (n && j == 0) {
+		stats_add(STAT_WAIT_RETRIES, 1);
 		goto again;
 	}
 
 	*actual_cnt = j;
 	return 0;
 }
+
+static char const *
+node_type_name(NodeType node_type)
+{
+	switch (node_type) {
+	case NODE_TYPE_FIFO:
+		return "fifo";
+	case NODE_TYPE_SOCKET:
+		return "socket";
+	case NODE_TYPE_KQUEUE:
+		return "kqueue";
+	case NODE_TYPE_OTHER:
+		return "other";
+	case NODE_TYPE_POLL:
+		return "poll";
+	}
+	return "unknown";
+}
+
+static void
+dump_events(FILE *out, RegisteredFDsNode const *node)
+{
+	static struct {
+		uint32_t event;
+		char const *name;
+	} const names[] = {
+		{ EPOLLIN, "IN" },
+		{ EPOLLPRI, "PRI" },
+		{ EPOLLOUT, "OUT" },
+		{ EPOLLRDHUP, "RDHUP" },
+		{ EPOLLERR, "ERR" },
+		{ EPOLLHUP, "HUP" },
+	};
+
+	char const *sep = "";
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (node->events & names[i].event) {
+			fprintf(out, "%s%s", sep, names[i].name);
+			sep = "|";
+		}
+	}
+	if (node->is_oneshot) {
+		fprintf(out, "%sONESHOT", sep);
+		sep = "|";
+	} else if (node->is_edge_triggered) {
+		fprintf(out, "%sET", sep);
+		sep = "|";
+	}
+	if (*sep == '\0') {
+		fprintf(out, "0");
+	}
+}
+
+static void
+dump_node(FILE *out, RegisteredFDsNode const *node, uint64_t now_ns)
+{
+	fprintf(out, "  fd %d: %s, events ", node->fd,
+	    node_type_name(node->node_type));
+	dump_events(out, node);
+	fprintf(out, ", filters");
+	if (!node->has_evfilt_read && !node->has_evfilt_write &&
+	    !node->has_evfilt_except) {
+		fprintf(out, " none");
+	}
+	if (node->has_evfilt_read) {
+		fprintf(out, " read%s", node->got_evfilt_read ? "(got)" : "");
+	}
+	if (node->has_evfilt_write) {
+		fprintf(out, " write%s", node->got_evfilt_write ? "(got)" : "");
+	}
+	if (node->has_evfilt_except) {
+		fprintf(out, " except%s",
+		    node->got_evfilt_except ? "(got)" : "");
+	}
+	fprintf(out, ", eof 0x%x%s%s, delivered %llu", node->eof_state,
+	    node->is_registered ? "" : ", disarmed",
+	    node->is_on_pollfd_list ? ", polled" : "",
+	    (unsigned long long)node->nr_delivered);
+	if (node->nr_delivered == 0) {
+		fprintf(out, ", never\n");
+	} else {
+		fprintf(out, ", last %.3f s ago\n",
+		    (double)(now_ns - node->last_delivered_ns) / 1e9);
+	}
+}
+
+static void
+dump_node_json(FILE *out, RegisteredFDsNode const *node, uint64_t now_ns,
+    char const *sep)
+{
+	fprintf(out,
+	    "%s{\"fd\": %d, \"node_type\": \"%s\", \"events\": %u, "
+	    "\"edge_triggered\": %s, \"oneshot\": %s, \"registered\": %s, "
+	    "\"on_poll_list\": %s, ",
+	    sep, node->fd, node_type_name(node->node_type),
+	    (unsigned int)node->events,
+	    node->is_edge_triggered ? "true" : "false",
+	    node->is_oneshot ? "true" : "false",
+	    node->is_registered ? "true" : "false",
+	    node->is_on_pollfd_list ? "true" : "false");
+	fprintf(out,
+	    "\"has_evfilt_read\": %s, \"has_evfilt_write\": %s, "
+	    "\"has_evfilt_except\": %s, \"got_evfilt_read\": %s, "
+	    "\"got_evfilt_write\": %s, \"got_evfilt_except\": %s, ",
+	    node->has_evfilt_read ? "true" : "false",
+	    node->has_evfilt_write ? "true" : "false",
+	    node->has_evfilt_except ? "true" : "false",
+	    node->got_evfilt_read ? "true" : "false",
+	    node->got_evfilt_write ? "true" : "false",
+	    node->got_evfilt_except ? "true" : "false");
+	fprintf(out, "\"eof_state\": %d, \"delivered\": %llu, ",
+	    node->eof_state, (unsigned long long)node->nr_delivered);
+	if (node->nr_delivered == 0) {
+		fprintf(out, "\"last_event_age_ns\": null}");
+	} else {
+		fprintf(out, "\"last_event_age_ns\": %llu}",
+		    (unsigned long long)(now_ns - node->last_delivered_ns));
+	}
+}
+
+errno_t
+epollfd_ctx_snapshot(EpollFDCtx *epollfd, EpollFDCtxSnapshot *snapshot)
+{
+	*snapshot = (EpollFDCtxSnapshot) {
+		.now_ns = monotonic_now_ns(),
+		.kevs_length = epollfd->kevs_length,
+		.pfds_length = epollfd->pfds_length,
+	};
+
+	(void)pthread_mutex_lock(&epollfd->nr_polling_threads_mutex);
+	snapshot->nr_polling_threads = epollfd->nr_polling_threads;
+	(void)pthread_mutex_unlock(&epollfd->nr_polling_threads_mutex);
+
+	RegisteredFDsNode *node;
+	TAILQ_FOREACH (node, &epollfd->poll_fds, pollfd_list_entry) {
+		++snapshot->nr_polled;
+	}
+	assert(snapshot->nr_polled == epollfd->poll_fds_size);
+
+	if (epollfd->registered_fds_size == 0) {
+		return 0;
+	}
+
+	snapshot->nodes = calloc(epollfd->registered_fds_size,
+	    sizeof(RegisteredFDsNode));
+	if (!snapshot->nodes) {
+		return errno;
+	}
+
+	RB_FOREACH (node, registered_fds_set_, &epollfd->registered_fds) {
+		assert(snapshot->nr_nodes < epollfd->registered_fds_size);
+		snapshot->nodes[snapshot->nr_nodes++] = *node;
+	}
+
+	return 0;
+}
+
+void
+epollfd_ctx_snapshot_dump(EpollFDCtxSnapshot const *snapshot, int kq,
+    FILE *out, bool is_json)
+{
+	if (is_json) {
+		fprintf(out,
+		    "{\"epfd\": %d, \"registered_fds\": %zu, "
+		    "\"poll_fds\": %zu, \"polling_threads\": %lu, "
+		    "\"kevs_length\": %zu, \"kevs_bytes\": %zu, "
+		    "\"pfds_length\": %zu, \"pfds_bytes\": %zu, \"fds\": [",
+		    kq, snapshot->nr_nodes, snapshot->nr_polled,
+		    snapshot->nr_polling_threads, snapshot->kevs_length,
+		    snapshot->kevs_length * sizeof(struct kevent),
+		    snapshot->pfds_length,
+		    snapshot->pfds_length * sizeof(struct pollfd));
+	} else {
+		fprintf(out,
+		    "epoll instance %d: %zu registered fds, %zu polled, "
+		    "%lu polling threads, kevs %zu (%zu bytes), "
+		    "pfds %zu (%zu bytes)\n",
+		    kq, snapshot->nr_nodes, snapshot->nr_polled,
+		    snapshot->nr_polling_threads, snapshot->kevs_length,
+		    snapshot->kevs_length * sizeof(struct kevent),
+		    snapshot->pfds_length,
+		    snapshot->pfds_length * sizeof(struct pollfd));
+	}
+
+	char const *sep = "";
+	for (size_t i = 0; i < snapshot->nr_nodes; ++i) {
+		if (is_json) {
+			dump_node_json(out, &snapshot->nodes[i],
+			    snapshot->now_ns, sep);
+			sep = ", ";
+		} else {
+			dump_node(out, &snapshot->nodes[i], snapshot->now_ns);
+		}
+	}
+
+	if (is_json) {
+		fprintf(out, "]}\n");
+	}
+}
+
+void
+epollfd_ctx_snapshot_terminate(EpollFDCtxSnapshot *snapshot)
+{
+	free(snapshot->nodes);
+	snapshot->nodes = NULL;
+	snapshot->nr_nodes = 0;
+}
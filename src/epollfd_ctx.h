@@ -8,12 +8,15 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <poll.h>
 #include <pthread.h>
 
 #include "pollable_desc.h"
+#include "stats.h"
+#include "wait_profile.h"
 
 struct registered_fds_node_;
 typedef struct registered_fds_node_ RegisteredFDsNode;
@@ -70,6 +73,10 @@ struct registered_fds_node_ {
 
 	bool is_on_pollfd_list;
 	int self_pipe[2];
+
+	/* For 'epoll_shim_dump'. */
+	uint64_t nr_delivered;
+	uint64_t last_delivered_ns;
 };
 
 typedef TAILQ_HEAD(pollfds_list_, registered_fds_node_) PollFDList;
@@ -93,6 +100,9 @@ typedef struct {
 	unsigned long nr_polling_threads;
 
 	int self_pipe[2];
+
+	Stats stats;
+	WaitProfile wait_profile;
 } EpollFDCtx;
 
 errno_t epollfd_ctx_init(EpollFDCtx *epollfd);
@@ -108,4 +118,25 @@ errno_t epollfd_ctx_ctl(EpollFDCtx *epollfd, int kq, /**/
 errno_t epollfd_ctx_wait(EpollFDCtx *epollfd, int kq, /**/
     struct epoll_event *ev, int cnt, int *actual_cnt);
 
+/*
+ * State of an epoll instance for 'epoll_shim_dump'. It is taken with the
+ * mutex of the epoll instance held and written out after releasing it. The
+ * nodes are copies; their list and tree links must not be followed.
+ */
+typedef struct {
+	uint64_t now_ns;
+	size_t nr_polled;
+	unsigned long nr_polling_threads;
+	size_t kevs_length;
+	size_t pfds_length;
+	size_t nr_nodes;
+	RegisteredFDsNode *nodes;
+} EpollFDCtxSnapshot;
+
+errno_t epollfd_ctx_snapshot(EpollFDCtx *epollfd,
+    EpollFDCtxSnapshot *snapshot);
+void epollfd_ctx_snapshot_dump(EpollFDCtxSnapshot const *snapshot, int kq,
+    FILE *out, bool is_json);
+void epollfd_ctx_snapshot_terminate(EpollFDCtxSnapshot *snapshot);
+
 #endif
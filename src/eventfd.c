@@ -26,10 +26,10 @@ eventfd_ctx_read_or_block(FileDescription *desc, int kq, uint64_t *value)
 	EventFDCtx *eventfd_ctx = &desc->ctx.eventfd;
 
 	for (;;) {
-		(void)pthread_mutex_lock(&desc->mutex);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		ec = eventfd_ctx_read(eventfd_ctx, kq, value);
 		bool nonblock = (desc->flags & O_NONBLOCK) != 0;
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 
 		if (nonblock || ec != EAGAIN) {
 			return ec;
@@ -78,9 +78,9 @@ eventfd_helper_write(FileDescription *desc, int kq, /**/
 	uint64_t value;
 	memcpy(&value, buf, sizeof(uint64_t));
 
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	ec = eventfd_ctx_write(&desc->ctx.eventfd, kq, value);
-	(void)pthread_mutex_unlock(&desc->mutex);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	if (ec != 0) {
 		return ec;
 	}
@@ -11,6 +11,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "stats.h"
+
 _Static_assert(sizeof(unsigned int) < sizeof(uint64_t), "");
 
 errno_t
@@ -63,6 +65,8 @@ eventfd_ctx_write(EventFDCtx *eventfd, int kq, uint64_t value)
 {
 	errno_t ec;
 
+	stats_add(STAT_EVENTFD_OPS, 1);
+
 	if (value == UINT64_MAX) {
 		return EINVAL;
 	}
@@ -90,6 +94,8 @@ eventfd_ctx_read(EventFDCtx *eventfd, int kq, uint64_t *value)
 {
 	uint_least64_t current_value;
 
+	stats_add(STAT_EVENTFD_OPS, 1);
+
 	current_value = eventfd->counter_;
 	if (current_value == 0) {
 		return EAGAIN;
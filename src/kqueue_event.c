@@ -10,6 +10,10 @@
 
 #include "wrap.h"
 
+#ifdef KQUEUE_EVENT_DISABLE_EVFILT_USER
+#undef EVFILT_USER
+#endif
+
 errno_t
 kqueue_event_init(KQueueEvent *kqueue_event, struct kevent *kevs,
     int *kevs_length, bool should_trigger)
@@ -0,0 +1,69 @@
+#ifndef EPOLL_SHIM_LINUX_SYS_EVENT_H_
+#define EPOLL_SHIM_LINUX_SYS_EVENT_H_
+
+/*
+ * Stand-in for the BSD <sys/event.h> when building the shim on top of the
+ * userspace kqueue in "compat_kqueue.c". Only the subset used by the shim
+ * is provided. Values follow FreeBSD.
+ */
+
+#include <stdint.h>
+
+#define EVFILT_READ (-1)
+#define EVFILT_WRITE (-2)
+#define EVFILT_SIGNAL (-6)
+#define EVFILT_TIMER (-7)
+#define EVFILT_USER (-11)
+#define EVFILT_EXCEPT (-15)
+
+#define EV_ADD 0x0001
+#define EV_DELETE 0x0002
+#define EV_ENABLE 0x0004
+#define EV_DISABLE 0x0008
+#define EV_ONESHOT 0x0010
+#define EV_CLEAR 0x0020
+#define EV_RECEIPT 0x0040
+#define EV_DISPATCH 0x0080
+#define EV_ERROR 0x4000
+#define EV_EOF 0x8000
+
+/* EVFILT_USER */
+#define NOTE_FFNOP 0x00000000
+#define NOTE_FFAND 0x40000000
+#define NOTE_FFOR 0x80000000
+#define NOTE_FFCOPY 0xc0000000
+#define NOTE_FFCTRLMASK 0xc0000000
+#define NOTE_FFLAGSMASK 0x00ffffff
+#define NOTE_TRIGGER 0x01000000
+
+/* EVFILT_EXCEPT */
+#define NOTE_OOB 0x0002
+
+/* EVFILT_TIMER */
+#define NOTE_SECONDS 0x00000001
+#define NOTE_MSECONDS 0x00000002
+#define NOTE_USECONDS 0x00000004
+#define NOTE_NSECONDS 0x00000008
+#define NOTE_ABSTIME 0x00000010
+
+struct kevent {
+	uintptr_t ident;
+	short filter;
+	unsigned short flags;
+	unsigned int fflags;
+	int64_t data;
+	void *udata;
+};
+
+#define EV_SET(kevp, a, b, c, d, e, f)                  \
+	do {                                            \
+		struct kevent *kevp_ = (kevp);          \
+		kevp_->ident = (uintptr_t)(a);          \
+		kevp_->filter = (short)(b);             \
+		kevp_->flags = (unsigned short)(c);     \
+		kevp_->fflags = (unsigned int)(d);      \
+		kevp_->data = (int64_t)(e);             \
+		kevp_->udata = (void *)(f);             \
+	} while (0)
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef EPOLL_SHIM_LINUX_SYS_FILIO_H_
+#define EPOLL_SHIM_LINUX_SYS_FILIO_H_
+
+/* On Linux, FIONBIO and FIONREAD come from <sys/ioctl.h>. */
+#include <sys/ioctl.h>
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef EPOLL_SHIM_LINUX_SYS_SYSCTL_H_
+#define EPOLL_SHIM_LINUX_SYS_SYSCTL_H_
+
+/*
+ * Only the "kern.boottime" MIB is provided, see "compat_sysctl.c".
+ */
+
+#include <stddef.h>
+
+#define CTL_KERN 1
+#define KERN_BOOTTIME 21
+
+#endif
@@ -0,0 +1,293 @@
+#include "lock_profile.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#ifdef EPOLL_SHIM_LOCK_PROFILING
+
+typedef struct {
+	atomic_uint_least64_t acquisitions;
+	atomic_uint_least64_t contended_acquisitions;
+	atomic_uint_least64_t wait_ns;
+	atomic_uint_least64_t hold_ns;
+	atomic_uint_least64_t wait_histogram[LOCK_PROFILE_BUCKETS];
+	atomic_uint_least64_t hold_histogram[LOCK_PROFILE_BUCKETS];
+} LockClassStats;
+
+static LockClassStats lock_class_stats[LOCK_CLASS_COUNT];
+
+static char const *const lock_class_names[LOCK_CLASS_COUNT] = {
+	[LOCK_CLASS_RWLOCK_READ] = "rwlock (read)",
+	[LOCK_CLASS_RWLOCK_WRITE] = "rwlock (write)",
+	[LOCK_CLASS_DESC_MUTEX] = "file description mutex",
+	[LOCK_CLASS_POLLING_THREADS_MUTEX] = "polling threads mutex",
+};
+
+typedef struct {
+	atomic_uint_least64_t calls;
+	atomic_uint_least64_t ns;
+} PhaseStats;
+
+static PhaseStats phase_stats[PROFILE_PHASE_COUNT];
+
+static char const *const phase_names[PROFILE_PHASE_COUNT] = {
+	[PROFILE_PHASE_GET_NEEDED_FILTERS] = "get_needed_filters",
+	[PROFILE_PHASE_FEED_EVENT] = "registered_fds_node_feed_event",
+	[PROFILE_PHASE_TRANSLATE] = "translation to epoll_event",
+};
+
+/*
+ * Locks held by the current thread, together with the time they were
+ * acquired. Holds that do not fit are not accounted for.
+ */
+typedef struct {
+	void const *lock;
+	uint64_t since;
+} HeldLock;
+
+static _Thread_local HeldLock held_locks[16];
+static _Thread_local unsigned int nr_held_locks;
+
+uint64_t
+lock_profile_now(void)
+{
+	struct timespec ts;
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int
+lock_profile_bucket(uint64_t ns)
+{
+	/* Bucket 'i' holds durations in [2^i, 2^(i+1)). */
+	unsigned int bucket = ns == 0 ? /**/
+	    0 :
+	    63 - (unsigned int)__builtin_clzll(ns);
+	return bucket < LOCK_PROFILE_BUCKETS ? bucket : LOCK_PROFILE_BUCKETS - 1;
+}
+
+static void
+lock_profile_push(void const *lock, uint64_t now)
+{
+	if (nr_held_locks < nitems(held_locks)) {
+		held_locks[nr_held_locks++] = (HeldLock) {
+			.lock = lock,
+			.since = now,
+		};
+	}
+}
+
+void
+lock_profile_acquired(void const *lock, LockClass lock_class,
+    bool is_contended, uint64_t wait_begin)
+{
+	LockClassStats *stats = &lock_class_stats[lock_class];
+	uint64_t now = lock_profile_now();
+
+	atomic_fetch_add_explicit(&stats->acquisitions, 1,
+	    memory_order_relaxed);
+	if (is_contended) {
+		uint64_t wait_ns = now - wait_begin;
+		atomic_fetch_add_explicit(&stats->contended_acquisitions, 1,
+		    memory_order_relaxed);
+		atomic_fetch_add_explicit(&stats->wait_ns, wait_ns,
+		    memory_order_relaxed);
+		atomic_fetch_add_explicit(
+		    &stats->wait_histogram[lock_profile_bucket(wait_ns)], 1,
+		    memory_order_relaxed);
+	}
+
+	lock_profile_push(lock, now);
+}
+
+void
+lock_profile_reacquired(void const *lock)
+{
+	lock_profile_push(lock, lock_profile_now());
+}
+
+void
+lock_profile_released(void const *lock, LockClass lock_class)
+{
+	LockClassStats *stats = &lock_class_stats[lock_class];
+
+	for (unsigned int i = nr_held_locks; i > 0; --i) {
+		if (held_locks[i - 1].lock != lock) {
+			continue;
+		}
+
+		uint64_t hold_ns = lock_profile_now() - held_locks[i - 1].since;
+		atomic_fetch_add_explicit(&stats->hold_ns, hold_ns,
+		    memory_order_relaxed);
+		atomic_fetch_add_explicit(
+		    &stats->hold_histogram[lock_profile_bucket(hold_ns)], 1,
+		    memory_order_relaxed);
+
+		/* Locks are not necessarily released in LIFO order. */
+		held_locks[i - 1] = held_locks[--nr_held_locks];
+		return;
+	}
+}
+
+void
+lock_profile_phase_end(ProfilePhase phase, uint64_t begin)
+{
+	PhaseStats *stats = &phase_stats[phase];
+
+	atomic_fetch_add_explicit(&stats->calls, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&stats->ns, lock_profile_now() - begin,
+	    memory_order_relaxed);
+}
+
+errno_t
+lock_profile_get(int lock_class, LockProfile *profile)
+{
+	if (lock_class < 0 || lock_class >= LOCK_CLASS_COUNT) {
+		return EINVAL;
+	}
+
+	LockClassStats *stats = &lock_class_stats[lock_class];
+
+	*profile = (LockProfile) {
+		.acquisitions = atomic_load_explicit(&stats->acquisitions,
+		    memory_order_relaxed),
+		.contended_acquisitions = atomic_load_explicit(
+		    &stats->contended_acquisitions, memory_order_relaxed),
+		.wait_ns = atomic_load_explicit(&stats->wait_ns,
+		    memory_order_relaxed),
+		.hold_ns = atomic_load_explicit(&stats->hold_ns,
+		    memory_order_relaxed),
+	};
+	for (unsigned int i = 0; i < LOCK_PROFILE_BUCKETS; ++i) {
+		profile->wait_histogram[i] = atomic_load_explicit(
+		    &stats->wait_histogram[i], memory_order_relaxed);
+		profile->hold_histogram[i] = atomic_load_explicit(
+		    &stats->hold_histogram[i], memory_order_relaxed);
+	}
+
+	return 0;
+}
+
+errno_t
+lock_profile_phase_get(int phase, PhaseProfile *profile)
+{
+	if (phase < 0 || phase >= PROFILE_PHASE_COUNT) {
+		return EINVAL;
+	}
+
+	*profile = (PhaseProfile) {
+		.calls = atomic_load_explicit(&phase_stats[phase].calls,
+		    memory_order_relaxed),
+		.ns = atomic_load_explicit(&phase_stats[phase].ns,
+		    memory_order_relaxed),
+	};
+
+	return 0;
+}
+
+void
+lock_profile_reset(void)
+{
+	for (unsigned int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+		atomic_store_explicit(&phase_stats[p].calls, 0,
+		    memory_order_relaxed);
+		atomic_store_explicit(&phase_stats[p].ns, 0,
+		    memory_order_relaxed);
+	}
+
+	for (unsigned int c = 0; c < LOCK_CLASS_COUNT; ++c) {
+		LockClassStats *stats = &lock_class_stats[c];
+
+		atomic_store_explicit(&stats->acquisitions, 0,
+		    memory_order_relaxed);
+		atomic_store_explicit(&stats->contended_acquisitions, 0,
+		    memory_order_relaxed);
+		atomic_store_explicit(&stats->wait_ns, 0, memory_order_relaxed);
+		atomic_store_explicit(&stats->hold_ns, 0, memory_order_relaxed);
+		for (unsigned int i = 0; i < LOCK_PROFILE_BUCKETS; ++i) {
+			atomic_store_explicit(&stats->wait_histogram[i], 0,
+			    memory_order_relaxed);
+			atomic_store_explicit(&stats->hold_histogram[i], 0,
+			    memory_order_relaxed);
+		}
+	}
+}
+
+static void
+lock_profile_dump_histogram(char const *name, uint64_t const *histogram)
+{
+	for (unsigned int i = 0; i < LOCK_PROFILE_BUCKETS; ++i) {
+		if (histogram[i] == 0) {
+			continue;
+		}
+		fprintf(stderr, "    %s >= %12llu ns: %llu\n", name,
+		    (unsigned long long)((uint64_t)1 << i),
+		    (unsigned long long)histogram[i]);
+	}
+}
+
+__attribute__((destructor)) static void
+lock_profile_dump(void)
+{
+	for (int c = 0; c < LOCK_CLASS_COUNT; ++c) {
+		LockProfile profile;
+		(void)lock_profile_get(c, &profile);
+		if (profile.acquisitions == 0) {
+			continue;
+		}
+
+		fprintf(stderr,
+		    "epoll-shim lock profile: %s: %llu acquisitions, "
+		    "%llu contended, %llu ns waited, %llu ns held\n",
+		    lock_class_names[c],
+		    (unsigned long long)profile.acquisitions,
+		    (unsigned long long)profile.contended_acquisitions,
+		    (unsigned long long)profile.wait_ns,
+		    (unsigned long long)profile.hold_ns);
+		lock_profile_dump_histogram("wait", profile.wait_histogram);
+		lock_profile_dump_histogram("hold", profile.hold_histogram);
+	}
+
+	for (int p = 0; p < PROFILE_PHASE_COUNT; ++p) {
+		PhaseProfile profile;
+		(void)lock_profile_phase_get(p, &profile);
+		if (profile.calls == 0) {
+			continue;
+		}
+
+		fprintf(stderr,
+		    "epoll-shim phase profile: %s: %llu calls, %llu ns\n",
+		    phase_names[p], (unsigned long long)profile.calls,
+		    (unsigned long long)profile.ns);
+	}
+}
+
+#else
+
+errno_t
+lock_profile_get(int lock_class, LockProfile *profile)
+{
+	(void)lock_class;
+	(void)profile;
+	return ENOTSUP;
+}
+
+errno_t
+lock_profile_phase_get(int phase, PhaseProfile *profile)
+{
+	(void)phase;
+	(void)profile;
+	return ENOTSUP;
+}
+
+void
+lock_profile_reset(void)
+{
+}
+
+#endif
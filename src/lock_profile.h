@@ -0,0 +1,135 @@
+#ifndef LOCK_PROFILE_H_
+#define LOCK_PROFILE_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+/*
+ * Opt-in lock instrumentation (ENABLE_LOCK_PROFILING). The lock classes and
+ * the layout of 'LockProfile' mirror the public <epoll-shim/lock_profile.h>.
+ */
+
+typedef enum {
+	LOCK_CLASS_RWLOCK_READ,
+	LOCK_CLASS_RWLOCK_WRITE,
+	LOCK_CLASS_DESC_MUTEX,
+	LOCK_CLASS_POLLING_THREADS_MUTEX,
+	LOCK_CLASS_COUNT,
+} LockClass;
+
+#define LOCK_PROFILE_BUCKETS 32
+
+typedef struct {
+	uint64_t acquisitions;
+	uint64_t contended_acquisitions;
+	uint64_t wait_ns;
+	uint64_t hold_ns;
+	uint64_t wait_histogram[LOCK_PROFILE_BUCKETS];
+	uint64_t hold_histogram[LOCK_PROFILE_BUCKETS];
+} LockProfile;
+
+/*
+ * Profiling builds also record the time spent in some hot code paths of
+ * 'epoll_wait'. Phases may nest: 'PROFILE_PHASE_FEED_EVENT' includes the
+ * 'get_needed_filters' calls made from there.
+ */
+typedef enum {
+	PROFILE_PHASE_GET_NEEDED_FILTERS,
+	PROFILE_PHASE_FEED_EVENT,
+	PROFILE_PHASE_TRANSLATE,
+	PROFILE_PHASE_COUNT,
+} ProfilePhase;
+
+typedef struct {
+	uint64_t calls;
+	uint64_t ns;
+} PhaseProfile;
+
+errno_t lock_profile_get(int lock_class, LockProfile *profile);
+errno_t lock_profile_phase_get(int phase, PhaseProfile *profile);
+void lock_profile_reset(void);
+
+#ifdef EPOLL_SHIM_LOCK_PROFILING
+uint64_t lock_profile_now(void);
+void lock_profile_acquired(void const *lock, LockClass lock_class,
+    bool is_contended, uint64_t wait_begin);
+void lock_profile_reacquired(void const *lock);
+void lock_profile_released(void const *lock, LockClass lock_class);
+void lock_profile_phase_end(ProfilePhase phase, uint64_t begin);
+#else
+static inline uint64_t
+lock_profile_now(void)
+{
+	return 0;
+}
+
+static inline void
+lock_profile_acquired(void const *lock, LockClass lock_class,
+    bool is_contended, uint64_t wait_begin)
+{
+	(void)lock;
+	(void)lock_class;
+	(void)is_contended;
+	(void)wait_begin;
+}
+
+static inline void
+lock_profile_reacquired(void const *lock)
+{
+	(void)lock;
+}
+
+static inline void
+lock_profile_released(void const *lock, LockClass lock_class)
+{
+	(void)lock;
+	(void)lock_class;
+}
+
+static inline void
+lock_profile_phase_end(ProfilePhase phase, uint64_t begin)
+{
+	(void)phase;
+	(void)begin;
+}
+#endif
+
+static inline void
+profiled_mutex_lock(pthread_mutex_t *mutex, LockClass lock_class)
+{
+#ifdef EPOLL_SHIM_LOCK_PROFILING
+	if (pthread_mutex_trylock(mutex) == 0) {
+		lock_profile_acquired(mutex, lock_class, false, 0);
+		return;
+	}
+
+	uint64_t wait_begin = lock_profile_now();
+	(void)pthread_mutex_lock(mutex);
+	lock_profile_acquired(mutex, lock_class, true, wait_begin);
+#else
+	(void)lock_class;
+	(void)pthread_mutex_lock(mutex);
+#endif
+}
+
+static inline void
+profiled_mutex_unlock(pthread_mutex_t *mutex, LockClass lock_class)
+{
+	lock_profile_released(mutex, lock_class);
+	(void)pthread_mutex_unlock(mutex);
+}
+
+static inline int
+profiled_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+    LockClass lock_class)
+{
+	lock_profile_released(mutex, lock_class);
+	int rc = pthread_cond_wait(cond, mutex);
+	lock_profile_reacquired(mutex);
+	return rc;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PROBES_H_
+#define PROBES_H_
+
+/*
+ * Static tracepoints (ENABLE_DTRACE), defined in 'epoll_shim_provider.d'.
+ * With DTrace, the macros come from the header generated by 'dtrace -h'. On
+ * Linux, they are mapped to the SystemTap <sys/sdt.h> by hand. Otherwise,
+ * they expand to nothing and their arguments are not evaluated.
+ */
+
+#if defined(EPOLL_SHIM_PROBES_DTRACE)
+
+#include "epoll_shim_provider.h"
+
+#elif defined(EPOLL_SHIM_PROBES_SDT)
+
+#include <sys/sdt.h>
+
+#include <stdint.h>
+
+/*
+ * The arguments are converted to the types of 'epoll_shim_provider.d', like
+ * the macros generated by 'dtrace -h' do. Otherwise, the probe would record
+ * the width and signedness of whatever the caller passed.
+ */
+
+#define EPOLL_SHIM_EPOLL_CTL_ENTRY(epfd, op, fd, events) \
+	DTRACE_PROBE4(epoll_shim, epoll_ctl__entry, (int)(epfd), (int)(op), \
+	    (int)(fd), (uint32_t)(events))
+#define EPOLL_SHIM_EPOLL_CTL_RETURN(epfd, op, fd, error) \
+	DTRACE_PROBE4(epoll_shim, epoll_ctl__return, (int)(epfd), (int)(op), \
+	    (int)(fd), (int)(error))
+#define EPOLL_SHIM_WAIT_HARVEST(epollfd, nkevents, nevents) \
+	DTRACE_PROBE3(epoll_shim, wait__harvest, (void *)(epollfd), \
+	    (int)(nkevents), (int)(nevents))
+#define EPOLL_SHIM_FEED_EVENT(fd, filter, flags, revents) \
+	DTRACE_PROBE4(epoll_shim, feed__event, (int)(fd), (int)(filter), \
+	    (int)(flags), (uint32_t)(revents))
+#define EPOLL_SHIM_BLOCK_ENTRY(epollfd, nfds) \
+	DTRACE_PROBE2(epoll_shim, block__entry, (void *)(epollfd), (int)(nfds))
+#define EPOLL_SHIM_BLOCK_RETURN(epollfd, n) \
+	DTRACE_PROBE2(epoll_shim, block__return, (void *)(epollfd), (int)(n))
+#define EPOLL_SHIM_TIMERFD_FIRE(timerfd, expirations) \
+	DTRACE_PROBE2(epoll_shim, timerfd__fire, (void *)(timerfd), \
+	    (uint64_t)(expirations))
+#define EPOLL_SHIM_TIMERFD_REARM(timerfd, sec, nsec) \
+	DTRACE_PROBE3(epoll_shim, timerfd__rearm, (void *)(timerfd), \
+	    (int64_t)(sec), (long)(nsec))
+#define EPOLL_SHIM_SIGNALFD_DEQUEUE(signalfd, signo) \
+	DTRACE_PROBE2(epoll_shim, signalfd__dequeue, (void *)(signalfd), \
+	    (int)(signo))
+#define EPOLL_SHIM_RWLOCK_CONTEND_START(rwlock, is_write) \
+	DTRACE_PROBE2(epoll_shim, rwlock__contend__start, (void *)(rwlock), \
+	    (int)(is_write))
+#define EPOLL_SHIM_RWLOCK_CONTEND_DONE(rwlock, is_write) \
+	DTRACE_PROBE2(epoll_shim, rwlock__contend__done, (void *)(rwlock), \
+	    (int)(is_write))
+
+#else
+
+#define EPOLL_SHIM_EPOLL_CTL_ENTRY(epfd, op, fd, events) ((void)0)
+#define EPOLL_SHIM_EPOLL_CTL_RETURN(epfd, op, fd, error) ((void)0)
+#define EPOLL_SHIM_WAIT_HARVEST(epollfd, nkevents, nevents) ((void)0)
+#define EPOLL_SHIM_FEED_EVENT(fd, filter, flags, revents) ((void)0)
+#define EPOLL_SHIM_BLOCK_ENTRY(epollfd, nfds) ((void)0)
+#define EPOLL_SHIM_BLOCK_RETURN(epollfd, n) ((void)0)
+#define EPOLL_SHIM_TIMERFD_FIRE(timerfd, expirations) ((void)0)
+#define EPOLL_SHIM_TIMERFD_REARM(timerfd, sec, nsec) ((void)0)
+#define EPOLL_SHIM_SIGNALFD_DEQUEUE(signalfd, signo) ((void)0)
+#define EPOLL_SHIM_RWLOCK_CONTEND_START(rwlock, is_write) ((void)0)
+#define EPOLL_SHIM_RWLOCK_CONTEND_DONE(rwlock, is_write) ((void)0)
+
+#endif
+
+#endif
@@ -2,12 +2,84 @@
 
 #include <errno.h>
 
+#include "lock_profile.h"
+#include "probes.h"
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/umtx.h>
+#endif
+
 /*
- * Inspired by:
- * <https://eli.thegreenplace.net/2019/implementing-reader-writer-locks/>
+ * Big-reader lock, inspired by:
+ * <https://www.kernel.org/doc/html/latest/locking/percpu-rw-semaphore.html>
+ *
+ * Readers increment the counter of their shard and then check whether a
+ * writer is active. Writers (serialized by the mutex) first announce
+ * themselves and then wait for the counter of each shard to drop to zero.
+ * Because both sides use sequentially consistent operations, either the
+ * reader sees the writer or the writer sees the reader. A reader that sees
+ * a writer backs off and waits for the mutex instead.
+ *
+ * Both sides spin for a bit before parking, as most critical sections are
+ * short.
  */
 
-#define MAX_READERS (1 << 30)
+#define RWLOCK_SPIN_COUNT 100
+
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+#ifdef RWLOCK_HAVE_FUTEX
+
+/*
+ * Writers park on the 'writer_wakeups' sequence number. Futex waits are not
+ * cancellation points, so there is no need to fiddle with the cancel state.
+ */
+
+static uint32_t
+rwlock_writer_prepare_park(RWLock *rwlock)
+{
+	return atomic_load(&rwlock->writer_wakeups);
+}
+
+static void
+rwlock_writer_park(RWLock *rwlock, uint32_t seq)
+{
+#if defined(__linux__)
+	(void)syscall(SYS_futex, &rwlock->writer_wakeups, FUTEX_WAIT_PRIVATE,
+	    seq, NULL, NULL, 0);
+#else
+	(void)_umtx_op(&rwlock->writer_wakeups, UMTX_OP_WAIT_UINT_PRIVATE,
+	    seq, NULL, NULL);
+#endif
+}
+
+static void
+rwlock_writer_wake(RWLock *rwlock)
+{
+	atomic_fetch_add(&rwlock->writer_wakeups, 1);
+#if defined(__linux__)
+	(void)syscall(SYS_futex, &rwlock->writer_wakeups, FUTEX_WAKE_PRIVATE,
+	    1, NULL, NULL, 0);
+#else
+	(void)_umtx_op(&rwlock->writer_wakeups, UMTX_OP_WAKE_PRIVATE, 1, NULL,
+	    NULL);
+#endif
+}
+
+#else
 
 static int
 sem_wait_nointr(sem_t *sem)
@@ -25,6 +97,47 @@ sem_wait_nointr(sem_t *sem)
 	return rc;
 }
 
+static uint32_t
+rwlock_writer_prepare_park(RWLock *rwlock)
+{
+	(void)rwlock;
+	return 0;
+}
+
+static void
+rwlock_writer_park(RWLock *rwlock, uint32_t seq)
+{
+	(void)seq;
+	(void)sem_wait_nointr(&rwlock->writer_wait);
+}
+
+static void
+rwlock_writer_wake(RWLock *rwlock)
+{
+	(void)sem_post(&rwlock->writer_wait);
+}
+
+#endif
+
+static atomic_uint next_shard_index;
+static _Thread_local unsigned int thread_shard_index;
+
+static RWLockShard *
+rwlock_shard(RWLock *rwlock)
+{
+	/* Index 0 means "not yet assigned". */
+	unsigned int index = thread_shard_index;
+	if (index == 0) {
+		index = atomic_fetch_add_explicit(&next_shard_index, 1,
+			    memory_order_relaxed) %
+			RWLOCK_NR_SHARDS +
+		    1;
+		thread_shard_index = index;
+	}
+
+	return &rwlock->shards[index - 1];
+}
+
 errno_t
 rwlock_init(RWLock *rwlock)
 {
@@ -36,22 +149,19 @@ rwlock_init(RWLock *rwlock)
 		goto out_mutex;
 	}
 
+#ifndef RWLOCK_HAVE_FUTEX
 	if (sem_init(&rwlock->writer_wait, 0, 0) < 0) {
 		ec = errno;
 		goto out_writer_wait;
 	}
-
-	if (sem_init(&rwlock->reader_wait, 0, 0) < 0) {
-		ec = errno;
-		goto out_reader_wait;
-	}
+#endif
 
 	return 0;
 
-	(void)sem_destroy(&rwlock->reader_wait);
-out_reader_wait:
+#ifndef RWLOCK_HAVE_FUTEX
 	(void)sem_destroy(&rwlock->writer_wait);
 out_writer_wait:
+#endif
 	(void)pthread_mutex_destroy(&rwlock->mutex);
 out_mutex:
 	return ec;
@@ -60,60 +170,155 @@ out_mutex:
 void
 rwlock_terminate(RWLock *rwlock)
 {
-	(void)sem_destroy(&rwlock->reader_wait);
+#ifndef RWLOCK_HAVE_FUTEX
 	(void)sem_destroy(&rwlock->writer_wait);
+#endif
 	(void)pthread_mutex_destroy(&rwlock->mutex);
 }
 
+static void
+rwlock_shard_release(RWLock *rwlock, RWLockShard *shard)
+{
+	atomic_fetch_sub(&shard->num_readers, 1);
+	if (atomic_load(&rwlock->writer_active)) {
+		rwlock_writer_wake(rwlock);
+	}
+}
+
+static bool
+rwlock_try_lock_read(RWLock *rwlock, RWLockShard *shard)
+{
+	atomic_fetch_add(&shard->num_readers, 1);
+	if (!atomic_load(&rwlock->writer_active)) {
+		return true;
+	}
+
+	/*
+	 * A writer is active or about to become active. Get out of its way.
+	 */
+	rwlock_shard_release(rwlock, shard);
+	return false;
+}
+
 void
 rwlock_lock_read(RWLock *rwlock)
 {
-	if (atomic_fetch_add(&rwlock->num_pending, 1) + 1 < 0) {
-		(void)sem_wait_nointr(&rwlock->reader_wait);
+	RWLockShard *shard = rwlock_shard(rwlock);
+
+	if (rwlock_try_lock_read(rwlock, shard)) {
+		lock_profile_acquired(rwlock, LOCK_CLASS_RWLOCK_READ, false, 0);
+		return;
 	}
+
+	uint64_t wait_begin = lock_profile_now();
+	EPOLL_SHIM_RWLOCK_CONTEND_START(rwlock, 0);
+
+	for (int i = 0; i < RWLOCK_SPIN_COUNT; ++i) {
+		cpu_relax();
+		if (!atomic_load_explicit(&rwlock->writer_active,
+			memory_order_relaxed) &&
+		    rwlock_try_lock_read(rwlock, shard)) {
+			goto out;
+		}
+	}
+
+	/*
+	 * Wait until the writer is done. No writer can be active while we
+	 * hold the mutex.
+	 */
+	(void)pthread_mutex_lock(&rwlock->mutex);
+	atomic_fetch_add(&shard->num_readers, 1);
+	(void)pthread_mutex_unlock(&rwlock->mutex);
+
+out:
+	EPOLL_SHIM_RWLOCK_CONTEND_DONE(rwlock, 0);
+	lock_profile_acquired(rwlock, LOCK_CLASS_RWLOCK_READ, true, wait_begin);
 }
 
 void
 rwlock_unlock_read(RWLock *rwlock)
 {
-	if (atomic_fetch_sub(&rwlock->num_pending, 1) - 1 < 0) {
-		if (atomic_fetch_sub(&rwlock->readers_departing, 1) - 1 == 0) {
-			(void)sem_post(&rwlock->writer_wait);
+	lock_profile_released(rwlock, LOCK_CLASS_RWLOCK_READ);
+	rwlock_shard_release(rwlock, rwlock_shard(rwlock));
+}
+
+static void
+rwlock_wait_for_shard(RWLock *rwlock, RWLockShard *shard)
+{
+	for (int i = 0; i < RWLOCK_SPIN_COUNT; ++i) {
+		cpu_relax();
+		if (atomic_load(&shard->num_readers) == 0) {
+			return;
+		}
+	}
+
+	for (;;) {
+		uint32_t seq = rwlock_writer_prepare_park(rwlock);
+		if (atomic_load(&shard->num_readers) == 0) {
+			return;
 		}
+		rwlock_writer_park(rwlock, seq);
 	}
 }
 
 void
 rwlock_lock_write(RWLock *rwlock)
 {
-	(void)pthread_mutex_lock(&rwlock->mutex);
-	int_fast32_t r = atomic_fetch_sub(&rwlock->num_pending, MAX_READERS);
-	if (r != 0 &&
-	    atomic_fetch_add(&rwlock->readers_departing, r) + r != 0) {
-		(void)sem_wait_nointr(&rwlock->writer_wait);
+	uint64_t wait_begin = 0;
+	bool is_contended = false;
+
+	if (pthread_mutex_trylock(&rwlock->mutex) != 0) {
+		wait_begin = lock_profile_now();
+		is_contended = true;
+		EPOLL_SHIM_RWLOCK_CONTEND_START(rwlock, 1);
+		(void)pthread_mutex_lock(&rwlock->mutex);
 	}
+	atomic_store(&rwlock->writer_active, true);
+
+#ifndef RWLOCK_HAVE_FUTEX
+	/* Wakeups from earlier writers are stale. */
+	while (sem_trywait(&rwlock->writer_wait) == 0) {
+	}
+#endif
+
+	for (int i = 0; i < RWLOCK_NR_SHARDS; ++i) {
+		if (atomic_load(&rwlock->shards[i].num_readers) == 0) {
+			continue;
+		}
+		if (!is_contended) {
+			wait_begin = lock_profile_now();
+			is_contended = true;
+			EPOLL_SHIM_RWLOCK_CONTEND_START(rwlock, 1);
+		}
+		rwlock_wait_for_shard(rwlock, &rwlock->shards[i]);
+	}
+
+	if (is_contended) {
+		EPOLL_SHIM_RWLOCK_CONTEND_DONE(rwlock, 1);
+	}
+	lock_profile_acquired(rwlock, LOCK_CLASS_RWLOCK_WRITE, is_contended,
+	    wait_begin);
 }
 
-static inline void
-rwlock_unlock_common(RWLock *rwlock, int keep_reading)
+static void
+rwlock_unlock_write_impl(RWLock *rwlock)
 {
-	int_fast32_t r = atomic_fetch_add(&rwlock->num_pending,
-			     MAX_READERS + keep_reading) +
-	    MAX_READERS + keep_reading;
-	for (int_fast32_t i = keep_reading; i < r; ++i) {
-		(void)sem_post(&rwlock->reader_wait);
-	}
+	atomic_store(&rwlock->writer_active, false);
 	(void)pthread_mutex_unlock(&rwlock->mutex);
 }
 
 void
 rwlock_unlock_write(RWLock *rwlock)
 {
-	rwlock_unlock_common(rwlock, 0);
+	lock_profile_released(rwlock, LOCK_CLASS_RWLOCK_WRITE);
+	rwlock_unlock_write_impl(rwlock);
 }
 
 void
 rwlock_downgrade(RWLock *rwlock)
 {
-	rwlock_unlock_common(rwlock, 1);
+	lock_profile_released(rwlock, LOCK_CLASS_RWLOCK_WRITE);
+	atomic_fetch_add(&rwlock_shard(rwlock)->num_readers, 1);
+	rwlock_unlock_write_impl(rwlock);
+	lock_profile_acquired(rwlock, LOCK_CLASS_RWLOCK_READ, false, 0);
 }
@@ -2,6 +2,7 @@
 #define RWLOCK_H_
 
 #include <errno.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -10,12 +11,31 @@
 #include <pthread.h>
 #include <semaphore.h>
 
+#define RWLOCK_NR_SHARDS 64
+#define RWLOCK_CACHE_LINE_SIZE 64
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#define RWLOCK_HAVE_FUTEX
+#endif
+
 typedef struct {
+	alignas(RWLOCK_CACHE_LINE_SIZE) atomic_int_fast32_t num_readers;
+} RWLockShard;
+
+/*
+ * Big-reader lock: readers only touch the reader count of their own shard,
+ * writers sweep all shards. A read lock must be released by the thread that
+ * acquired it (or by the thread that downgraded its write lock).
+ */
+typedef struct {
+	RWLockShard shards[RWLOCK_NR_SHARDS];
+	alignas(RWLOCK_CACHE_LINE_SIZE) atomic_bool writer_active;
 	pthread_mutex_t mutex;
+#ifdef RWLOCK_HAVE_FUTEX
+	atomic_uint_least32_t writer_wakeups;
+#else
 	sem_t writer_wait;
-	sem_t reader_wait;
-	atomic_int_fast32_t num_pending;
-	atomic_int_fast32_t readers_departing;
+#endif
 } RWLock;
 
 errno_t rwlock_init(RWLock *rwlock);
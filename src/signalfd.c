@@ -24,17 +24,19 @@
 
 static errno_t
 signalfd_ctx_read_or_block(FileDescription *desc, int kq,
-    SignalFDCtxSiginfo *siginfo, bool force_nonblock)
+    SignalFDCtxSiginfo *siginfos, size_t nr_siginfos, size_t *nr_read,
+    bool force_nonblock)
 {
 	errno_t ec;
 	SignalFDCtx *signalfd_ctx = &desc->ctx.signalfd;
 
 	for (;;) {
-		(void)pthread_mutex_lock(&desc->mutex);
-		ec = signalfd_ctx_read(signalfd_ctx, kq, siginfo);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+		ec = signalfd_ctx_read(signalfd_ctx, kq, siginfos, nr_siginfos,
+		    nr_read);
 		bool nonblock = force_nonblock ||
 		    (desc->flags & O_NONBLOCK) != 0;
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		if (nonblock || (ec != EAGAIN && ec != EWOULDBLOCK)) {
 			return ec;
 		}
@@ -67,20 +69,28 @@ signalfd_read(FileDescription *desc, int kq, void *buf, size_t nbytes,
 			sizeof(SignalFDCtxSiginfo),
 		    "");
 
-		SignalFDCtxSiginfo siginfo;
-		memset(&siginfo, 0, sizeof(siginfo));
+		SignalFDCtxSiginfo siginfos[32];
+		size_t nr_siginfos = nbytes / sizeof(siginfos[0]);
+		if (nr_siginfos > sizeof(siginfos) / sizeof(siginfos[0])) {
+			nr_siginfos = sizeof(siginfos) / sizeof(siginfos[0]);
+		}
 
-		if ((ec = signalfd_ctx_read_or_block(desc, kq, &siginfo,
-			 force_nonblock)) != 0) {
+		size_t nr_read;
+		if ((ec = signalfd_ctx_read_or_block(desc, kq, siginfos,
+			 nr_siginfos, &nr_read, force_nonblock)) != 0) {
 			break;
 		}
 
-		memcpy(buf, &siginfo, sizeof(siginfo));
-		bytes_transferred_local += sizeof(siginfo);
+		memcpy(buf, siginfos, nr_read * sizeof(siginfos[0]));
+		bytes_transferred_local += nr_read * sizeof(siginfos[0]);
+
+		if (nr_read < nr_siginfos) {
+			break;
+		}
 
 		force_nonblock = true;
-		nbytes -= sizeof(siginfo);
-		buf = ((unsigned char *)buf) + sizeof(siginfo);
+		nbytes -= nr_read * sizeof(siginfos[0]);
+		buf = ((unsigned char *)buf) + nr_read * sizeof(siginfos[0]);
 	}
 
 	if (bytes_transferred_local > 0) {
@@ -100,9 +110,9 @@ signalfd_close(FileDescription *desc)
 static void
 signalfd_poll(FileDescription *desc, int kq, uint32_t *revents)
 {
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	signalfd_ctx_poll(&desc->ctx.signalfd, kq, revents);
-	(void)pthread_mutex_unlock(&desc->mutex);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 }
 
 static struct file_description_vtable const signalfd_vtable = {
@@ -112,6 +122,30 @@ static struct file_description_vtable const signalfd_vtable = {
 	.poll_fun = signalfd_poll,
 };
 
+static errno_t
+signalfd_set_mask_impl(EpollShimCtx *epoll_shim_ctx, int fd,
+    sigset_t const *sigs)
+{
+	errno_t ec;
+
+	FileDescription *desc = epoll_shim_ctx_find_desc(epoll_shim_ctx, fd);
+	if (!desc || desc->vtable != &signalfd_vtable) {
+		struct stat sb;
+		ec = (fd < 0 || fstat(fd, &sb) < 0) ? EBADF : EINVAL;
+		goto out;
+	}
+
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+	ec = signalfd_ctx_set_mask(&desc->ctx.signalfd, fd, sigs);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+
+out:
+	if (desc) {
+		(void)file_description_unref(&desc);
+	}
+	return ec;
+}
+
 static errno_t
 signalfd_impl(int *sfd_out, int fd, sigset_t const *sigs, int flags)
 {
@@ -121,11 +155,6 @@ signalfd_impl(int *sfd_out, int fd, sigset_t const *sigs, int flags)
 		return EINVAL;
 	}
 
-	if (fd != -1) {
-		struct stat sb;
-		return (fd < 0 || fstat(fd, &sb) < 0) ? EBADF : EINVAL;
-	}
-
 	_Static_assert(SFD_CLOEXEC == O_CLOEXEC, "");
 	_Static_assert(SFD_NONBLOCK == O_NONBLOCK, "");
 
@@ -134,6 +163,17 @@ signalfd_impl(int *sfd_out, int fd, sigset_t const *sigs, int flags)
 		return ec;
 	}
 
+	if (fd != -1) {
+		/* Like on Linux, the flags only matter for new descriptors. */
+		if ((ec = signalfd_set_mask_impl(epoll_shim_ctx, fd,
+			 sigs)) != 0) {
+			return ec;
+		}
+
+		*sfd_out = fd;
+		return 0;
+	}
+
 	int sfd;
 	FileDescription *desc;
 	ec = epoll_shim_ctx_create_desc(epoll_shim_ctx,
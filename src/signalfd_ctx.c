@@ -13,6 +13,10 @@
 #include <poll.h>
 #include <unistd.h>
 
+#include "probes.h"
+#include "stats.h"
+#include "wrap.h"
+
 static errno_t
 signalfd_has_pending(SignalFDCtx const *signalfd, bool *has_pending,
     sigset_t *pending)
@@ -37,89 +41,408 @@ signalfd_ctx_trigger_manually(SignalFDCtx *signalfd, int kq)
 	return kqueue_event_trigger(&signalfd->kqueue_event, kq);
 }
 
+static errno_t
+signalfd_ctx_trigger(SignalFDCtx *signalfd, int kq)
+{
+	errno_t ec;
+
+	(void)pthread_mutex_lock(&signalfd->mutex);
+	ec = signalfd_ctx_trigger_manually(signalfd, kq);
+	(void)pthread_mutex_unlock(&signalfd->mutex);
+
+	return ec;
+}
+
 static void
 signalfd_signal_handler(int signo)
 {
 	(void)signo;
 }
 
-errno_t
-signalfd_ctx_init(SignalFDCtx *signalfd, int kq, sigset_t const *sigs)
+#ifndef _SIG_MAXSIG
+#define _SIG_MAXSIG (8 * sizeof(sigset_t))
+#endif
+
+/*
+ * Process wide signal router. Instead of registering EVFILT_SIGNAL on the
+ * kqueue of each signalfd, the union of all watched signals is registered
+ * once on a private kqueue. A helper thread waits on that kqueue and
+ * triggers only those signalfds whose mask contains a signal that has
+ * arrived. Signals are still dequeued by 'read', so each signal is consumed
+ * only once even if several signalfds watch it.
+ *
+ * The router (and its thread and kqueue) only exists as long as there are
+ * signalfds.
+ *
+ * Neither the thread nor the kqueue survive a 'fork()'. The child starts
+ * over with an empty router. Signalfds inherited from the parent belong to
+ * an older generation of the router and are not touched anymore.
+ */
+
+static pthread_once_t signalfd_router_atfork_once = PTHREAD_ONCE_INIT;
+
+static struct {
+	pthread_mutex_t lifecycle_mutex;
+	unsigned long nr_signalfds;
+	unsigned long generation;
+	pthread_t thread;
+	KQueueEvent stop_event;
+
+	pthread_mutex_t mutex;
+	int kq;
+	LIST_HEAD(, signalfd_ctx_) signalfds;
+	unsigned int nr_watchers[_SIG_MAXSIG + 1];
+} signalfd_router = {
+	.lifecycle_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.kq = -1,
+	.signalfds = LIST_HEAD_INITIALIZER(signalfd_router.signalfds),
+};
+
+static void *
+signalfd_router_thread(void *arg)
 {
-	errno_t ec;
+	(void)arg;
 
-	assert(sigs != NULL);
+	for (;;) {
+		struct kevent kevs[32];
+		int n = kevent(signalfd_router.kq, NULL, 0, kevs,
+		    (int)(sizeof(kevs) / sizeof(kevs[0])), NULL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
 
-	*signalfd = (SignalFDCtx) { .sigs = *sigs };
+		sigset_t arrived;
+		sigemptyset(&arrived);
+		for (int i = 0; i < n; ++i) {
+			if (kevs[i].filter != EVFILT_SIGNAL) {
+				return NULL;
+			}
+			sigaddset(&arrived, (int)kevs[i].ident);
+		}
 
-#ifndef _SIG_MAXSIG
-#define _SIG_MAXSIG (8 * sizeof(sigset_t))
-#endif
+		(void)pthread_mutex_lock(&signalfd_router.mutex);
+		SignalFDCtx *signalfd;
+		LIST_FOREACH (signalfd, &signalfd_router.signalfds,
+		    router_entry) {
+			sigset_t sigs;
+			if (sigandset(&sigs, &arrived, &signalfd->sigs) == 0 &&
+			    !sigisemptyset(&sigs)) {
+				(void)signalfd_ctx_trigger(signalfd,
+				    signalfd->kq);
+			}
+		}
+		(void)pthread_mutex_unlock(&signalfd_router.mutex);
+	}
+
+	return NULL;
+}
 
-	struct kevent kevs[_SIG_MAXSIG + 2];
+static errno_t
+signalfd_router_start(void)
+{
+	errno_t ec;
+
+	int kq = kqueue1(O_CLOEXEC);
+	if (kq < 0) {
+		return errno;
+	}
+
+	struct kevent kevs[1];
 	int n = 0;
 
-	if ((ec = kqueue_event_init(&signalfd->kqueue_event, kevs, &n,
+	if ((ec = kqueue_event_init(&signalfd_router.stop_event, kevs, &n,
 		 false)) != 0) {
 		goto out2;
 	}
 
-	for (int i = 1; i <= _SIG_MAXSIG; ++i) {
-		if (sigismember(&signalfd->sigs, i)) {
-			EV_SET(&kevs[n++], (unsigned int)i, EVFILT_SIGNAL,
-			    EV_ADD, 0, 0, 0);
-
-			/*
-			 * On Linux, signals with disposition SIG_DFL and a
-			 * default action of "ignored" are returned from
-			 * sigwait.
-			 * We can emulate this by registering an empty signal
-			 * handler.
-			 */
-			if (i == SIGCHLD || /**/
-			    i == SIGURG ||  /**/
-			    i == SIGCONT || /**/
+	if (kevent(kq, kevs, n, NULL, 0, NULL) < 0) {
+		ec = errno;
+		goto out;
+	}
+
+	signalfd_router.kq = kq;
+
+	sigset_t set;
+	if (sigfillset(&set) < 0) {
+		ec = errno;
+		goto out;
+	}
+
+	sigset_t oldset;
+	if ((ec = pthread_sigmask(SIG_BLOCK, &set, &oldset)) != 0) {
+		goto out;
+	}
+	ec = pthread_create(&signalfd_router.thread, NULL, /**/
+	    signalfd_router_thread, NULL);
+	(void)pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ec != 0) {
+		goto out;
+	}
+
+	return 0;
+
+out:
+	signalfd_router.kq = -1;
+	(void)kqueue_event_terminate(&signalfd_router.stop_event);
+out2:
+	real_close(kq);
+	return ec;
+}
+
+static void
+signalfd_router_stop(void)
+{
+	(void)kqueue_event_trigger(&signalfd_router.stop_event,
+	    signalfd_router.kq);
+
+	(void)pthread_join(signalfd_router.thread, NULL);
+
+	(void)kqueue_event_terminate(&signalfd_router.stop_event);
+	real_close(signalfd_router.kq);
+	signalfd_router.kq = -1;
+}
+
+static void
+signalfd_router_atfork_prepare(void)
+{
+	(void)pthread_mutex_lock(&signalfd_router.lifecycle_mutex);
+	(void)pthread_mutex_lock(&signalfd_router.mutex);
+}
+
+static void
+signalfd_router_atfork_parent(void)
+{
+	(void)pthread_mutex_unlock(&signalfd_router.mutex);
+	(void)pthread_mutex_unlock(&signalfd_router.lifecycle_mutex);
+}
+
+static void
+signalfd_router_atfork_child(void)
+{
+	if (signalfd_router.nr_signalfds > 0) {
+		(void)kqueue_event_terminate(&signalfd_router.stop_event);
+	}
+
+	signalfd_router.nr_signalfds = 0;
+	++signalfd_router.generation;
+	signalfd_router.kq = -1;
+	LIST_INIT(&signalfd_router.signalfds);
+	memset(signalfd_router.nr_watchers, 0,
+	    sizeof(signalfd_router.nr_watchers));
+
+	(void)pthread_mutex_init(&signalfd_router.mutex, NULL);
+	(void)pthread_mutex_init(&signalfd_router.lifecycle_mutex, NULL);
+}
+
+static void
+signalfd_router_atfork_init(void)
+{
+	(void)pthread_atfork(signalfd_router_atfork_prepare,
+	    signalfd_router_atfork_parent, signalfd_router_atfork_child);
+}
+
+static errno_t
+signalfd_router_ref(void)
+{
+	errno_t ec = 0;
+
+	(void)pthread_once(&signalfd_router_atfork_once,
+	    signalfd_router_atfork_init);
+
+	(void)pthread_mutex_lock(&signalfd_router.lifecycle_mutex);
+	if (signalfd_router.nr_signalfds == 0) {
+		ec = signalfd_router_start();
+	}
+	if (ec == 0) {
+		++signalfd_router.nr_signalfds;
+	}
+	(void)pthread_mutex_unlock(&signalfd_router.lifecycle_mutex);
+
+	return ec;
+}
+
+static void
+signalfd_router_unref(void)
+{
+	(void)pthread_mutex_lock(&signalfd_router.lifecycle_mutex);
+	assert(signalfd_router.nr_signalfds > 0);
+	if (--signalfd_router.nr_signalfds == 0) {
+		signalfd_router_stop();
+	}
+	(void)pthread_mutex_unlock(&signalfd_router.lifecycle_mutex);
+}
+
+/*
+ * Adjusts the EVFILT_SIGNAL registrations of the router for the signals in
+ * 'sigs'. Must be called with the router mutex held.
+ */
+static errno_t
+signalfd_router_update_watchers(sigset_t const *sigs, bool add)
+{
+	struct kevent kevs[_SIG_MAXSIG];
+	int n = 0;
+
+	for (int i = 1; i <= (int)_SIG_MAXSIG; ++i) {
+		if (sigismember(sigs, i) != 1) {
+			continue;
+		}
+
+		if (add) {
+			if (signalfd_router.nr_watchers[i]++ == 0) {
+				EV_SET(&kevs[n++], (unsigned int)i,
+				    EVFILT_SIGNAL, EV_ADD | EV_RECEIPT, 0, 0,
+				    0);
+			}
+		} else {
+			assert(signalfd_router.nr_watchers[i] > 0);
+			if (--signalfd_router.nr_watchers[i] == 0) {
+				EV_SET(&kevs[n++], (unsigned int)i,
+				    EVFILT_SIGNAL, EV_DELETE | EV_RECEIPT, 0,
+				    0, 0);
+			}
+		}
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if ((n = kevent(signalfd_router.kq, kevs, n, kevs, n, NULL)) < 0) {
+		return errno;
+	}
+
+	errno_t ec = 0;
+	for (int i = 0; i < n; ++i) {
+		assert((kevs[i].flags & EV_ERROR) != 0);
+		if (ec == 0 && kevs[i].data != 0) {
+			ec = (errno_t)kevs[i].data;
+		}
+	}
+	return ec;
+}
+
+static errno_t
+signalfd_router_add(SignalFDCtx *signalfd)
+{
+	errno_t ec;
+
+	(void)pthread_mutex_lock(&signalfd_router.mutex);
+	if ((ec = signalfd_router_update_watchers(&signalfd->sigs,
+		 true)) != 0) {
+		(void)signalfd_router_update_watchers(&signalfd->sigs, false);
+	} else {
+		LIST_INSERT_HEAD(&signalfd_router.signalfds, signalfd,
+		    router_entry);
+		signalfd->router_generation = signalfd_router.generation;
+	}
+	(void)pthread_mutex_unlock(&signalfd_router.mutex);
+
+	return ec;
+}
+
+static void
+signalfd_router_remove(SignalFDCtx *signalfd)
+{
+	(void)pthread_mutex_lock(&signalfd_router.mutex);
+	LIST_REMOVE(signalfd, router_entry);
+	(void)signalfd_router_update_watchers(&signalfd->sigs, false);
+	(void)pthread_mutex_unlock(&signalfd_router.mutex);
+}
+
+/*
+ * On Linux, signals with disposition SIG_DFL and a default action of
+ * "ignored" are returned from sigwait. We can emulate this by registering an
+ * empty signal handler.
+ */
+static void
+signalfd_install_handlers(sigset_t const *sigs)
+{
+	for (int i = 1; i <= (int)_SIG_MAXSIG; ++i) {
+		if (sigismember(sigs, i) != 1) {
+			continue;
+		}
+
+		if (i == SIGCHLD || /**/
+		    i == SIGURG ||  /**/
+		    i == SIGCONT || /**/
 #ifdef SIGIO
-			    i == SIGIO || /**/
+		    i == SIGIO || /**/
 #endif
 #ifdef SIGWINCH
-			    i == SIGWINCH || /**/
+		    i == SIGWINCH || /**/
 #endif
 #ifdef SIGINFO
-			    i == SIGINFO || /**/
+		    i == SIGINFO || /**/
 #endif
 #ifdef SIGPWR
-			    i == SIGPWR || /**/
+		    i == SIGPWR || /**/
 #endif
 #ifdef SIGTHR
-			    i == SIGTHR || /**/
+		    i == SIGTHR || /**/
 #endif
-			    false) {
-				struct sigaction sa;
-
-				if (sigaction(i, NULL, &sa) == 0 &&
-				    !(sa.sa_flags & SA_SIGINFO) &&
-				    sa.sa_handler == SIG_DFL) {
-					sa.sa_flags |= SA_RESTART;
-					sa.sa_handler = signalfd_signal_handler;
-					(void)sigaction(i, &sa, NULL);
-				}
+		    false) {
+			struct sigaction sa;
+
+			if (sigaction(i, NULL, &sa) == 0 &&
+			    !(sa.sa_flags & SA_SIGINFO) &&
+			    sa.sa_handler == SIG_DFL) {
+				sa.sa_flags |= SA_RESTART;
+				sa.sa_handler = signalfd_signal_handler;
+				(void)sigaction(i, &sa, NULL);
 			}
 		}
 	}
+}
+
+errno_t
+signalfd_ctx_init(SignalFDCtx *signalfd, int kq, sigset_t const *sigs)
+{
+	errno_t ec;
+
+	assert(sigs != NULL);
+
+	*signalfd = (SignalFDCtx) { .sigs = *sigs, .kq = kq };
+
+	if ((ec = pthread_mutex_init(&signalfd->mutex, NULL)) != 0) {
+		return ec;
+	}
+
+	struct kevent kevs[2];
+	int n = 0;
+
+	if ((ec = kqueue_event_init(&signalfd->kqueue_event, kevs, &n,
+		 false)) != 0) {
+		goto out3;
+	}
 
-	n = kevent(kq, kevs, n, NULL, 0, NULL);
-	if (n < 0) {
+	signalfd_install_handlers(&signalfd->sigs);
+
+	if (kevent(kq, kevs, n, NULL, 0, NULL) < 0) {
 		ec = errno;
-		goto out;
+		goto out2;
+	}
+
+	if ((ec = signalfd_router_ref()) != 0) {
+		goto out2;
+	}
+
+	if ((ec = signalfd_router_add(signalfd)) != 0) {
+		goto out1;
 	}
 
+	/*
+	 * Signals that are already pending have not been seen by the router.
+	 */
 	bool has_pending;
 	if ((ec = signalfd_has_pending(signalfd, &has_pending, NULL)) != 0) {
 		goto out;
 	}
 	if (has_pending) {
-		if ((ec = signalfd_ctx_trigger_manually(signalfd, kq)) != 0) {
+		if ((ec = signalfd_ctx_trigger(signalfd, kq)) != 0) {
 			goto out;
 		}
 	}
@@ -127,8 +450,13 @@ signalfd_ctx_init(SignalFDCtx *signalfd, int kq, sigset_t const *sigs)
 	return 0;
 
 out:
-	(void)kqueue_event_terminate(&signalfd->kqueue_event);
+	signalfd_router_remove(signalfd);
+out1:
+	signalfd_router_unref();
 out2:
+	(void)kqueue_event_terminate(&signalfd->kqueue_event);
+out3:
+	(void)pthread_mutex_destroy(&signalfd->mutex);
 	return ec;
 }
 
@@ -138,9 +466,17 @@ signalfd_ctx_terminate(SignalFDCtx *signalfd)
 	errno_t ec = 0;
 	errno_t ec_local;
 
+	if (signalfd->router_generation == signalfd_router.generation) {
+		signalfd_router_remove(signalfd);
+		signalfd_router_unref();
+	}
+
 	ec_local = kqueue_event_terminate(&signalfd->kqueue_event);
 	ec = ec != 0 ? ec : ec_local;
 
+	ec_local = pthread_mutex_destroy(&signalfd->mutex);
+	ec = ec != 0 ? ec : ec_local;
+
 	return ec;
 }
 
@@ -225,6 +561,8 @@ signalfd_ctx_read_impl(SignalFDCtx *signalfd,
 		return ec;
 	}
 
+	EPOLL_SHIM_SIGNALFD_DEQUEUE(signalfd, siginfo.si_signo);
+
 	/*
 	 * First, fill the POSIX compatible fields, then anything else OS
 	 * specific we have.
@@ -280,21 +618,39 @@ signalfd_ctx_read_impl(SignalFDCtx *signalfd,
 	return 0;
 }
 
+/*
+ * Brings the readiness of the kq in line with the pending signals. Must be
+ * called with the mutex of the signalfd held, but not with the one of the
+ * router, so that 'sigpending' and the kevent calls of one signalfd do not
+ * hold up the others. Returns true if there are pending signals. If
+ * 'check_pending' is false, the caller has just seen that there are no
+ * pending signals.
+ */
 static bool
-signalfd_ctx_clear_signal(SignalFDCtx *signalfd, int kq, bool was_triggered)
+signalfd_ctx_update_readiness(SignalFDCtx *signalfd, int kq,
+    bool check_pending)
 {
-	if (was_triggered) {
+	if (check_pending) {
 		/*
-		 * When there are other signals pending we can keep the kq
-		 * readable and therefore don't need to clear it.
+		 * When there are signals pending we can keep the kq readable
+		 * (or make it readable) and don't need to clear it.
 		 */
 		bool has_pending;
 		if (signalfd_has_pending(signalfd, &has_pending, NULL) != 0 ||
 		    has_pending) {
+			(void)signalfd_ctx_trigger_manually(signalfd, kq);
 			return true;
 		}
 	}
 
+	/*
+	 * The router triggers the kq only with the mutex of the signalfd held,
+	 * so there is nothing to clear unless it has been triggered already.
+	 */
+	if (!kqueue_event_is_triggered(&signalfd->kqueue_event)) {
+		return false;
+	}
+
 	/*
 	 * Clear the kq. Signals can arrive here, leading to a race.
 	 */
@@ -315,22 +671,91 @@ signalfd_ctx_clear_signal(SignalFDCtx *signalfd, int kq, bool was_triggered)
 }
 
 errno_t
-signalfd_ctx_read(SignalFDCtx *signalfd, int kq, SignalFDCtxSiginfo *siginfo)
+signalfd_ctx_set_mask(SignalFDCtx *signalfd, int kq, sigset_t const *sigs)
 {
 	errno_t ec;
 
-	ec = signalfd_ctx_read_impl(signalfd, siginfo);
-	if (ec == 0 || ec == EAGAIN || ec == EWOULDBLOCK) {
-		(void)signalfd_ctx_clear_signal(signalfd, kq, false);
+	if (signalfd->router_generation != signalfd_router.generation) {
+		return EBADF;
 	}
 
+	signalfd_install_handlers(sigs);
+
+	(void)pthread_mutex_lock(&signalfd_router.mutex);
+
+	/*
+	 * Add the new watchers before dropping the old ones, so that only
+	 * signals that were not watched before (or are not watched anymore)
+	 * need kevents.
+	 */
+	if ((ec = signalfd_router_update_watchers(sigs, true)) != 0) {
+		(void)signalfd_router_update_watchers(sigs, false);
+		goto out;
+	}
+	(void)signalfd_router_update_watchers(&signalfd->sigs, false);
+
+	signalfd->sigs = *sigs;
+
+	(void)pthread_mutex_unlock(&signalfd_router.mutex);
+
+	(void)pthread_mutex_lock(&signalfd->mutex);
+	(void)signalfd_ctx_update_readiness(signalfd, kq, true);
+	(void)pthread_mutex_unlock(&signalfd->mutex);
+
+	return 0;
+
+out:
+	(void)pthread_mutex_unlock(&signalfd_router.mutex);
 	return ec;
 }
 
+errno_t
+signalfd_ctx_read(SignalFDCtx *signalfd, int kq, SignalFDCtxSiginfo *siginfos,
+    size_t nr_siginfos, size_t *nr_read)
+{
+	errno_t ec = 0;
+	size_t n = 0;
+
+	stats_add(STAT_SIGNALFD_OPS, 1);
+
+	/*
+	 * Dequeue as many signals as possible first. The kq has to be cleared
+	 * only once all of them are gone.
+	 */
+	while (n < nr_siginfos) {
+		memset(&siginfos[n], 0, sizeof(siginfos[n]));
+		if ((ec = signalfd_ctx_read_impl(signalfd, &siginfos[n])) != 0) {
+			break;
+		}
+		++n;
+	}
+
+	if (ec == EAGAIN || ec == EWOULDBLOCK) {
+		(void)pthread_mutex_lock(&signalfd->mutex);
+		(void)signalfd_ctx_update_readiness(signalfd, kq, false);
+		(void)pthread_mutex_unlock(&signalfd->mutex);
+	}
+
+	*nr_read = n;
+	return n > 0 ? 0 : ec;
+}
+
 void
 signalfd_ctx_poll(SignalFDCtx *signalfd, int kq, uint32_t *revents)
 {
-	bool pending = signalfd_ctx_clear_signal(signalfd, kq, revents != NULL);
+	(void)pthread_mutex_lock(&signalfd->mutex);
+	/*
+	 * When asked for the events, the kqueue has been reported as
+	 * readable. Unless the router has triggered this signalfd since it
+	 * was last cleared, no watched signal has arrived in the meantime and
+	 * we can skip 'sigpending'. Signals directed at the calling thread
+	 * might still be pending, so always check when only asked to update
+	 * the kqueue.
+	 */
+	bool pending = (revents == NULL ||
+			   kqueue_event_is_triggered(&signalfd->kqueue_event)) &&
+	    signalfd_ctx_update_readiness(signalfd, kq, true);
+	(void)pthread_mutex_unlock(&signalfd->mutex);
 	if (revents) {
 		*revents = pending ? POLLIN : 0;
 	}
@@ -1,6 +1,8 @@
 #ifndef SIGNALFD_CTX_H_
 #define SIGNALFD_CTX_H_
 
+#include <sys/queue.h>
+
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -9,9 +11,20 @@
 
 #include "kqueue_event.h"
 
-typedef struct {
+typedef struct signalfd_ctx_ {
 	sigset_t sigs;
+	int kq;
+
+	/*
+	 * Protected by 'mutex'. The router thread takes it (with its own mutex
+	 * held) only to trigger the kq.
+	 */
+	pthread_mutex_t mutex;
 	KQueueEvent kqueue_event;
+
+	/* Protected by the mutex of the signal router. */
+	LIST_ENTRY(signalfd_ctx_) router_entry;
+	unsigned long router_generation;
 } SignalFDCtx;
 
 typedef struct {
@@ -35,11 +48,23 @@ typedef struct {
 	uint8_t pad[46];
 } SignalFDCtxSiginfo;
 
+/*
+ * A signalfd becomes readable whenever a signal in its mask arrives at the
+ * process. The router cannot tell which thread a signal was directed at or
+ * whether another signalfd (or 'sigwait') has dequeued it already, so the
+ * readiness may be spurious. A 'read' will then fail with EAGAIN.
+ */
 errno_t signalfd_ctx_init(SignalFDCtx *signalfd, int kq, sigset_t const *sigs);
 errno_t signalfd_ctx_terminate(SignalFDCtx *signalfd);
 
+errno_t signalfd_ctx_set_mask(SignalFDCtx *signalfd, int kq,
+    sigset_t const *sigs);
+
+/*
+ * Dequeues up to 'nr_siginfos' signals. Returns EAGAIN if there are none.
+ */
 errno_t signalfd_ctx_read(SignalFDCtx *signalfd, int kq,
-    SignalFDCtxSiginfo *siginfo);
+    SignalFDCtxSiginfo *siginfos, size_t nr_siginfos, size_t *nr_read);
 void signalfd_ctx_poll(SignalFDCtx *signalfd, int kq, uint32_t *revents);
 
 #endif
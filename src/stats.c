@@ -0,0 +1,132 @@
+#include "stats.h"
+
+#include <sys/queue.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#include <stddef.h>
+
+#include <epoll-shim/stats.h>
+
+/* Public and internal counters are copied with 'memcpy'. */
+_Static_assert(sizeof(struct epoll_shim_stats) == sizeof(Stats), "");
+_Static_assert(offsetof(struct epoll_shim_stats, signalfd_ops) ==
+	STAT_SIGNALFD_OPS * sizeof(uint64_t),
+    "");
+
+typedef struct stats_thread_ {
+	atomic_uint_least64_t n[STAT_COUNT];
+	bool is_registered;
+	LIST_ENTRY(stats_thread_) entry;
+} StatsThread;
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(stats_threads_, stats_thread_) stats_threads =
+    LIST_HEAD_INITIALIZER(stats_threads);
+/* Counts of threads that have exited. */
+static uint64_t stats_retired[STAT_COUNT];
+
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static bool stats_key_created;
+
+static _Thread_local StatsThread stats_thread;
+static _Thread_local Stats *stats_attributed;
+
+static void
+stats_thread_exit(void *arg)
+{
+	StatsThread *thread = arg;
+
+	(void)pthread_mutex_lock(&stats_mutex);
+	for (int i = 0; i < STAT_COUNT; ++i) {
+		stats_retired[i] += atomic_load_explicit(&thread->n[i],
+		    memory_order_relaxed);
+		atomic_store_explicit(&thread->n[i], 0, memory_order_relaxed);
+	}
+	LIST_REMOVE(thread, entry);
+	thread->is_registered = false;
+	(void)pthread_mutex_unlock(&stats_mutex);
+}
+
+static void
+stats_key_create(void)
+{
+	stats_key_created = pthread_key_create(&stats_key,
+				stats_thread_exit) == 0;
+}
+
+static StatsThread *
+stats_thread_get(void)
+{
+	StatsThread *thread = &stats_thread;
+
+	if (!thread->is_registered) {
+		(void)pthread_once(&stats_key_once, stats_key_create);
+		if (!stats_key_created ||
+		    pthread_setspecific(stats_key, thread) != 0) {
+			return NULL;
+		}
+
+		(void)pthread_mutex_lock(&stats_mutex);
+		LIST_INSERT_HEAD(&stats_threads, thread, entry);
+		thread->is_registered = true;
+		(void)pthread_mutex_unlock(&stats_mutex);
+	}
+
+	return thread;
+}
+
+void
+stats_add(Stat stat, uint64_t n)
+{
+	StatsThread *thread = stats_thread_get();
+
+	/* Only this thread writes to its block, so no RMW is needed. */
+	if (thread != NULL) {
+		atomic_store_explicit(&thread->n[stat],
+		    atomic_load_explicit(&thread->n[stat],
+			memory_order_relaxed) +
+			n,
+		    memory_order_relaxed);
+	}
+
+	if (stats_attributed != NULL) {
+		stats_attributed->n[stat] += n;
+	}
+}
+
+void
+stats_get(Stats *stats)
+{
+	(void)pthread_mutex_lock(&stats_mutex);
+
+	for (int i = 0; i < STAT_COUNT; ++i) {
+		stats->n[i] = stats_retired[i];
+	}
+
+	StatsThread *thread;
+	LIST_FOREACH (thread, &stats_threads, entry) {
+		for (int i = 0; i < STAT_COUNT; ++i) {
+			stats->n[i] += atomic_load_explicit(&thread->n[i],
+			    memory_order_relaxed);
+		}
+	}
+
+	(void)pthread_mutex_unlock(&stats_mutex);
+}
+
+void
+stats_attribute_begin(Stats *stats)
+{
+	stats_attributed = stats;
+}
+
+void
+stats_attribute_end(void)
+{
+	stats_attributed = NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+/*
+ * Event counters, mirroring 'struct epoll_shim_stats' from the public
+ * <epoll-shim/stats.h>. Every thread counts into its own block. The blocks
+ * are only summed up when the counters are read.
+ */
+
+typedef enum {
+	STAT_EPOLL_WAIT_CALLS,
+	STAT_EMPTY_WAKEUPS,
+	STAT_WAIT_RETRIES,
+	STAT_KEVENT_CALLS,
+	STAT_KEVENT_CHANGES,
+	STAT_COMPLETION_KQUEUES,
+	STAT_EOF_REREGISTRATIONS,
+	STAT_REPOLLS,
+	STAT_REPOLL_WAITS,
+	STAT_EVENTFD_OPS,
+	STAT_TIMERFD_OPS,
+	STAT_SIGNALFD_OPS,
+	STAT_COUNT,
+} Stat;
+
+typedef struct {
+	uint64_t n[STAT_COUNT];
+} Stats;
+
+void stats_add(Stat stat, uint64_t n);
+void stats_get(Stats *stats);
+
+/*
+ * Between 'begin' and 'end', the calling thread's counts are also added to
+ * 'stats'. The caller must serialize access to 'stats'.
+ */
+void stats_attribute_begin(Stats *stats);
+void stats_attribute_end(void);
+
+#endif
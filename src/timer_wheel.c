@@ -0,0 +1,206 @@
+#include "timer_wheel.h"
+
+#include <assert.h>
+
+#define TIMER_WHEEL_SLOT_MASK ((uint64_t)TIMER_WHEEL_SLOTS - 1)
+
+static unsigned int
+level_shift(unsigned int level)
+{
+	return level * TIMER_WHEEL_LEVEL_BITS;
+}
+
+static unsigned int
+slot_index(uint64_t tick, unsigned int level)
+{
+	return (unsigned int)((tick >> level_shift(level)) &
+	    TIMER_WHEEL_SLOT_MASK);
+}
+
+void
+timer_wheel_init(TimerWheel *wheel, uint64_t now)
+{
+	*wheel = (TimerWheel) { .now = now };
+
+	for (unsigned int l = 0; l < TIMER_WHEEL_LEVELS; ++l) {
+		for (unsigned int s = 0; s < TIMER_WHEEL_SLOTS; ++s) {
+			LIST_INIT(&wheel->slots[l][s]);
+		}
+	}
+}
+
+void
+timer_wheel_entry_init(TimerWheelEntry *entry)
+{
+	*entry = (TimerWheelEntry) {};
+}
+
+static void
+timer_wheel_place(TimerWheel *wheel, TimerWheelEntry *entry)
+{
+	uint64_t expiry = entry->expiry < wheel->now ? /**/
+	    wheel->now :
+	    entry->expiry;
+
+	/*
+	 * Use the lowest level where the expiry time and the current time
+	 * share all higher order bits. Entries that are too far in the future
+	 * stay on the top level and are re-placed each time their slot comes
+	 * around.
+	 */
+	unsigned int level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 &&
+	    (expiry >> level_shift(level + 1)) !=
+		(wheel->now >> level_shift(level + 1))) {
+		++level;
+	}
+
+	unsigned int slot = slot_index(expiry, level);
+
+	entry->level = (uint8_t)level;
+	entry->slot = (uint8_t)slot;
+	LIST_INSERT_HEAD(&wheel->slots[level][slot], entry, entry);
+	wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void
+timer_wheel_unlink(TimerWheel *wheel, TimerWheelEntry *entry)
+{
+	LIST_REMOVE(entry, entry);
+	if (LIST_EMPTY(&wheel->slots[entry->level][entry->slot])) {
+		wheel->occupied[entry->level] &= ~((uint64_t)1 << entry->slot);
+	}
+}
+
+void
+timer_wheel_add(TimerWheel *wheel, TimerWheelEntry *entry, uint64_t expiry)
+{
+	assert(!entry->is_pending);
+
+	entry->expiry = expiry;
+	entry->is_pending = true;
+	timer_wheel_place(wheel, entry);
+	++wheel->nr_entries;
+}
+
+void
+timer_wheel_remove(TimerWheel *wheel, TimerWheelEntry *entry)
+{
+	if (!entry->is_pending) {
+		return;
+	}
+
+	timer_wheel_unlink(wheel, entry);
+	entry->is_pending = false;
+	--wheel->nr_entries;
+}
+
+bool
+timer_wheel_next_event(TimerWheel const *wheel, uint64_t *tick)
+{
+	bool found = false;
+	uint64_t next = UINT64_MAX;
+
+	for (unsigned int l = 0; l < TIMER_WHEEL_LEVELS; ++l) {
+		uint64_t occupied = wheel->occupied[l];
+		if (occupied == 0) {
+			continue;
+		}
+
+		unsigned int shift = level_shift(l);
+		unsigned int index = slot_index(wheel->now, l);
+
+		/*
+		 * On higher levels, the current slot has already been
+		 * cascaded unless 'now' is exactly at its start. Entries that
+		 * are in earlier slots belong to a later round (this can only
+		 * happen on the top level).
+		 */
+		uint64_t mask = ~(uint64_t)0 << index;
+		if ((wheel->now & (((uint64_t)1 << shift) - 1)) != 0) {
+			mask = index == TIMER_WHEEL_SLOTS - 1 ? 0 : mask << 1;
+		}
+
+		uint64_t base = wheel->now >> (shift + TIMER_WHEEL_LEVEL_BITS)
+		    << (shift + TIMER_WHEEL_LEVEL_BITS);
+
+		uint64_t candidates = occupied & mask;
+		if (candidates == 0) {
+			candidates = occupied;
+			base += (uint64_t)1 << (shift + TIMER_WHEEL_LEVEL_BITS);
+		}
+
+		uint64_t t = base |
+		    ((uint64_t)__builtin_ctzll(candidates) << shift);
+		if (t < next) {
+			next = t;
+		}
+		found = true;
+	}
+
+	if (found) {
+		*tick = next;
+	}
+	return found;
+}
+
+static void
+timer_wheel_cascade(TimerWheel *wheel, unsigned int level, unsigned int slot)
+{
+	TimerWheelSlot entries = LIST_HEAD_INITIALIZER(entries);
+	LIST_SWAP(&entries, &wheel->slots[level][slot], timer_wheel_entry_,
+	    entry);
+	wheel->occupied[level] &= ~((uint64_t)1 << slot);
+
+	TimerWheelEntry *entry;
+	while ((entry = LIST_FIRST(&entries)) != NULL) {
+		LIST_REMOVE(entry, entry);
+		timer_wheel_place(wheel, entry);
+	}
+}
+
+void
+timer_wheel_advance(TimerWheel *wheel, uint64_t now,
+    timer_wheel_fire_fun fire_fun, void *arg)
+{
+	while (wheel->now <= now) {
+		uint64_t t;
+		if (!timer_wheel_next_event(wheel, &t) || t > now) {
+			wheel->now = now + 1;
+			break;
+		}
+
+		wheel->now = t;
+
+		for (unsigned int l = TIMER_WHEEL_LEVELS - 1; l > 0; --l) {
+			uint64_t lower_bits = ((uint64_t)1 << level_shift(l)) -
+			    1;
+			if ((t & lower_bits) != 0) {
+				continue;
+			}
+
+			unsigned int slot = slot_index(t, l);
+			if (wheel->occupied[l] & ((uint64_t)1 << slot)) {
+				timer_wheel_cascade(wheel, l, slot);
+			}
+		}
+
+		unsigned int slot = slot_index(t, 0);
+		TimerWheelSlot fired = LIST_HEAD_INITIALIZER(fired);
+		LIST_SWAP(&fired, &wheel->slots[0][slot], timer_wheel_entry_,
+		    entry);
+		wheel->occupied[0] &= ~((uint64_t)1 << slot);
+
+		/* Entries re-added from 'fire_fun' must land in later ticks. */
+		wheel->now = t + 1;
+
+		TimerWheelEntry *entry;
+		while ((entry = LIST_FIRST(&fired)) != NULL) {
+			LIST_REMOVE(entry, entry);
+			assert(entry->expiry <= t);
+			entry->is_pending = false;
+			--wheel->nr_entries;
+			fire_fun(entry, arg);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <sys/queue.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Hierarchical timer wheel. Expiry times are given in abstract "ticks".
+ * Adding and removing entries is O(1). Advancing the wheel cascades entries
+ * from the coarser levels down to level 0, from where they fire.
+ */
+
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS 6
+
+struct timer_wheel_entry_;
+typedef struct timer_wheel_entry_ TimerWheelEntry;
+
+struct timer_wheel_entry_ {
+	LIST_ENTRY(timer_wheel_entry_) entry;
+	uint64_t expiry;
+	bool is_pending;
+	uint8_t level;
+	uint8_t slot;
+};
+
+typedef LIST_HEAD(timer_wheel_slot_, timer_wheel_entry_) TimerWheelSlot;
+
+typedef struct {
+	/* First tick that has not been processed yet. */
+	uint64_t now;
+	uint64_t occupied[TIMER_WHEEL_LEVELS];
+	TimerWheelSlot slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	size_t nr_entries;
+} TimerWheel;
+
+typedef void (*timer_wheel_fire_fun)(TimerWheelEntry *entry, void *arg);
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now);
+
+void timer_wheel_entry_init(TimerWheelEntry *entry);
+
+/* Expiry times in the past fire on the next call to 'timer_wheel_advance'. */
+void timer_wheel_add(TimerWheel *wheel, TimerWheelEntry *entry,
+    uint64_t expiry);
+void timer_wheel_remove(TimerWheel *wheel, TimerWheelEntry *entry);
+
+/*
+ * Returns the earliest tick at which 'timer_wheel_advance' has work to do,
+ * i.e. either an entry fires or a slot must be cascaded. This is a lower
+ * bound on the next expiry time.
+ */
+bool timer_wheel_next_event(TimerWheel const *wheel, uint64_t *tick);
+
+/*
+ * Processes all ticks up to and including 'now'. Fired entries are removed
+ * from the wheel before 'fire_fun' is called, so it may re-add them.
+ */
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now,
+    timer_wheel_fire_fun fire_fun, void *arg);
+
+#endif
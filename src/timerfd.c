@@ -27,10 +27,10 @@ timerfd_ctx_read_or_block(FileDescription *desc, int kq, uint64_t *value)
 	TimerFDCtx *timerfd = &desc->ctx.timerfd;
 
 	for (;;) {
-		(void)pthread_mutex_lock(&desc->mutex);
+		profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		ec = timerfd_ctx_read(timerfd, kq, value);
 		bool nonblock = (desc->flags & O_NONBLOCK) != 0;
-		(void)pthread_mutex_unlock(&desc->mutex);
+		profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 		if (nonblock && ec == 0 && *value == 0) {
 			ec = EAGAIN;
 		}
@@ -81,28 +81,25 @@ timerfd_close(FileDescription *desc)
 	assert(ec == 0);
 	(void)ec;
 
-	int const old_can_jump = /**/
-	    desc->ctx.timerfd.clockid == CLOCK_REALTIME &&
-	    desc->ctx.timerfd.is_abstime;
-	epoll_shim_ctx_update_realtime_change_monitoring(epoll_shim_ctx,
-	    -old_can_jump);
+	epoll_shim_ctx_update_realtime_change_monitoring(epoll_shim_ctx, desc,
+	    -1, false);
 	return timerfd_ctx_terminate(&desc->ctx.timerfd);
 }
 
 static void
 timerfd_poll(FileDescription *desc, int kq, uint32_t *revents)
 {
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	timerfd_ctx_poll(&desc->ctx.timerfd, kq, revents);
-	(void)pthread_mutex_unlock(&desc->mutex);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 }
 
 static void
 timerfd_realtime_change(FileDescription *desc, int kq)
 {
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	timerfd_ctx_realtime_change(&desc->ctx.timerfd, kq);
-	(void)pthread_mutex_unlock(&desc->mutex);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 }
 
 static struct file_description_vtable const timerfd_vtable = {
@@ -122,12 +119,13 @@ timerfd_create_impl(int *fd_out, int clockid, int flags)
 		return EINVAL;
 	}
 
-	if (flags & ~(TFD_CLOEXEC | TFD_NONBLOCK)) {
+	if (flags & ~(TFD_CLOEXEC | TFD_NONBLOCK | TFD_WHEEL)) {
 		return EINVAL;
 	}
 
 	_Static_assert(TFD_CLOEXEC == O_CLOEXEC, "");
 	_Static_assert(TFD_NONBLOCK == O_NONBLOCK, "");
+	_Static_assert((TFD_WHEEL & (O_CLOEXEC | O_NONBLOCK)) == 0, "");
 
 	EpollShimCtx *epoll_shim_ctx;
 	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
@@ -144,7 +142,8 @@ timerfd_create_impl(int *fd_out, int clockid, int flags)
 
 	desc->flags = flags & O_NONBLOCK;
 
-	if ((ec = timerfd_ctx_init(&desc->ctx.timerfd, clockid)) != 0) {
+	if ((ec = timerfd_ctx_init(&desc->ctx.timerfd, clockid,
+		 (flags & TFD_WHEEL) != 0)) != 0) {
 		goto fail;
 	}
 
@@ -173,24 +172,12 @@ timerfd_create(int clockid, int flags)
 }
 
 static errno_t
-timerfd_settime_impl(int fd, int flags, const struct itimerspec *new,
-    struct itimerspec *old)
+timerfd_settime_one(EpollShimCtx *epoll_shim_ctx, int fd, int flags,
+    const struct itimerspec *new, struct itimerspec *old,
+    TimerFDClockCache *clocks)
 {
 	errno_t ec;
 
-	if (!new) {
-		return EFAULT;
-	}
-
-	if (flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET)) {
-		return EINVAL;
-	}
-
-	EpollShimCtx *epoll_shim_ctx;
-	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
-		return ec;
-	}
-
 	FileDescription *desc = epoll_shim_ctx_find_desc(epoll_shim_ctx, fd);
 	if (!desc || desc->vtable != &timerfd_vtable) {
 		struct stat sb;
@@ -198,27 +185,21 @@ timerfd_settime_impl(int fd, int flags, const struct itimerspec *new,
 		goto out;
 	}
 
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	{
-		int const old_can_jump = /**/
-		    desc->ctx.timerfd.clockid == CLOCK_REALTIME &&
-		    desc->ctx.timerfd.is_abstime;
-
 		ec = timerfd_ctx_settime(&desc->ctx.timerfd, fd,
 		    (flags & TFD_TIMER_ABSTIME) != 0,	    /**/
 		    (flags & TFD_TIMER_CANCEL_ON_SET) != 0, /**/
-		    new, old);
+		    new, old, clocks);
 
 		if (ec == 0 || ec == ECANCELED) {
-			int const new_can_jump = /**/
-			    desc->ctx.timerfd.clockid == CLOCK_REALTIME &&
-			    desc->ctx.timerfd.is_abstime;
-
 			epoll_shim_ctx_update_realtime_change_monitoring(
-			    epoll_shim_ctx, new_can_jump - old_can_jump);
+			    epoll_shim_ctx, desc, fd,
+			    timerfd_ctx_needs_step_detection(
+				&desc->ctx.timerfd));
 		}
 	}
-	(void)pthread_mutex_unlock(&desc->mutex);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 
 out:
 	if (desc) {
@@ -227,6 +208,29 @@ out:
 	return ec;
 }
 
+static errno_t
+timerfd_settime_impl(int fd, int flags, const struct itimerspec *new,
+    struct itimerspec *old)
+{
+	errno_t ec;
+
+	if (!new) {
+		return EFAULT;
+	}
+
+	if (flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET)) {
+		return EINVAL;
+	}
+
+	EpollShimCtx *epoll_shim_ctx;
+	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
+		return ec;
+	}
+
+	return timerfd_settime_one(epoll_shim_ctx, fd, flags, new, old,
+	    &(TimerFDClockCache) {});
+}
+
 EPOLL_SHIM_EXPORT
 int
 timerfd_settime(int fd, int flags, const struct itimerspec *new,
@@ -240,6 +244,56 @@ timerfd_settime(int fd, int flags, const struct itimerspec *new,
 	ERRNO_RETURN(ec, -1, 0);
 }
 
+static errno_t
+timerfd_settime_many_impl(int const *fds, int flags,
+    struct itimerspec const *new, int *errors, size_t n)
+{
+	errno_t ec;
+
+	if ((!fds || !new) && n > 0) {
+		return EFAULT;
+	}
+
+	if (flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET)) {
+		return EINVAL;
+	}
+
+	EpollShimCtx *epoll_shim_ctx;
+	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
+		return ec;
+	}
+
+	/* All relative timers are armed relative to the same time. */
+	TimerFDClockCache clocks = {};
+
+	errno_t first_ec = 0;
+	for (size_t i = 0; i < n; ++i) {
+		ec = timerfd_settime_one(epoll_shim_ctx, fds[i], flags, &new[i],
+		    NULL, &clocks);
+		if (errors) {
+			errors[i] = ec;
+		}
+		if (first_ec == 0) {
+			first_ec = ec;
+		}
+	}
+
+	return first_ec;
+}
+
+EPOLL_SHIM_EXPORT
+int
+timerfd_settime_many(int const *fds, int flags, struct itimerspec const *new,
+    int *errors, size_t n)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	ec = timerfd_settime_many_impl(fds, flags, new, errors, n);
+
+	ERRNO_RETURN(ec, -1, 0);
+}
+
 static errno_t
 timerfd_gettime_impl(int fd, struct itimerspec *cur)
 {
@@ -257,9 +311,9 @@ timerfd_gettime_impl(int fd, struct itimerspec *cur)
 		goto out;
 	}
 
-	(void)pthread_mutex_lock(&desc->mutex);
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 	ec = timerfd_ctx_gettime(&desc->ctx.timerfd, cur);
-	(void)pthread_mutex_unlock(&desc->mutex);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
 
 out:
 	if (desc) {
@@ -279,3 +333,47 @@ timerfd_gettime(int fd, struct itimerspec *cur)
 
 	ERRNO_RETURN(ec, -1, 0);
 }
+
+static errno_t
+timerfd_set_slack_impl(int fd, struct timespec const *slack)
+{
+	errno_t ec;
+
+	if (!slack) {
+		return EFAULT;
+	}
+
+	EpollShimCtx *epoll_shim_ctx;
+	if ((ec = epoll_shim_ctx_global(&epoll_shim_ctx)) != 0) {
+		return ec;
+	}
+
+	FileDescription *desc = epoll_shim_ctx_find_desc(epoll_shim_ctx, fd);
+	if (!desc || desc->vtable != &timerfd_vtable) {
+		struct stat sb;
+		ec = (fd < 0 || fstat(fd, &sb)) ? EBADF : EINVAL;
+		goto out;
+	}
+
+	profiled_mutex_lock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+	ec = timerfd_ctx_set_slack(&desc->ctx.timerfd, fd, slack);
+	profiled_mutex_unlock(&desc->mutex, LOCK_CLASS_DESC_MUTEX);
+
+out:
+	if (desc) {
+		(void)file_description_unref(&desc);
+	}
+	return ec;
+}
+
+EPOLL_SHIM_EXPORT
+int
+timerfd_set_slack(int fd, struct timespec const *slack)
+{
+	ERRNO_SAVE;
+	errno_t ec;
+
+	ec = timerfd_set_slack_impl(fd, slack);
+
+	ERRNO_RETURN(ec, -1, 0);
+}
@@ -9,12 +9,25 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <signal.h>
+#include <stddef.h>
 
+#include "probes.h"
+#include "stats.h"
 #include "timespec_util.h"
 #include "wrap.h"
 
+/*
+ * If the kernel's absolute timers follow steps of the realtime clock, it can
+ * schedule absolute CLOCK_REALTIME timers on its own. Only timers with
+ * TFD_TIMER_CANCEL_ON_SET then need the realtime step detector.
+ */
+#if defined(NOTE_ABSTIME) && defined(HAVE_REALTIME_NOTE_ABSTIME)
+#define TIMERFD_HAVE_REALTIME_KEVENT
+#endif
+
 static bool
 timerfd_ctx_is_disarmed(TimerFDCtx const *timerfd)
 {
@@ -37,6 +50,7 @@ timerfd_ctx_disarm(TimerFDCtx *timerfd)
 	timerfd->current_itimerspec.it_value.tv_sec = 0;
 	timerfd->current_itimerspec.it_value.tv_nsec = 0;
 	timerfd->timer_type = TIMER_TYPE_UNSPECIFIED;
+	timerfd->is_periodic_kevent = false;
 }
 
 static errno_t
@@ -113,10 +127,24 @@ static void timerfd_ctx_rearm_kevent(TimerFDCtx *timerfd, int kq,
     struct timespec const *current_time,
     bool need_kevent_delete_on_disarmed_timer);
 
+bool
+timerfd_ctx_needs_step_detection(TimerFDCtx const *timerfd)
+{
+	if (timerfd->clockid != CLOCK_REALTIME || !timerfd->is_abstime) {
+		return false;
+	}
+
+#ifdef TIMERFD_HAVE_REALTIME_KEVENT
+	return timerfd->is_cancel_on_set;
+#else
+	return true;
+#endif
+}
+
 void
 timerfd_ctx_realtime_change(TimerFDCtx *timerfd, int kq)
 {
-	if (!timerfd_ctx_can_jump(timerfd)) {
+	if (!timerfd_ctx_needs_step_detection(timerfd)) {
 		return;
 	}
 
@@ -328,34 +356,42 @@ round_up_millis(int64_t millis, int64_t *result)
 }
 #endif
 
-static errno_t
-timerfd_ctx_register_event(TimerFDCtx *timerfd, int kq,
-    struct timespec const *new, struct timespec const *current_time)
+/*
+ * Fills in a oneshot EVFILT_TIMER kevent that fires after 'diff_time'.
+ * Returns false if the timeout is too large to be represented.
+ */
+static bool
+timer_kevent_set(struct kevent *kev, uintptr_t ident,
+    struct timespec const *diff_time)
 {
-	(void)timerfd;
-	assert(new->tv_sec != 0 || new->tv_nsec != 0);
+	bool kev_is_set = false;
 
-	struct timespec diff_time;
-	if (!timespecsub_safe(new, current_time, &diff_time) ||
-	    diff_time.tv_sec < 0) {
-		diff_time.tv_sec = 0;
-		diff_time.tv_nsec = 0;
+	/* Let's hope nobody needs timeouts larger than 10 years. */
+	if (diff_time->tv_sec >= 315360000) {
+		return false;
 	}
 
-	struct kevent kev[2];
-	bool kev_is_set = false;
+#ifdef NOTE_NSECONDS
+	{
+		int64_t nanos = (int64_t)diff_time->tv_sec * 1000000000 +
+		    diff_time->tv_nsec;
 
-	/* Let's hope nobody needs timeouts larger than 10 years. */
-	if (diff_time.tv_sec >= 315360000) {
-		goto out;
+		/* Fall back to coarser units if the data field is too small. */
+		if (!__builtin_add_overflow(nanos, 0, &kev->data)) {
+			EV_SET(kev, ident, EVFILT_TIMER,
+			    EV_ADD | EV_ONESHOT | EV_RECEIPT, /**/
+			    NOTE_NSECONDS, nanos, 0);
+			kev_is_set = true;
+		}
 	}
+#endif
 
 #ifdef NOTE_USECONDS
 	if (!kev_is_set) {
-		int64_t micros = (int64_t)diff_time.tv_sec * 1000000 +
-		    diff_time.tv_nsec / 1000;
+		int64_t micros = (int64_t)diff_time->tv_sec * 1000000 +
+		    diff_time->tv_nsec / 1000;
 
-		if ((diff_time.tv_nsec % 1000) != 0) {
+		if ((diff_time->tv_nsec % 1000) != 0) {
 			++micros;
 		}
 
@@ -364,8 +400,8 @@ timerfd_ctx_register_event(TimerFDCtx *timerfd, int kq,
 
 		/* The data field is only 32 bit wide on FreeBSD 11 i386. If
 		 * this would overflow, try again with milliseconds. */
-		if (!__builtin_add_overflow(micros, 0, &kev[1].data)) {
-			EV_SET(&kev[1], 0, EVFILT_TIMER,
+		if (!__builtin_add_overflow(micros, 0, &kev->data)) {
+			EV_SET(kev, ident, EVFILT_TIMER,
 			    EV_ADD | EV_ONESHOT | EV_RECEIPT, /**/
 			    NOTE_USECONDS, micros, 0);
 			kev_is_set = true;
@@ -376,28 +412,28 @@ timerfd_ctx_register_event(TimerFDCtx *timerfd, int kq,
 	if (!kev_is_set) {
 #ifdef QUIRKY_EVFILT_TIMER
 		/* Let's hope 49 days are enough. */
-		if (diff_time.tv_sec >= 4233600) {
-			goto out;
+		if (diff_time->tv_sec >= 4233600) {
+			return false;
 		}
 #endif
 
-		int64_t millis = (int64_t)diff_time.tv_sec * 1000 +
-		    diff_time.tv_nsec / 1000000;
+		int64_t millis = (int64_t)diff_time->tv_sec * 1000 +
+		    diff_time->tv_nsec / 1000000;
 
-		if ((diff_time.tv_nsec % 1000000) != 0) {
+		if ((diff_time->tv_nsec % 1000000) != 0) {
 			++millis;
 		}
 
 #ifdef QUIRKY_EVFILT_TIMER
 		if (millis != 0 && !round_up_millis(millis, &millis)) {
-			goto out;
+			return false;
 		}
 #endif
 
-		if (__builtin_add_overflow(millis, 0, &kev[1].data)) {
-			goto out;
+		if (__builtin_add_overflow(millis, 0, &kev->data)) {
+			return false;
 		}
-		EV_SET(&kev[1], 0, EVFILT_TIMER,      /**/
+		EV_SET(kev, ident, EVFILT_TIMER,      /**/
 		    EV_ADD | EV_ONESHOT | EV_RECEIPT, /**/
 		    0, millis, 0);
 		kev_is_set = true;
@@ -406,12 +442,157 @@ timerfd_ctx_register_event(TimerFDCtx *timerfd, int kq,
 	assert(kev_is_set);
 
 #ifdef QUIRK_EVFILT_TIMER_DISALLOWS_ONESHOT_TIMEOUT_ZERO
-	if (kev[1].data == 0) {
-		kev[1].data = 1;
+	if (kev->data == 0) {
+		kev->data = 1;
 	}
 #endif
 
-out:
+	return true;
+}
+
+#ifdef TIMERFD_HAVE_REALTIME_KEVENT
+static bool
+timer_kevent_set_abstime(struct kevent *kev, struct timespec const *deadline)
+{
+	if (deadline->tv_sec < 0) {
+		return false;
+	}
+
+#ifdef NOTE_NSECONDS
+	int64_t nanos;
+	if (ts_to_nanos(deadline, &nanos) == 0 &&
+	    !__builtin_add_overflow(nanos, 0, &kev->data)) {
+		EV_SET(kev, 0, EVFILT_TIMER,	      /**/
+		    EV_ADD | EV_ONESHOT | EV_RECEIPT, /**/
+		    NOTE_ABSTIME | NOTE_NSECONDS, nanos, 0);
+		return true;
+	}
+#endif
+
+#ifdef NOTE_USECONDS
+	int64_t micros;
+	if (!__builtin_mul_overflow(deadline->tv_sec, 1000000, &micros) &&
+	    !__builtin_add_overflow(micros,
+		(deadline->tv_nsec + 999) / 1000, &micros) &&
+	    !__builtin_add_overflow(micros, 0, &kev->data)) {
+		EV_SET(kev, 0, EVFILT_TIMER,	      /**/
+		    EV_ADD | EV_ONESHOT | EV_RECEIPT, /**/
+		    NOTE_ABSTIME | NOTE_USECONDS, micros, 0);
+		return true;
+	}
+#endif
+
+	int64_t millis;
+	if (__builtin_mul_overflow(deadline->tv_sec, 1000, &millis) ||
+	    __builtin_add_overflow(millis,
+		(deadline->tv_nsec + 999999) / 1000000, &millis) ||
+	    __builtin_add_overflow(millis, 0, &kev->data)) {
+		return false;
+	}
+	EV_SET(kev, 0, EVFILT_TIMER,	      /**/
+	    EV_ADD | EV_ONESHOT | EV_RECEIPT, /**/
+	    NOTE_ABSTIME, millis, 0);
+	return true;
+}
+#endif
+
+/*
+ * Fills in a periodic EVFILT_TIMER kevent. Returns false if the interval
+ * cannot be represented exactly.
+ */
+static bool
+timer_kevent_set_periodic(struct kevent *kev, struct timespec const *interval)
+{
+#ifdef QUIRKY_EVFILT_TIMER
+	(void)kev;
+	(void)interval;
+	return false;
+#else
+	int64_t nanos;
+	if (ts_to_nanos(interval, &nanos) != 0 || nanos <= 0) {
+		return false;
+	}
+
+#ifdef NOTE_NSECONDS
+	if (!__builtin_add_overflow(nanos, 0, &kev->data)) {
+		EV_SET(kev, 0, EVFILT_TIMER, EV_ADD | EV_RECEIPT, /**/
+		    NOTE_NSECONDS, nanos, 0);
+		return true;
+	}
+#endif
+
+#ifdef NOTE_USECONDS
+	if (nanos % 1000 == 0 &&
+	    !__builtin_add_overflow(nanos / 1000, 0, &kev->data)) {
+		EV_SET(kev, 0, EVFILT_TIMER, EV_ADD | EV_RECEIPT, /**/
+		    NOTE_USECONDS, nanos / 1000, 0);
+		return true;
+	}
+#endif
+
+	if (nanos % 1000000 == 0 &&
+	    !__builtin_add_overflow(nanos / 1000000, 0, &kev->data)) {
+		EV_SET(kev, 0, EVFILT_TIMER, EV_ADD | EV_RECEIPT, /**/
+		    0, nanos / 1000000, 0);
+		return true;
+	}
+
+	return false;
+#endif
+}
+
+static errno_t
+timerfd_ctx_register_periodic_event(int kq, struct kevent const *kev_periodic)
+{
+	struct kevent kev[2];
+
+	EV_SET(&kev[0], 0, EVFILT_TIMER, EV_DELETE | EV_RECEIPT, 0, 0, 0);
+	kev[1] = *kev_periodic;
+
+	int n;
+	if ((n = kevent(kq, kev, 2, kev, 2, NULL)) < 0) {
+		return errno;
+	}
+	assert(n == 2);
+	assert((kev[1].flags & EV_ERROR) != 0);
+	return (errno_t)kev[1].data;
+}
+
+static bool
+timerfd_ctx_timer_kevent_set(TimerFDCtx const *timerfd, TimerType timer_type,
+    struct kevent *kev, struct timespec const *new,
+    struct timespec const *current_time)
+{
+#ifdef TIMERFD_HAVE_REALTIME_KEVENT
+	if (timerfd->clockid == CLOCK_REALTIME &&
+	    timer_type == TIMER_TYPE_ABSOLUTE) {
+		return timer_kevent_set_abstime(kev, new);
+	}
+#else
+	(void)timerfd;
+	(void)timer_type;
+#endif
+
+	struct timespec diff_time;
+	if (!timespecsub_safe(new, current_time, &diff_time) ||
+	    diff_time.tv_sec < 0) {
+		diff_time.tv_sec = 0;
+		diff_time.tv_nsec = 0;
+	}
+
+	return timer_kevent_set(kev, 0, &diff_time);
+}
+
+static errno_t
+timerfd_ctx_register_event(TimerFDCtx *timerfd, int kq, TimerType timer_type,
+    struct timespec const *new, struct timespec const *current_time)
+{
+	assert(new->tv_sec != 0 || new->tv_nsec != 0);
+
+	struct kevent kev[2];
+	bool kev_is_set = timerfd_ctx_timer_kevent_set(timerfd, timer_type,
+	    &kev[1], new, current_time);
+
 	/*
 	 * On some BSD's, EVFILT_TIMER ignores timer resets using
 	 * EV_ADD, so we have to do it manually.
@@ -434,22 +615,515 @@ out:
 	return (errno_t)kev[1].data;
 }
 
+#ifdef EVFILT_USER
+
+/*
+ * Process wide timer wheel for TFD_WHEEL timers. All deadlines are kept in
+ * userspace, and a single kernel timer on a private kqueue is armed for the
+ * earliest of them. A helper thread waits on that kqueue, advances the wheel
+ * and triggers the EVFILT_USER event of each expired timerfd. Re-arming a
+ * timer that has not fired yet does not need any system calls unless its
+ * deadline becomes the earliest one.
+ *
+ * The wheel (and its thread and kqueue) only exists as long as there are
+ * TFD_WHEEL timerfds.
+ *
+ * A child created by 'fork()' starts over with an empty wheel. Timerfds
+ * inherited from the parent belong to an older generation of the wheel and
+ * are not touched anymore.
+ */
+
+#define TIMERFD_WHEEL_TICK_NS 1000000
+
+static pthread_once_t timerfd_wheel_atfork_once = PTHREAD_ONCE_INIT;
+
+static struct {
+	pthread_mutex_t lifecycle_mutex;
+	unsigned long nr_timerfds;
+	unsigned long generation;
+	pthread_t thread;
+
+	pthread_mutex_t mutex;
+	TimerWheel wheel;
+	int kq;
+	uint64_t armed_tick;
+} timerfd_wheel = {
+	.lifecycle_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.kq = -1,
+	.armed_tick = UINT64_MAX,
+};
+
+static errno_t
+timerfd_wheel_current_time(int64_t *now_nanos)
+{
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+		return errno;
+	}
+	return ts_to_nanos(&now, now_nanos);
+}
+
+static uint64_t
+timerfd_wheel_expiry_tick(struct timespec const *deadline)
+{
+	int64_t deadline_nanos;
+	if (ts_to_nanos(deadline, &deadline_nanos) != 0 ||
+	    deadline_nanos > INT64_MAX - TIMERFD_WHEEL_TICK_NS) {
+		return INT64_MAX / TIMERFD_WHEEL_TICK_NS;
+	}
+	if (deadline_nanos < 0) {
+		return 0;
+	}
+
+	/* Round up, so that timers never fire early. */
+	return (uint64_t)(deadline_nanos + TIMERFD_WHEEL_TICK_NS - 1) /
+	    TIMERFD_WHEEL_TICK_NS;
+}
+
+/* Must be called with the wheel mutex held. */
+static void
+timerfd_wheel_arm_kernel_timer(int64_t now_nanos)
+{
+	uint64_t tick;
+	if (!timer_wheel_next_event(&timerfd_wheel.wheel, &tick) ||
+	    tick >= timerfd_wheel.armed_tick) {
+		return;
+	}
+
+	struct timespec diff_time = { 0, 0 };
+	if (tick <= INT64_MAX / TIMERFD_WHEEL_TICK_NS &&
+	    (int64_t)tick * TIMERFD_WHEEL_TICK_NS > now_nanos) {
+		diff_time = nanos_to_ts(
+		    (int64_t)tick * TIMERFD_WHEEL_TICK_NS - now_nanos);
+	}
+
+	struct kevent kev[2];
+	EV_SET(&kev[0], 0, EVFILT_TIMER, EV_DELETE | EV_RECEIPT, 0, 0, 0);
+	if (!timer_kevent_set(&kev[1], 0, &diff_time)) {
+		return;
+	}
+
+	if (kevent(timerfd_wheel.kq, kev, 2, kev, 2, NULL) == 2 &&
+	    kev[1].data == 0) {
+		timerfd_wheel.armed_tick = tick;
+	}
+}
+
+static void
+timerfd_wheel_fire(TimerWheelEntry *entry, void *arg)
+{
+	(void)arg;
+
+	TimerFDCtx *timerfd = (TimerFDCtx *)((char *)entry -
+	    offsetof(TimerFDCtx, wheel_entry));
+
+	struct kevent kev;
+	EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+	(void)kevent(timerfd->wheel_kq, &kev, 1, NULL, 0, NULL);
+
+	timerfd->wheel_has_fired = true;
+}
+
+static void *
+timerfd_wheel_thread(void *arg)
+{
+	(void)arg;
+
+	for (;;) {
+		struct kevent kevs[2];
+		int n = kevent(timerfd_wheel.kq, NULL, 0, kevs, 2, NULL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		for (int i = 0; i < n; ++i) {
+			if (kevs[i].filter == EVFILT_USER) {
+				return NULL;
+			}
+		}
+
+		(void)pthread_mutex_lock(&timerfd_wheel.mutex);
+		timerfd_wheel.armed_tick = UINT64_MAX;
+		int64_t now_nanos;
+		if (timerfd_wheel_current_time(&now_nanos) == 0) {
+			timer_wheel_advance(&timerfd_wheel.wheel,
+			    (uint64_t)now_nanos / TIMERFD_WHEEL_TICK_NS,
+			    timerfd_wheel_fire, NULL);
+			timerfd_wheel_arm_kernel_timer(now_nanos);
+		}
+		(void)pthread_mutex_unlock(&timerfd_wheel.mutex);
+	}
+
+	return NULL;
+}
+
+static errno_t
+timerfd_wheel_start(void)
+{
+	errno_t ec;
+
+	int64_t now_nanos;
+	if ((ec = timerfd_wheel_current_time(&now_nanos)) != 0) {
+		return ec;
+	}
+
+	int kq = kqueue1(O_CLOEXEC);
+	if (kq < 0) {
+		return errno;
+	}
+
+	struct kevent kev;
+	EV_SET(&kev, 1, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+	if (kevent(kq, &kev, 1, NULL, 0, NULL) < 0) {
+		ec = errno;
+		goto out;
+	}
+
+	timer_wheel_init(&timerfd_wheel.wheel,
+	    (uint64_t)now_nanos / TIMERFD_WHEEL_TICK_NS);
+	timerfd_wheel.kq = kq;
+	timerfd_wheel.armed_tick = UINT64_MAX;
+
+	sigset_t set;
+	if (sigfillset(&set) < 0) {
+		ec = errno;
+		goto out;
+	}
+
+	sigset_t oldset;
+	if ((ec = pthread_sigmask(SIG_BLOCK, &set, &oldset)) != 0) {
+		goto out;
+	}
+	ec = pthread_create(&timerfd_wheel.thread, NULL, /**/
+	    timerfd_wheel_thread, NULL);
+	(void)pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ec != 0) {
+		goto out;
+	}
+
+	return 0;
+
+out:
+	timerfd_wheel.kq = -1;
+	real_close(kq);
+	return ec;
+}
+
+static void
+timerfd_wheel_stop(void)
+{
+	struct kevent kev;
+	EV_SET(&kev, 1, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+	(void)kevent(timerfd_wheel.kq, &kev, 1, NULL, 0, NULL);
+
+	(void)pthread_join(timerfd_wheel.thread, NULL);
+
+	real_close(timerfd_wheel.kq);
+	timerfd_wheel.kq = -1;
+}
+
+static void
+timerfd_wheel_atfork_prepare(void)
+{
+	(void)pthread_mutex_lock(&timerfd_wheel.lifecycle_mutex);
+	(void)pthread_mutex_lock(&timerfd_wheel.mutex);
+}
+
+static void
+timerfd_wheel_atfork_parent(void)
+{
+	(void)pthread_mutex_unlock(&timerfd_wheel.mutex);
+	(void)pthread_mutex_unlock(&timerfd_wheel.lifecycle_mutex);
+}
+
+static void
+timerfd_wheel_atfork_child(void)
+{
+	timerfd_wheel.nr_timerfds = 0;
+	++timerfd_wheel.generation;
+	timer_wheel_init(&timerfd_wheel.wheel, 0);
+	timerfd_wheel.kq = -1;
+	timerfd_wheel.armed_tick = UINT64_MAX;
+
+	(void)pthread_mutex_init(&timerfd_wheel.mutex, NULL);
+	(void)pthread_mutex_init(&timerfd_wheel.lifecycle_mutex, NULL);
+}
+
+static void
+timerfd_wheel_atfork_init(void)
+{
+	(void)pthread_atfork(timerfd_wheel_atfork_prepare,
+	    timerfd_wheel_atfork_parent, timerfd_wheel_atfork_child);
+}
+
+static errno_t
+timerfd_wheel_ref(unsigned long *generation)
+{
+	errno_t ec = 0;
+
+	(void)pthread_once(&timerfd_wheel_atfork_once,
+	    timerfd_wheel_atfork_init);
+
+	(void)pthread_mutex_lock(&timerfd_wheel.lifecycle_mutex);
+	if (timerfd_wheel.nr_timerfds == 0) {
+		ec = timerfd_wheel_start();
+	}
+	if (ec == 0) {
+		++timerfd_wheel.nr_timerfds;
+		*generation = timerfd_wheel.generation;
+	}
+	(void)pthread_mutex_unlock(&timerfd_wheel.lifecycle_mutex);
+
+	return ec;
+}
+
+static void
+timerfd_wheel_unref(void)
+{
+	(void)pthread_mutex_lock(&timerfd_wheel.lifecycle_mutex);
+	assert(timerfd_wheel.nr_timerfds > 0);
+	if (--timerfd_wheel.nr_timerfds == 0) {
+		timerfd_wheel_stop();
+	}
+	(void)pthread_mutex_unlock(&timerfd_wheel.lifecycle_mutex);
+}
+
+/*
+ * Takes the timer off the wheel. Returns true if it has fired since it was
+ * added, i.e. if the EVFILT_USER event might still be triggered.
+ */
+static bool
+timerfd_wheel_remove(TimerFDCtx *timerfd)
+{
+	if (timerfd->wheel_generation != timerfd_wheel.generation) {
+		return false;
+	}
+
+	(void)pthread_mutex_lock(&timerfd_wheel.mutex);
+	timer_wheel_remove(&timerfd_wheel.wheel, &timerfd->wheel_entry);
+	bool has_fired = timerfd->wheel_has_fired;
+	timerfd->wheel_has_fired = false;
+	(void)pthread_mutex_unlock(&timerfd_wheel.mutex);
+
+	return has_fired;
+}
+
+static void
+timerfd_wheel_add_locked(TimerFDCtx *timerfd, uint64_t expiry)
+{
+	int64_t now_nanos;
+	if (timerfd_wheel_current_time(&now_nanos) != 0) {
+		now_nanos = 0;
+	}
+
+	/* An empty wheel might lag behind, so move it forward. */
+	if (timerfd_wheel.wheel.nr_entries == 0) {
+		timer_wheel_init(&timerfd_wheel.wheel,
+		    (uint64_t)now_nanos / TIMERFD_WHEEL_TICK_NS);
+	}
+
+	timer_wheel_add(&timerfd_wheel.wheel, &timerfd->wheel_entry, expiry);
+	timerfd_wheel_arm_kernel_timer(now_nanos);
+}
+
+static void
+timerfd_ctx_clear_wheel_kevent(int kq)
+{
+	struct kevent kev[2];
+
+	EV_SET(&kev[0], 0, EVFILT_USER, EV_DELETE, 0, 0, 0);
+	EV_SET(&kev[1], 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, 0);
+	(void)kevent(kq, kev, 2, NULL, 0, NULL);
+}
+
+static errno_t
+timerfd_ctx_register_wheel(TimerFDCtx *timerfd, int kq,
+    struct timespec const *new)
+{
+	if (timerfd->wheel_generation != timerfd_wheel.generation) {
+		return EBADF;
+	}
+
+	if (!timerfd->has_wheel_kevent || !timerfd->is_on_wheel) {
+		struct kevent kev[2];
+		int n = 0;
+
+		EV_SET(&kev[n++], 0, EVFILT_TIMER, /**/
+		    EV_DELETE | EV_RECEIPT, 0, 0, 0);
+		if (!timerfd->has_wheel_kevent) {
+			EV_SET(&kev[n++], 0, EVFILT_USER,	 /**/
+			    EV_ADD | EV_CLEAR | EV_RECEIPT, /**/
+			    0, 0, 0);
+		}
+
+		if (kevent(kq, kev, n, kev, n, NULL) < 0) {
+			return errno;
+		}
+		if (n == 2 && kev[1].data != 0) {
+			return (errno_t)kev[1].data;
+		}
+
+		timerfd->has_wheel_kevent = true;
+		timerfd->is_on_wheel = true;
+		timerfd->wheel_kq = kq;
+	}
+
+	uint64_t expiry = timerfd_wheel_expiry_tick(new);
+
+	(void)pthread_mutex_lock(&timerfd_wheel.mutex);
+	timer_wheel_remove(&timerfd_wheel.wheel, &timerfd->wheel_entry);
+	bool has_fired = timerfd->wheel_has_fired;
+	if (!has_fired) {
+		timerfd_wheel_add_locked(timerfd, expiry);
+	}
+	(void)pthread_mutex_unlock(&timerfd_wheel.mutex);
+
+	if (has_fired) {
+		/*
+		 * Clear the stale trigger before putting the timer back, so
+		 * that a new expiration cannot get lost.
+		 */
+		timerfd_ctx_clear_wheel_kevent(kq);
+
+		(void)pthread_mutex_lock(&timerfd_wheel.mutex);
+		timerfd->wheel_has_fired = false;
+		timerfd_wheel_add_locked(timerfd, expiry);
+		(void)pthread_mutex_unlock(&timerfd_wheel.mutex);
+	}
+
+	return 0;
+}
+
+#endif
+
+static bool
+timerfd_ctx_uses_wheel(TimerFDCtx const *timerfd, TimerType timer_type)
+{
+	/*
+	 * Absolute CLOCK_REALTIME timers can jump, so they keep using their
+	 * own EVFILT_TIMER. All other deadlines are on CLOCK_MONOTONIC.
+	 */
+	return timerfd->use_wheel &&
+	    !(timerfd->clockid == CLOCK_REALTIME &&
+		timer_type == TIMER_TYPE_ABSOLUTE);
+}
+
+/*
+ * Rounds the deadline up to a multiple of the slack, so that timers with
+ * overlapping windows expire at the same time.
+ */
+static struct timespec
+timerfd_ctx_apply_slack(TimerFDCtx const *timerfd,
+    struct timespec const *deadline)
+{
+	if (timerfd->slack_nanos == 0) {
+		return *deadline;
+	}
+
+	int64_t deadline_nanos;
+	if (ts_to_nanos(deadline, &deadline_nanos) != 0 ||
+	    deadline_nanos < 0) {
+		return *deadline;
+	}
+
+	int64_t rem = deadline_nanos % timerfd->slack_nanos;
+	if (rem == 0 ||
+	    __builtin_add_overflow(deadline_nanos, timerfd->slack_nanos - rem,
+		&deadline_nanos)) {
+		return *deadline;
+	}
+
+	return nanos_to_ts(deadline_nanos);
+}
+
+static errno_t
+timerfd_ctx_arm(TimerFDCtx *timerfd, int kq, TimerType timer_type,
+    struct timespec const *new, struct timespec const *current_time)
+{
+	struct timespec deadline = timerfd_ctx_apply_slack(timerfd, new);
+
+	EPOLL_SHIM_TIMERFD_REARM(timerfd, (int64_t)deadline.tv_sec,
+	    deadline.tv_nsec);
+
+#ifdef EVFILT_USER
+	if (timerfd_ctx_uses_wheel(timerfd, timer_type)) {
+		return timerfd_ctx_register_wheel(timerfd, kq, &deadline);
+	}
+
+	if (timerfd->is_on_wheel) {
+		if (timerfd_wheel_remove(timerfd)) {
+			timerfd_ctx_clear_wheel_kevent(kq);
+		}
+		timerfd->is_on_wheel = false;
+	}
+#endif
+
+	return timerfd_ctx_register_event(timerfd, kq, timer_type, &deadline,
+	    current_time);
+}
+
+static void
+timerfd_ctx_unregister(TimerFDCtx *timerfd, int kq)
+{
+#ifdef EVFILT_USER
+	if (timerfd->is_on_wheel) {
+		if (timerfd_wheel_remove(timerfd)) {
+			timerfd_ctx_clear_wheel_kevent(kq);
+		}
+		return;
+	}
+#endif
+
+	struct kevent kev;
+
+	EV_SET(&kev, 0, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
+	(void)kevent(kq, &kev, 1, NULL, 0, NULL);
+}
+
 errno_t
-timerfd_ctx_init(TimerFDCtx *timerfd, int clockid)
+timerfd_ctx_init(TimerFDCtx *timerfd, int clockid, bool use_wheel)
 {
 	assert(clockid == CLOCK_MONOTONIC || clockid == CLOCK_REALTIME);
 
 	*timerfd = (TimerFDCtx) {
 		.clockid = (clockid_t)clockid,
+		.wheel_kq = -1,
 	};
 
+#ifdef EVFILT_USER
+	if (use_wheel) {
+		errno_t ec = timerfd_wheel_ref(&timerfd->wheel_generation);
+		if (ec != 0) {
+			return ec;
+		}
+		timer_wheel_entry_init(&timerfd->wheel_entry);
+		timerfd->use_wheel = true;
+		timerfd->is_tfd_wheel = true;
+	}
+#else
+	/* Without EVFILT_USER, every timer gets its own EVFILT_TIMER. */
+	(void)use_wheel;
+#endif
+
 	return 0;
 }
 
 errno_t
 timerfd_ctx_terminate(TimerFDCtx *timerfd)
 {
+#ifdef EVFILT_USER
+	if (timerfd->use_wheel &&
+	    timerfd->wheel_generation == timerfd_wheel.generation) {
+		(void)timerfd_wheel_remove(timerfd);
+		timerfd_wheel_unref();
+	}
+#else
 	(void)timerfd;
+#endif
 
 	return 0;
 }
@@ -459,7 +1133,16 @@ timerfd_ctx_gettime_impl(TimerFDCtx *timerfd, struct itimerspec *cur,
     struct timespec const *current_time)
 {
 	if (current_time != NULL) {
+		uint64_t nr_expirations = timerfd->nr_expirations;
 		timerfd_ctx_update_to_current_time(timerfd, current_time);
+
+		/*
+		 * Expirations of periodic kernel timers are counted by the
+		 * kernel. Only move 'it_value' forward.
+		 */
+		if (timerfd->is_periodic_kevent) {
+			timerfd->nr_expirations = nr_expirations;
+		}
 	}
 
 	*cur = timerfd->current_itimerspec;
@@ -470,31 +1153,60 @@ timerfd_ctx_gettime_impl(TimerFDCtx *timerfd, struct itimerspec *cur,
 	}
 }
 
+static errno_t
+timerfd_ctx_get_cached_clocktime(clockid_t clockid, TimerType timer_type,
+    TimerFDClockCache *clocks, struct timespec *current_time)
+{
+	errno_t ec;
+
+	assert(timer_type != TIMER_TYPE_UNSPECIFIED);
+
+	bool is_realtime = clockid == CLOCK_REALTIME &&
+	    timer_type == TIMER_TYPE_ABSOLUTE;
+	bool *has_time = is_realtime ? &clocks->has_realtime :
+				       &clocks->has_monotonic;
+	struct timespec *time = is_realtime ? &clocks->realtime :
+					      &clocks->monotonic;
+
+	if (!*has_time) {
+		if ((ec = timerfd_ctx_get_clocktime(clockid, timer_type,
+			 time)) != 0) {
+			return ec;
+		}
+		*has_time = true;
+	}
+
+	*current_time = *time;
+	return 0;
+}
+
 errno_t
 timerfd_ctx_settime(TimerFDCtx *timerfd, int kq, /**/
     bool const is_abstime, bool const is_cancel_on_set,
-    struct itimerspec const *new, struct itimerspec *old)
+    struct itimerspec const *new, struct itimerspec *old,
+    TimerFDClockCache *clocks)
 {
 	errno_t ec;
 
 	assert(new != NULL);
 
+	stats_add(STAT_TIMERFD_OPS, 1);
+
 	if (!itimerspec_is_valid(new)) {
 		return EINVAL;
 	}
 
 	bool const old_is_cancel_on_set = timerfd->is_cancel_on_set;
 
-	bool has_current_time = false;
 	struct timespec current_time;
 
 	if (old) {
 		if (timerfd->timer_type != TIMER_TYPE_UNSPECIFIED) {
-			if ((ec = timerfd_ctx_get_clocktime(timerfd->clockid,
-				 timerfd->timer_type, &current_time)) != 0) {
+			if ((ec = timerfd_ctx_get_cached_clocktime(
+				 timerfd->clockid, timerfd->timer_type, clocks,
+				 &current_time)) != 0) {
 				return ec;
 			}
-			has_current_time = true;
 		}
 
 		timerfd_ctx_gettime_impl(timerfd, old,
@@ -504,10 +1216,7 @@ timerfd_ctx_settime(TimerFDCtx *timerfd, int kq, /**/
 	}
 
 	if (new->it_value.tv_sec == 0 && new->it_value.tv_nsec == 0) {
-		struct kevent kev;
-
-		EV_SET(&kev, 0, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
-		(void)kevent(kq, &kev, 1, NULL, 0, NULL);
+		timerfd_ctx_unregister(timerfd, kq);
 
 		timerfd_ctx_disarm(timerfd);
 		timerfd->is_cancel_on_set = false;
@@ -517,13 +1226,9 @@ timerfd_ctx_settime(TimerFDCtx *timerfd, int kq, /**/
 		    TIMER_TYPE_ABSOLUTE :
 		    TIMER_TYPE_RELATIVE;
 
-		if (!has_current_time ||
-		    timerfd->timer_type != new_timer_type) {
-			if ((ec = timerfd_ctx_get_clocktime(timerfd->clockid,
-				 new_timer_type, &current_time)) != 0) {
-				return ec;
-			}
-			has_current_time = true;
+		if ((ec = timerfd_ctx_get_cached_clocktime(timerfd->clockid,
+			 new_timer_type, clocks, &current_time)) != 0) {
+			return ec;
 		}
 
 		struct itimerspec new_absolute;
@@ -541,13 +1246,26 @@ timerfd_ctx_settime(TimerFDCtx *timerfd, int kq, /**/
 			}
 		}
 
-		if ((ec = timerfd_ctx_register_event(timerfd, kq,
-			 &new_absolute.it_value, &current_time)) != 0) {
+		struct kevent kev_periodic;
+		bool is_periodic_kevent = !is_abstime && !timerfd->use_wheel &&
+		    timerfd->slack_nanos == 0 &&
+		    timespeccmp(&new->it_value, &new->it_interval, ==) &&
+		    timer_kevent_set_periodic(&kev_periodic, &new->it_interval);
+
+		if (is_periodic_kevent) {
+			ec = timerfd_ctx_register_periodic_event(kq,
+			    &kev_periodic);
+		} else {
+			ec = timerfd_ctx_arm(timerfd, kq, new_timer_type,
+			    &new_absolute.it_value, &current_time);
+		}
+		if (ec != 0) {
 			return ec;
 		}
 
 		timerfd->current_itimerspec = new_absolute;
 		timerfd->timer_type = new_timer_type;
+		timerfd->is_periodic_kevent = is_periodic_kevent;
 		timerfd->is_cancel_on_set = is_cancel_on_set &&
 		    timerfd->clockid == CLOCK_REALTIME &&
 		    timerfd->timer_type == TIMER_TYPE_ABSOLUTE;
@@ -562,6 +1280,88 @@ timerfd_ctx_settime(TimerFDCtx *timerfd, int kq, /**/
 	    0;
 }
 
+#ifdef EVFILT_USER
+/*
+ * Gives the timer its own EVFILT_TIMER again after its slack has been
+ * reduced below the resolution of the wheel.
+ */
+static errno_t
+timerfd_ctx_leave_wheel(TimerFDCtx *timerfd, int kq)
+{
+	errno_t ec;
+
+	timerfd->use_wheel = false;
+
+	/* Rearming moves the timer from the wheel to its own EVFILT_TIMER. */
+	if (timerfd->timer_type != TIMER_TYPE_UNSPECIFIED) {
+		struct timespec current_time;
+		if ((ec = timerfd_ctx_get_clocktime(timerfd->clockid,
+			 timerfd->timer_type, &current_time)) != 0) {
+			timerfd->use_wheel = true;
+			return ec;
+		}
+
+		timerfd_ctx_rearm_kevent(timerfd, kq, &current_time, false);
+	}
+
+	if (timerfd->is_on_wheel) {
+		if (timerfd_wheel_remove(timerfd)) {
+			timerfd_ctx_clear_wheel_kevent(kq);
+		}
+		timerfd->is_on_wheel = false;
+	}
+
+	if (timerfd->wheel_generation == timerfd_wheel.generation) {
+		timerfd_wheel_unref();
+	}
+
+	return 0;
+}
+#endif
+
+errno_t
+timerfd_ctx_set_slack(TimerFDCtx *timerfd, int kq,
+    struct timespec const *slack)
+{
+	int64_t slack_nanos;
+
+	if (slack->tv_sec < 0 || slack->tv_nsec < 0 ||
+	    slack->tv_nsec >= 1000000000 ||
+	    ts_to_nanos(slack, &slack_nanos) != 0) {
+		return EINVAL;
+	}
+
+#ifdef EVFILT_USER
+	/*
+	 * Timers that don't need to be more precise than the wheel's
+	 * resolution share its kernel timer. The timer moves to the wheel
+	 * the next time it is armed.
+	 */
+	if (slack_nanos >= TIMERFD_WHEEL_TICK_NS && !timerfd->use_wheel) {
+		errno_t ec = timerfd_wheel_ref(&timerfd->wheel_generation);
+		if (ec != 0) {
+			return ec;
+		}
+		timer_wheel_entry_init(&timerfd->wheel_entry);
+		timerfd->use_wheel = true;
+	} else if (slack_nanos < TIMERFD_WHEEL_TICK_NS && timerfd->use_wheel &&
+	    !timerfd->is_tfd_wheel) {
+		/* The new deadline must not be rounded to the old slack. */
+		timerfd->slack_nanos = slack_nanos;
+
+		errno_t ec = timerfd_ctx_leave_wheel(timerfd, kq);
+		if (ec != 0) {
+			return ec;
+		}
+	}
+#else
+	(void)kq;
+#endif
+
+	timerfd->slack_nanos = slack_nanos;
+	return 0;
+}
+
 errno_t
 timerfd_ctx_gettime(TimerFDCtx *timerfd, struct itimerspec *cur)
 {
@@ -589,19 +1389,45 @@ timerfd_ctx_rearm_kevent(TimerFDCtx *timerfd, int kq,
     bool need_kevent_delete_on_disarmed_timer)
 {
 	if (!timerfd_ctx_is_disarmed(timerfd)) {
-		if (timerfd_ctx_register_event(timerfd, kq,
+		if (timerfd_ctx_arm(timerfd, kq, timerfd->timer_type,
 			&timerfd->current_itimerspec.it_value,
 			current_time) != 0) {
 			timerfd_ctx_disarm(timerfd);
 		}
 	} else {
-		if (need_kevent_delete_on_disarmed_timer) {
-			struct kevent kev;
+		if (need_kevent_delete_on_disarmed_timer &&
+		    !timerfd->is_on_wheel) {
+			timerfd_ctx_unregister(timerfd, kq);
+		}
+	}
+}
 
-			EV_SET(&kev, 0, EVFILT_TIMER, EV_DELETE, 0, 0, 0);
-			(void)kevent(kq, &kev, 1, NULL, 0, NULL);
+static errno_t
+timerfd_ctx_read_periodic(int kq, uint64_t *value)
+{
+	struct kevent kevs[3];
+	int n = kevent(kq, NULL, 0, kevs, 3, &(struct timespec) { 0, 0 });
+	if (n < 0) {
+		return errno;
+	}
+
+	uint64_t nr_expirations = 0;
+	for (int i = 0; i < n; ++i) {
+		assert(kevs[i].filter == EVFILT_TIMER && kevs[i].ident == 0);
+
+		if (kevs[i].data > 0 &&
+		    __builtin_add_overflow(nr_expirations,
+			(uint64_t)kevs[i].data, &nr_expirations)) {
+			nr_expirations = UINT64_MAX;
 		}
 	}
+
+	if (nr_expirations == 0) {
+		return EAGAIN;
+	}
+
+	*value = nr_expirations;
+	return 0;
 }
 
 errno_t
@@ -609,10 +1435,36 @@ timerfd_ctx_read(TimerFDCtx *timerfd, int kq, uint64_t *value)
 {
 	errno_t ec;
 
+	stats_add(STAT_TIMERFD_OPS, 1);
+
 	if (timerfd->timer_type == TIMER_TYPE_UNSPECIFIED) {
 		return EAGAIN;
 	}
 
+	if (timerfd->is_periodic_kevent) {
+		/*
+		 * Expirations counted by 'timerfd_gettime' are part of the
+		 * kernel's count as well, so they are dropped here.
+		 */
+		timerfd->nr_expirations = 0;
+		ec = timerfd_ctx_read_periodic(kq, value);
+		if (ec == 0) {
+			EPOLL_SHIM_TIMERFD_FIRE(timerfd, *value);
+		}
+		return ec;
+	}
+
+#ifdef EVFILT_USER
+	/*
+	 * Take the timer off the wheel first. This way, any trigger is
+	 * consumed by the kevent call below. The timer is put back when
+	 * rearming.
+	 */
+	if (timerfd->is_on_wheel) {
+		(void)timerfd_wheel_remove(timerfd);
+	}
+#endif
+
 	bool got_kevent = false;
 	unsigned long event_ident;
 	{
@@ -624,7 +1476,8 @@ timerfd_ctx_read(TimerFDCtx *timerfd, int kq, uint64_t *value)
 		}
 
 		for (int i = 0; i < n; ++i) {
-			assert(kevs[i].filter == EVFILT_TIMER);
+			assert(kevs[i].filter == EVFILT_TIMER ||
+			    kevs[i].filter == EVFILT_USER);
 
 			if (!got_kevent) {
 				event_ident = kevs[i].ident;
@@ -681,6 +1534,12 @@ timerfd_ctx_read(TimerFDCtx *timerfd, int kq, uint64_t *value)
 		timerfd->nr_expirations = 0;
 
 		if (nr_expirations == 0) {
+			if (timerfd->is_on_wheel) {
+				timerfd_ctx_rearm_kevent(timerfd, kq,
+				    &current_time, false);
+				return EAGAIN;
+			}
+
 			if (!got_kevent) {
 				return EAGAIN;
 			}
@@ -715,6 +1574,8 @@ timerfd_ctx_read(TimerFDCtx *timerfd, int kq, uint64_t *value)
 		return ECANCELED;
 	}
 
+	EPOLL_SHIM_TIMERFD_FIRE(timerfd, nr_expirations);
+
 	*value = nr_expirations;
 	return 0;
 }
@@ -10,6 +10,8 @@
 #include <pthread.h>
 #include <time.h>
 
+#include "timer_wheel.h"
+
 typedef enum {
 	TIMER_TYPE_UNSPECIFIED,
 	TIMER_TYPE_RELATIVE,
@@ -31,20 +33,59 @@ typedef struct {
 	 */
 	struct itimerspec current_itimerspec;
 	uint64_t nr_expirations;
+
+	/*
+	 * Relative interval timers whose first expiration equals the interval
+	 * use a periodic EVFILT_TIMER. The kernel counts the expirations, so
+	 * reads don't need to re-arm the timer.
+	 */
+	bool is_periodic_kevent;
+
+	/*
+	 * Timers created with TFD_WHEEL are kept on a process wide timer
+	 * wheel instead of having their own EVFILT_TIMER. On expiry, an
+	 * EVFILT_USER event is triggered on the timerfd's kqueue.
+	 */
+	bool use_wheel;
+	bool is_tfd_wheel; /* 'use_wheel' because of TFD_WHEEL, not the slack */
+	bool is_on_wheel;
+	bool has_wheel_kevent;
+	int wheel_kq;
+	bool wheel_has_fired; /* protected by the wheel mutex */
+	TimerWheelEntry wheel_entry;
+	unsigned long wheel_generation;
+
+	/* Deadlines are rounded up to a multiple of this. */
+	int64_t slack_nanos;
 } TimerFDCtx;
 
-errno_t timerfd_ctx_init(TimerFDCtx *timerfd, int clockid);
+/*
+ * Clock readings that are shared between several timer operations, so that
+ * batches of timers are armed relative to the same point in time.
+ */
+typedef struct {
+	bool has_monotonic;
+	bool has_realtime;
+	struct timespec monotonic;
+	struct timespec realtime;
+} TimerFDClockCache;
+
+errno_t timerfd_ctx_init(TimerFDCtx *timerfd, int clockid, bool use_wheel);
 errno_t timerfd_ctx_terminate(TimerFDCtx *timerfd);
 
 errno_t timerfd_ctx_settime(TimerFDCtx *timerfd, int kq, /**/
     bool is_abstime, bool is_cancel_on_set,		 /**/
-    struct itimerspec const *new, struct itimerspec *old);
+    struct itimerspec const *new, struct itimerspec *old,
+    TimerFDClockCache *clocks);
 errno_t timerfd_ctx_gettime(TimerFDCtx *timerfd, struct itimerspec *cur);
+errno_t timerfd_ctx_set_slack(TimerFDCtx *timerfd, int kq,
+    struct timespec const *slack);
 
 errno_t timerfd_ctx_read(TimerFDCtx *timerfd, int kq, uint64_t *value);
 void timerfd_ctx_poll(TimerFDCtx *timerfd, int kq, uint32_t *revents);
 
 errno_t timerfd_ctx_get_monotonic_offset(struct timespec *monotonic_offset);
+bool timerfd_ctx_needs_step_detection(TimerFDCtx const *timerfd);
 void timerfd_ctx_realtime_change(TimerFDCtx *timerfd, int kq);
 
 #endif
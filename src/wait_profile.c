@@ -0,0 +1,188 @@
+#include "wait_profile.h"
+
+#include <stdio.h>
+
+#include <pthread.h>
+
+/*
+ * HDR-style buckets: values below 4 have their own bucket, above that each
+ * power of two is split into 4 linear sub-buckets. This keeps the relative
+ * error below 25% for all values up to 2^40 (about 18 minutes in ns).
+ */
+
+uint64_t
+wait_profile_bucket_min(unsigned int bucket)
+{
+	if (bucket < 4) {
+		return bucket;
+	}
+
+	unsigned int exponent = bucket / 4 + 1;
+	return (uint64_t)(4 + bucket % 4) << (exponent - 2);
+}
+
+#ifdef EPOLL_SHIM_LOCK_PROFILING
+
+static unsigned int
+wait_profile_bucket(uint64_t value)
+{
+	if (value < 4) {
+		return (unsigned int)value;
+	}
+
+	unsigned int exponent = 63 - (unsigned int)__builtin_clzll(value);
+	unsigned int bucket = 4 * (exponent - 1) +
+	    (unsigned int)((value >> (exponent - 2)) & 3);
+	return bucket < WAIT_HISTOGRAM_BUCKETS ? bucket
+					       : WAIT_HISTOGRAM_BUCKETS - 1;
+}
+
+static char const *const wait_histogram_names[WAIT_HISTOGRAM_COUNT] = {
+	[WAIT_HISTOGRAM_BLOCK] = "blocking time (ns)",
+	[WAIT_HISTOGRAM_EVENTS] = "events per call",
+	[WAIT_HISTOGRAM_WAKEUP_TO_RETURN] = "wakeup to return (ns)",
+	[WAIT_HISTOGRAM_MUTEX_WAIT] = "mutex wait (ns)",
+};
+
+/* All live profiles, and the sum of the ones already terminated. */
+static pthread_mutex_t wait_profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(wait_profiles_, wait_profile_) wait_profiles =
+    LIST_HEAD_INITIALIZER(wait_profiles);
+static WaitHistogram wait_profiles_retired[WAIT_HISTOGRAM_COUNT];
+
+static void
+wait_histogram_add(WaitHistogram *sum, WaitHistogram const *histogram)
+{
+	sum->count += histogram->count;
+	sum->sum += histogram->sum;
+	if (histogram->max > sum->max) {
+		sum->max = histogram->max;
+	}
+	for (unsigned int i = 0; i < WAIT_HISTOGRAM_BUCKETS; ++i) {
+		sum->buckets[i] += histogram->buckets[i];
+	}
+}
+
+void
+wait_profile_init(WaitProfile *profile)
+{
+	*profile = (WaitProfile) { .histograms = { { 0 } } };
+
+	(void)pthread_mutex_lock(&wait_profiles_mutex);
+	LIST_INSERT_HEAD(&wait_profiles, profile, entry);
+	(void)pthread_mutex_unlock(&wait_profiles_mutex);
+}
+
+void
+wait_profile_terminate(WaitProfile *profile)
+{
+	(void)pthread_mutex_lock(&wait_profiles_mutex);
+	for (int k = 0; k < WAIT_HISTOGRAM_COUNT; ++k) {
+		WaitHistogram histogram;
+		(void)wait_profile_get(profile, k, &histogram);
+		wait_histogram_add(&wait_profiles_retired[k], &histogram);
+	}
+	LIST_REMOVE(profile, entry);
+	(void)pthread_mutex_unlock(&wait_profiles_mutex);
+}
+
+static void
+relaxed_add(atomic_uint_least64_t *counter, uint64_t n)
+{
+	/* Writers are serialized, so no RMW is needed. */
+	atomic_store_explicit(counter,
+	    atomic_load_explicit(counter, memory_order_relaxed) + n,
+	    memory_order_relaxed);
+}
+
+void
+wait_profile_record(WaitProfile *profile, WaitHistogramKind kind,
+    uint64_t value)
+{
+	WaitProfileHistogram *histogram = &profile->histograms[kind];
+
+	relaxed_add(&histogram->count, 1);
+	relaxed_add(&histogram->sum, value);
+	if (value > atomic_load_explicit(&histogram->max,
+			memory_order_relaxed)) {
+		atomic_store_explicit(&histogram->max, value,
+		    memory_order_relaxed);
+	}
+	relaxed_add(&histogram->buckets[wait_profile_bucket(value)], 1);
+}
+
+errno_t
+wait_profile_get(WaitProfile const *profile, int kind,
+    WaitHistogram *histogram)
+{
+	if (kind < 0 || kind >= WAIT_HISTOGRAM_COUNT) {
+		return EINVAL;
+	}
+
+	WaitProfileHistogram const *source = &profile->histograms[kind];
+
+	*histogram = (WaitHistogram) {
+		.count = atomic_load_explicit(&source->count,
+		    memory_order_relaxed),
+		.sum = atomic_load_explicit(&source->sum, memory_order_relaxed),
+		.max = atomic_load_explicit(&source->max, memory_order_relaxed),
+	};
+	for (unsigned int i = 0; i < WAIT_HISTOGRAM_BUCKETS; ++i) {
+		histogram->buckets[i] = atomic_load_explicit(
+		    &source->buckets[i], memory_order_relaxed);
+	}
+
+	return 0;
+}
+
+/* Returns an upper bound of the given percentile (in per mille). */
+static uint64_t
+wait_histogram_percentile(WaitHistogram const *histogram, uint64_t permille)
+{
+	uint64_t rank = (histogram->count * permille + 999) / 1000;
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0; i < WAIT_HISTOGRAM_BUCKETS - 1; ++i) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			uint64_t bound = wait_profile_bucket_min(i + 1) - 1;
+			return bound < histogram->max ? bound : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
+
+__attribute__((destructor)) static void
+wait_profile_dump(void)
+{
+	(void)pthread_mutex_lock(&wait_profiles_mutex);
+
+	for (int k = 0; k < WAIT_HISTOGRAM_COUNT; ++k) {
+		WaitHistogram sum = wait_profiles_retired[k];
+
+		WaitProfile *profile;
+		LIST_FOREACH (profile, &wait_profiles, entry) {
+			WaitHistogram histogram;
+			(void)wait_profile_get(profile, k, &histogram);
+			wait_histogram_add(&sum, &histogram);
+		}
+
+		if (sum.count == 0) {
+			continue;
+		}
+
+		fprintf(stderr,
+		    "epoll-shim wait profile: %s: %llu samples, p50 %llu, "
+		    "p99 %llu, p999 %llu, max %llu\n",
+		    wait_histogram_names[k], (unsigned long long)sum.count,
+		    (unsigned long long)wait_histogram_percentile(&sum, 500),
+		    (unsigned long long)wait_histogram_percentile(&sum, 990),
+		    (unsigned long long)wait_histogram_percentile(&sum, 999),
+		    (unsigned long long)sum.max);
+	}
+
+	(void)pthread_mutex_unlock(&wait_profiles_mutex);
+}
+
+#endif
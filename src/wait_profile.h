@@ -0,0 +1,96 @@
+#ifndef WAIT_PROFILE_H_
+#define WAIT_PROFILE_H_
+
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Latency and batch size histograms of an epoll instance, recorded in
+ * profiling builds (ENABLE_LOCK_PROFILING). The histogram kinds and the
+ * layout of 'WaitHistogram' mirror the public <epoll-shim/wait_profile.h>.
+ */
+
+typedef enum {
+	WAIT_HISTOGRAM_BLOCK,
+	WAIT_HISTOGRAM_EVENTS,
+	WAIT_HISTOGRAM_WAKEUP_TO_RETURN,
+	WAIT_HISTOGRAM_MUTEX_WAIT,
+	WAIT_HISTOGRAM_COUNT,
+} WaitHistogramKind;
+
+#define WAIT_HISTOGRAM_BUCKETS 160
+
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[WAIT_HISTOGRAM_BUCKETS];
+} WaitHistogram;
+
+uint64_t wait_profile_bucket_min(unsigned int bucket);
+
+#ifdef EPOLL_SHIM_LOCK_PROFILING
+typedef struct {
+	atomic_uint_least64_t count;
+	atomic_uint_least64_t sum;
+	atomic_uint_least64_t max;
+	atomic_uint_least64_t buckets[WAIT_HISTOGRAM_BUCKETS];
+} WaitProfileHistogram;
+
+typedef struct wait_profile_ {
+	WaitProfileHistogram histograms[WAIT_HISTOGRAM_COUNT];
+	LIST_ENTRY(wait_profile_) entry;
+} WaitProfile;
+
+void wait_profile_init(WaitProfile *profile);
+void wait_profile_terminate(WaitProfile *profile);
+
+/*
+ * Writers of a profile must be serialized by the caller (the epoll
+ * instance's mutex). Readers may run concurrently.
+ */
+void wait_profile_record(WaitProfile *profile, WaitHistogramKind kind,
+    uint64_t value);
+errno_t wait_profile_get(WaitProfile const *profile, int kind,
+    WaitHistogram *histogram);
+#else
+typedef struct {
+	char unused;
+} WaitProfile;
+
+static inline void
+wait_profile_init(WaitProfile *profile)
+{
+	(void)profile;
+}
+
+static inline void
+wait_profile_terminate(WaitProfile *profile)
+{
+	(void)profile;
+}
+
+static inline void
+wait_profile_record(WaitProfile *profile, WaitHistogramKind kind,
+    uint64_t value)
+{
+	(void)profile;
+	(void)kind;
+	(void)value;
+}
+
+static inline errno_t
+wait_profile_get(WaitProfile const *profile, int kind,
+    WaitHistogram *histogram)
+{
+	(void)profile;
+	(void)kind;
+	(void)histogram;
+	return ENOTSUP;
+}
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -13,21 +14,27 @@
 
 #include "compat_ppoll.h"
 
+/*
+ * The symbols are resolved by a constructor at load time, so on the hot path
+ * calling a "real" function is just a load and an indirect call. Calls made
+ * before the constructor has run (from other constructors, for example)
+ * resolve them lazily.
+ */
 static struct {
 	pthread_once_t wrap_init;
 
-	typeof(read) *real_read;
-	typeof(write) *real_write;
-	typeof(close) *real_close;
-	typeof(poll) *real_poll;
+	_Atomic(typeof(read) *) real_read;
+	_Atomic(typeof(write) *) real_write;
+	_Atomic(typeof(close) *) real_close;
+	_Atomic(typeof(poll) *) real_poll;
 #if !defined(__APPLE__)
 #ifdef __NetBSD__
-	typeof(pollts) *real___pollts50;
+	_Atomic(typeof(pollts) *) real___pollts50;
 #else
-	typeof(ppoll) *real_ppoll;
+	_Atomic(typeof(ppoll) *) real_ppoll;
 #endif
 #endif
-	typeof(fcntl) *real_fcntl;
+	_Atomic(typeof(fcntl) *) real_fcntl;
 } wrap = { .wrap_init = PTHREAD_ONCE_INIT };
 
 static void
@@ -39,19 +46,22 @@ wrap_initialize_impl(void)
 	 * search order. This shouldn't really happen, but try with
 	 * `RTLD_DEFAULT` as a fallback anyway.
 	 */
-#define WRAP(fun)                                                    \
-	do {                                                         \
-		wrap.real_##fun = dlsym(RTLD_NEXT, #fun);            \
-		if (wrap.real_##fun == NULL) {                       \
-			wrap.real_##fun = dlsym(RTLD_DEFAULT, #fun); \
-		}                                                    \
-		if (wrap.real_##fun == NULL) {                       \
-			fprintf(stderr,                              \
-			    "epoll-shim: error resolving \"%s\" "    \
-			    "with dlsym RTLD_NEXT/RTLD_DEFAULT!\n",  \
-			    #fun);                                   \
-			abort();                                     \
-		}                                                    \
+#define WRAP(fun)                                                   \
+	do {                                                        \
+		void *sym = dlsym(RTLD_NEXT, #fun);                 \
+		if (sym == NULL) {                                  \
+			sym = dlsym(RTLD_DEFAULT, #fun);            \
+		}                                                   \
+		if (sym == NULL) {                                  \
+			fprintf(stderr,                             \
+			    "epoll-shim: error resolving \"%s\" "   \
+			    "with dlsym RTLD_NEXT/RTLD_DEFAULT!\n", \
+			    #fun);                                  \
+			abort();                                    \
+		}                                                   \
+		atomic_store_explicit(&wrap.real_##fun,             \
+		    (typeof(atomic_load(&wrap.real_##fun)))sym,     \
+		    memory_order_release);                          \
 	} while (0)
 
 	WRAP(read);
@@ -78,32 +88,62 @@ wrap_initialize(void)
 	errno = oe;
 }
 
+__attribute__((constructor)) static void
+wrap_constructor(void)
+{
+	wrap_initialize();
+}
+
+#define WRAP_GETTER(fun, proto)                                            \
+	static inline typeof(proto) *wrap_get_##fun(void)                  \
+	{                                                                  \
+		typeof(proto) *real_fun = atomic_load_explicit(            \
+		    &wrap.real_##fun, memory_order_acquire);               \
+		if (__builtin_expect(real_fun == NULL, 0)) {               \
+			wrap_initialize();                                 \
+			real_fun = atomic_load_explicit(&wrap.real_##fun,  \
+			    memory_order_acquire);                         \
+		}                                                          \
+		return real_fun;                                           \
+	}
+
+WRAP_GETTER(read, read)
+WRAP_GETTER(write, write)
+WRAP_GETTER(close, close)
+WRAP_GETTER(poll, poll)
+#if !defined(__APPLE__)
+#ifdef __NetBSD__
+WRAP_GETTER(__pollts50, pollts)
+#else
+WRAP_GETTER(ppoll, ppoll)
+#endif
+#endif
+WRAP_GETTER(fcntl, fcntl)
+
+#undef WRAP_GETTER
+
 ssize_t
 real_read(int fd, void *buf, size_t nbytes)
 {
-	wrap_initialize();
-	return wrap.real_read(fd, buf, nbytes);
+	return wrap_get_read()(fd, buf, nbytes);
 }
 
 ssize_t
 real_write(int fd, void const *buf, size_t nbytes)
 {
-	wrap_initialize();
-	return wrap.real_write(fd, buf, nbytes);
+	return wrap_get_write()(fd, buf, nbytes);
 }
 
 int
 real_close(int fd)
 {
-	wrap_initialize();
-	return wrap.real_close(fd);
+	return wrap_get_close()(fd);
 }
 
 int
 real_poll(struct pollfd fds[], nfds_t nfds, int timeout)
 {
-	wrap_initialize();
-	return wrap.real_poll(fds, nfds, timeout);
+	return wrap_get_poll()(fds, nfds, timeout);
 }
 
 int
@@ -114,11 +154,10 @@ real_ppoll(struct pollfd fds[], nfds_t nfds,
 #ifdef __APPLE__
 	return compat_ppoll(fds, nfds, timeout, newsigmask);
 #else
-	wrap_initialize();
 #ifdef __NetBSD__
-	return wrap.real___pollts50(fds, nfds, timeout, newsigmask);
+	return wrap_get___pollts50()(fds, nfds, timeout, newsigmask);
 #else
-	return wrap.real_ppoll(fds, nfds, timeout, newsigmask);
+	return wrap_get_ppoll()(fds, nfds, timeout, newsigmask);
 #endif
 #endif
 }
@@ -126,12 +165,11 @@ real_ppoll(struct pollfd fds[], nfds_t nfds,
 int
 real_fcntl(int fd, int cmd, ...)
 {
-	wrap_initialize();
 	va_list ap;
 
 	va_start(ap, cmd);
 	void *arg = va_arg(ap, void *);
-	int rv = wrap.real_fcntl(fd, cmd, arg);
+	int rv = wrap_get_fcntl()(fd, cmd, arg);
 	va_end(ap);
 
 	return rv;
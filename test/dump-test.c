@@ -0,0 +1,123 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <epoll-shim/dump.h>
+
+static void
+dump_to_string(int ep, int (*dump_fun)(int, FILE *), char *buf, size_t size)
+{
+	FILE *f = tmpfile();
+	ATF_REQUIRE(f != NULL);
+
+	ATF_REQUIRE(dump_fun(ep, f) == 0);
+
+	rewind(f);
+	size_t n = fread(buf, 1, size - 1, f);
+	ATF_REQUIRE(n > 0 && n < size - 1);
+	buf[n] = '\0';
+
+	ATF_REQUIRE(fclose(f) == 0);
+}
+
+static bool
+contains(char const *buf, char const *format, int fd)
+{
+	char needle[128];
+	snprintf(needle, sizeof(needle), format, fd);
+	return strstr(buf, needle) != NULL;
+}
+
+ATF_TC_WITHOUT_HEAD(dump__registered_fds);
+ATF_TC_BODY(dump__registered_fds, tc)
+{
+	char buf[4096];
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	int p[2];
+	ATF_REQUIRE(pipe(p) == 0);
+
+	int sv[2];
+	ATF_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.fd = p[0],
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &event) == 0);
+	event = (struct epoll_event) {
+		.events = EPOLLIN | EPOLLOUT | EPOLLONESHOT,
+		.data.fd = sv[0],
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, sv[0], &event) == 0);
+
+	ATF_REQUIRE(write(p[1], "", 1) == 1);
+	struct epoll_event events[2];
+	ATF_REQUIRE(epoll_wait(ep, events, 2, -1) == 2);
+
+	dump_to_string(ep, epoll_shim_dump, buf, sizeof(buf));
+	ATF_REQUIRE(contains(buf, "epoll instance %d: 2 registered fds", ep));
+	ATF_REQUIRE(contains(buf, "fd %d: fifo, events IN,", p[0]));
+	ATF_REQUIRE(contains(buf, "fd %d: socket, events IN|OUT|ONESHOT,",
+	    sv[0]));
+	ATF_REQUIRE(strstr(buf, "delivered 1, last ") != NULL);
+
+	dump_to_string(ep, epoll_shim_dump_json, buf, sizeof(buf));
+	ATF_REQUIRE(buf[0] == '{');
+	ATF_REQUIRE(strcmp(buf + strlen(buf) - 3, "]}\n") == 0);
+	ATF_REQUIRE(strchr(buf, '\n') == buf + strlen(buf) - 1);
+	ATF_REQUIRE(contains(buf, "\"epfd\": %d, \"registered_fds\": 2", ep));
+	ATF_REQUIRE(contains(buf, "{\"fd\": %d, \"node_type\": \"fifo\"",
+	    p[0]));
+	ATF_REQUIRE(contains(buf, "{\"fd\": %d, \"node_type\": \"socket\"",
+	    sv[0]));
+	ATF_REQUIRE(strstr(buf, "\"oneshot\": true") != NULL);
+	ATF_REQUIRE(strstr(buf, "\"delivered\": 0") == NULL);
+
+	/* Deregistered fds are gone. */
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_DEL, p[0], NULL) == 0);
+	dump_to_string(ep, epoll_shim_dump, buf, sizeof(buf));
+	ATF_REQUIRE(contains(buf, "epoll instance %d: 1 registered fds", ep));
+	ATF_REQUIRE(!contains(buf, "fd %d:", p[0]));
+
+	ATF_REQUIRE(close(sv[0]) == 0);
+	ATF_REQUIRE(close(sv[1]) == 0);
+	ATF_REQUIRE(close(p[0]) == 0);
+	ATF_REQUIRE(close(p[1]) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(dump__invalid_fd);
+ATF_TC_BODY(dump__invalid_fd, tc)
+{
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_dump(-1, stderr) < 0);
+	ATF_REQUIRE(errno == EBADF);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_dump_json(fds[0], stderr) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, dump__registered_fds);
+	ATF_TP_ADD_TC(tp, dump__invalid_fd);
+
+	return atf_no_error();
+}
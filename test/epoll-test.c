@@ -987,6 +987,10 @@ signalfd_in_thread_test(int which)
 		ATF_REQUIRE(poll(&pfd, 1, 0) == 0);
 		atf_tc_skip("signals sent to threads won't trigger "
 			    "EVFILT_SIGNAL on DragonFly/macOS");
+#elif defined(EPOLL_SHIM_TEST_LINUX_KQUEUE)
+		ATF_REQUIRE(poll(&pfd, 1, 0) == 0);
+		atf_tc_skip("signals sent to threads won't trigger "
+			    "the signalfd backing EVFILT_SIGNAL");
 #endif
 		ATF_REQUIRE(poll(&pfd, 1, -1) == 1);
 		ATF_REQUIRE(pfd.revents == POLLIN);
@@ -1967,6 +1971,38 @@ ATF_TC_BODY_FD_LEAKCHECK(epoll__using_real_close, tcptr)
 	ATF_REQUIRE(close(ep) == 0);
 }
 
+ATF_TC_WITHOUT_HEAD(epoll__fd_bitmap);
+ATF_TC_BODY_FD_LEAKCHECK(epoll__fd_bitmap, tcptr)
+{
+#ifndef EPOLL_SHIM_HAVE_INLINE_WRAPPERS
+	atf_tc_skip("no inline wrappers");
+#else
+	int fds[3];
+	fd_pipe(fds);
+	ATF_REQUIRE(!epoll_shim_fd_maybe_shimmed(fds[0]));
+	ATF_REQUIRE(!epoll_shim_fd_maybe_shimmed(fds[1]));
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+	ATF_REQUIRE(epoll_shim_fd_maybe_shimmed(ep));
+
+	/* These go to libc directly. */
+	char c = 'x';
+	ATF_REQUIRE(write(fds[1], &c, 1) == 1);
+	ATF_REQUIRE(read(fds[0], &c, 1) == 1);
+	ATF_REQUIRE(c == 'x');
+
+	/* This always takes the out-of-line path. */
+	ATF_REQUIRE((fcntl(fds[0], F_GETFL) & O_NONBLOCK) == 0);
+
+	ATF_REQUIRE(close(ep) == 0);
+	ATF_REQUIRE(!epoll_shim_fd_maybe_shimmed(ep));
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+#endif
+}
+
 static sig_atomic_t volatile epoll_pwait_got_signal = 0;
 static void
 epoll_pwait_sighandler(int sig)
@@ -2183,6 +2219,7 @@ ATF_TP_ADD_TCS(tp)
 	ATF_TP_ADD_TC(tp, epoll__add_different_file_with_same_fd_value);
 	ATF_TP_ADD_TC(tp, epoll__invalid_writes);
 	ATF_TP_ADD_TC(tp, epoll__using_real_close);
+	ATF_TP_ADD_TC(tp, epoll__fd_bitmap);
 	ATF_TP_ADD_TC(tp, epoll__epoll_pwait);
 	ATF_TP_ADD_TC(tp, epoll__cloexec);
 	ATF_TP_ADD_TC(tp, epoll__fcntl_fl);
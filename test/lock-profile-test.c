@@ -0,0 +1,145 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <epoll-shim/lock_profile.h>
+
+static void
+get_profile(int lock_class, struct epoll_shim_lock_profile *profile)
+{
+	if (epoll_shim_lock_profile_get(lock_class, profile) < 0) {
+		ATF_REQUIRE(errno == ENOTSUP);
+		atf_tc_skip("epoll-shim was built without lock profiling");
+	}
+}
+
+static uint64_t
+histogram_sum(uint64_t const *histogram)
+{
+	uint64_t sum = 0;
+	for (int i = 0; i < EPOLL_SHIM_LOCK_PROFILE_BUCKETS; ++i) {
+		sum += histogram[i];
+	}
+	return sum;
+}
+
+ATF_TC_WITHOUT_HEAD(lock_profile__acquisitions);
+ATF_TC_BODY(lock_profile__acquisitions, tc)
+{
+	struct epoll_shim_lock_profile profile;
+	get_profile(EPOLL_SHIM_LOCK_CLASS_RWLOCK_READ, &profile);
+
+	epoll_shim_lock_profile_reset();
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.fd = fds[0],
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &event) == 0);
+	ATF_REQUIRE(write(fds[1], "", 1) == 1);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+
+	int const lock_classes[] = {
+		EPOLL_SHIM_LOCK_CLASS_RWLOCK_READ,
+		EPOLL_SHIM_LOCK_CLASS_RWLOCK_WRITE,
+		EPOLL_SHIM_LOCK_CLASS_DESC_MUTEX,
+	};
+	for (int i = 0; i < 3; ++i) {
+		get_profile(lock_classes[i], &profile);
+		ATF_REQUIRE(profile.acquisitions > 0);
+		ATF_REQUIRE(profile.contended_acquisitions <=
+		    profile.acquisitions);
+		ATF_REQUIRE(histogram_sum(profile.wait_histogram) ==
+		    profile.contended_acquisitions);
+		ATF_REQUIRE(histogram_sum(profile.hold_histogram) ==
+		    profile.acquisitions);
+	}
+
+	epoll_shim_lock_profile_reset();
+	get_profile(EPOLL_SHIM_LOCK_CLASS_DESC_MUTEX, &profile);
+	ATF_REQUIRE(profile.acquisitions == 0);
+	ATF_REQUIRE(histogram_sum(profile.hold_histogram) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(lock_profile__invalid_class);
+ATF_TC_BODY(lock_profile__invalid_class, tc)
+{
+	struct epoll_shim_lock_profile profile;
+	get_profile(EPOLL_SHIM_LOCK_CLASS_RWLOCK_READ, &profile);
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_lock_profile_get(-1, &profile) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_lock_profile_get(EPOLL_SHIM_LOCK_CLASS_COUNT,
+			&profile) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+}
+
+ATF_TC_WITHOUT_HEAD(lock_profile__phases);
+ATF_TC_BODY(lock_profile__phases, tc)
+{
+	struct epoll_shim_lock_profile lock_profile;
+	get_profile(EPOLL_SHIM_LOCK_CLASS_RWLOCK_READ, &lock_profile);
+
+	epoll_shim_lock_profile_reset();
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.fd = fds[0],
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &event) == 0);
+	ATF_REQUIRE(write(fds[1], "", 1) == 1);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+
+	struct epoll_shim_phase_profile profile;
+	for (int p = 0; p < EPOLL_SHIM_PHASE_COUNT; ++p) {
+		ATF_REQUIRE(epoll_shim_phase_profile_get(p, &profile) == 0);
+		ATF_REQUIRE(profile.calls > 0);
+	}
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_phase_profile_get(EPOLL_SHIM_PHASE_COUNT,
+			&profile) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+
+	epoll_shim_lock_profile_reset();
+	ATF_REQUIRE(epoll_shim_phase_profile_get(EPOLL_SHIM_PHASE_FEED_EVENT,
+			&profile) == 0);
+	ATF_REQUIRE(profile.calls == 0);
+	ATF_REQUIRE(profile.ns == 0);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, lock_profile__acquisitions);
+	ATF_TP_ADD_TC(tp, lock_profile__invalid_class);
+	ATF_TP_ADD_TC(tp, lock_profile__phases);
+
+	return atf_no_error();
+}
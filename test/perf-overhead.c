@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+
+#include <atf-c.h>
+
+#include <sys/types.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <epoll-shim/lock_profile.h>
+
+#include "syscall-counter.h"
+
+/*
+ * With the userspace kqueue on Linux, the "hand-written kevent code" calls
+ * into the same kqueue implementation the shim uses.
+ */
+#ifdef EPOLL_SHIM_TEST_LINUX_KQUEUE
+#define COMPAT_ENABLE_KQUEUE
+#include "compat_kqueue.h"
+#define kqueue_close compat_kqueue_close
+#else
+#include <sys/event.h>
+#define kqueue_close close
+#endif
+
+#define NR_ITERATIONS (5000)
+#define NR_TIMER_ITERATIONS (200)
+
+#define SOCKET_PATH "perf-overhead.sock"
+
+/*
+ * Runs the same workloads once with hand-written kevent code and once with
+ * the shim, so that the shim's own cost can be told apart from the cost of
+ * the kernel. Reports CPU time, calls into the kernel and allocations per
+ * event. If epoll-shim was built with ENABLE_LOCK_PROFILING, the shim's lock
+ * acquisitions and the time spent in the phases of 'epoll_wait' are reported
+ * as well.
+ */
+
+typedef struct {
+	int nr_events;
+	int64_t cpu_begin;
+	int64_t cpu_ns;
+	SyscallCounts counts;
+} Measurement;
+
+static int64_t
+cpu_now_ns(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+measure_begin(Measurement *m)
+{
+	epoll_shim_lock_profile_reset();
+	syscall_counter_start();
+	m->cpu_begin = cpu_now_ns();
+}
+
+static void
+measure_end(Measurement *m, int nr_events)
+{
+	m->cpu_ns = cpu_now_ns() - m->cpu_begin;
+	syscall_counter_stop(&m->counts);
+	m->nr_events = nr_events;
+}
+
+static void
+print_measurement(char const *workload, char const *api,
+    Measurement const *m)
+{
+	double n = (double)m->nr_events;
+
+	printf("{\"benchmark\": \"overhead\", \"workload\": \"%s\", "
+	       "\"api\": \"%s\", \"events\": %d, \"cpu_ns\": %.0f",
+	    workload, api, m->nr_events, (double)m->cpu_ns / n);
+	for (int i = 0; i < SYSCALL_NR; ++i) {
+		printf(", \"%s\": %.2f", syscall_counter_names[i],
+		    (double)m->counts.n[i] / n);
+	}
+	printf(", \"allocations\": %.2f", (double)m->counts.allocations / n);
+
+	if (strcmp(api, "shim") == 0) {
+		uint64_t acquisitions = 0, wait_ns = 0;
+		for (int c = 0; c < EPOLL_SHIM_LOCK_CLASS_COUNT; ++c) {
+			struct epoll_shim_lock_profile profile;
+			if (epoll_shim_lock_profile_get(c, &profile) < 0) {
+				goto out;
+			}
+			acquisitions += profile.acquisitions;
+			wait_ns += profile.wait_ns;
+		}
+		printf(", \"lock_acquisitions\": %.2f, \"lock_wait_ns\": %.0f",
+		    (double)acquisitions / n, (double)wait_ns / n);
+
+		static char const *const phase_names[] = {
+			[EPOLL_SHIM_PHASE_GET_NEEDED_FILTERS] =
+			    "get_needed_filters_ns",
+			[EPOLL_SHIM_PHASE_FEED_EVENT] = "feed_event_ns",
+			[EPOLL_SHIM_PHASE_TRANSLATE] = "translate_ns",
+		};
+		for (int p = 0; p < EPOLL_SHIM_PHASE_COUNT; ++p) {
+			struct epoll_shim_phase_profile profile;
+			ATF_REQUIRE(
+			    epoll_shim_phase_profile_get(p, &profile) == 0);
+			printf(", \"%s\": %.0f", phase_names[p],
+			    (double)profile.ns / n);
+		}
+	}
+
+out:
+	printf("}\n");
+}
+
+static void
+kevent_add(int kq, int fd, short filter, unsigned short flags,
+    unsigned int fflags, int64_t data)
+{
+	struct kevent kev;
+	EV_SET(&kev, fd, filter, EV_ADD | flags, fflags, data, 0);
+	ATF_REQUIRE(kevent(kq, &kev, 1, NULL, 0, NULL) == 0);
+}
+
+static void
+kevent_wait_one(int kq, struct kevent const *change, short filter)
+{
+	struct kevent kev;
+	ATF_REQUIRE(kevent(kq, change, change ? 1 : 0, &kev, 1, NULL) == 1);
+	ATF_REQUIRE(kev.filter == filter);
+}
+
+static void
+epoll_add(int ep, int fd)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &event) == 0);
+}
+
+static void
+epoll_wait_one(int ep)
+{
+	struct epoll_event event;
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+	ATF_REQUIRE(event.events & EPOLLIN);
+}
+
+/* Accepts connections on a listening socket. */
+
+static int
+create_listener(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	(void)strcpy(addr.sun_path, SOCKET_PATH);
+	(void)unlink(SOCKET_PATH);
+
+	int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	ATF_REQUIRE(s >= 0);
+	ATF_REQUIRE(bind(s, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	ATF_REQUIRE(listen(s, 128) == 0);
+	return s;
+}
+
+static int
+connect_client(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	(void)strcpy(addr.sun_path, SOCKET_PATH);
+
+	int c = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	ATF_REQUIRE(c >= 0);
+	ATF_REQUIRE(connect(c, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	return c;
+}
+
+static void
+accept_and_close(int listener, int c)
+{
+	int a = accept(listener, NULL, NULL);
+	ATF_REQUIRE(a >= 0);
+	ATF_REQUIRE(close(a) == 0);
+	ATF_REQUIRE(close(c) == 0);
+}
+
+static void
+run_accept(void)
+{
+	Measurement m;
+	int listener = create_listener();
+
+	int kq = kqueue();
+	ATF_REQUIRE(kq >= 0);
+	kevent_add(kq, listener, EVFILT_READ, 0, 0, 0);
+	measure_begin(&m);
+	for (int i = 0; i < NR_ITERATIONS; ++i) {
+		int c = connect_client();
+		kevent_wait_one(kq, NULL, EVFILT_READ);
+		accept_and_close(listener, c);
+	}
+	measure_end(&m, NR_ITERATIONS);
+	ATF_REQUIRE(kqueue_close(kq) == 0);
+	print_measurement("accept", "kevent", &m);
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+	epoll_add(ep, listener);
+	measure_begin(&m);
+	for (int i = 0; i < NR_ITERATIONS; ++i) {
+		int c = connect_client();
+		epoll_wait_one(ep);
+		accept_and_close(listener, c);
+	}
+	measure_end(&m, NR_ITERATIONS);
+	ATF_REQUIRE(close(ep) == 0);
+	print_measurement("accept", "shim", &m);
+
+	ATF_REQUIRE(close(listener) == 0);
+	(void)unlink(SOCKET_PATH);
+}
+
+/* Sends single bytes over a socketpair and reads them back. */
+
+static void
+run_read_write(void)
+{
+	Measurement m;
+	char c;
+	int sv[2];
+	ATF_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) ==
+	    0);
+
+	int kq = kqueue();
+	ATF_REQUIRE(kq >= 0);
+	kevent_add(kq, sv[1], EVFILT_READ, 0, 0, 0);
+	measure_begin(&m);
+	for (int i = 0; i < NR_ITERATIONS; ++i) {
+		ATF_REQUIRE(write(sv[0], "", 1) == 1);
+		kevent_wait_one(kq, NULL, EVFILT_READ);
+		ATF_REQUIRE(read(sv[1], &c, 1) == 1);
+	}
+	measure_end(&m, NR_ITERATIONS);
+	ATF_REQUIRE(kqueue_close(kq) == 0);
+	print_measurement("read_write", "kevent", &m);
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+	epoll_add(ep, sv[1]);
+	measure_begin(&m);
+	for (int i = 0; i < NR_ITERATIONS; ++i) {
+		ATF_REQUIRE(write(sv[0], "", 1) == 1);
+		epoll_wait_one(ep);
+		ATF_REQUIRE(read(sv[1], &c, 1) == 1);
+	}
+	measure_end(&m, NR_ITERATIONS);
+	ATF_REQUIRE(close(ep) == 0);
+	print_measurement("read_write", "shim", &m);
+
+	ATF_REQUIRE(close(sv[0]) == 0);
+	ATF_REQUIRE(close(sv[1]) == 0);
+}
+
+/* Arms a one millisecond timer and waits for it. */
+
+static void
+run_timer(void)
+{
+	Measurement m;
+
+	int kq = kqueue();
+	ATF_REQUIRE(kq >= 0);
+	measure_begin(&m);
+	for (int i = 0; i < NR_TIMER_ITERATIONS; ++i) {
+		struct kevent kev;
+		EV_SET(&kev, 0, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, 1, 0);
+		kevent_wait_one(kq, &kev, EVFILT_TIMER);
+	}
+	measure_end(&m, NR_TIMER_ITERATIONS);
+	ATF_REQUIRE(kqueue_close(kq) == 0);
+	print_measurement("timer", "kevent", &m);
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	ATF_REQUIRE(tfd >= 0);
+	epoll_add(ep, tfd);
+	measure_begin(&m);
+	for (int i = 0; i < NR_TIMER_ITERATIONS; ++i) {
+		struct itimerspec its = { .it_value.tv_nsec = 1000000 };
+		uint64_t expirations;
+		ATF_REQUIRE(timerfd_settime(tfd, 0, &its, NULL) == 0);
+		epoll_wait_one(ep);
+		ATF_REQUIRE(read(tfd, &expirations, sizeof(expirations)) ==
+		    (ssize_t)sizeof(expirations));
+	}
+	measure_end(&m, NR_TIMER_ITERATIONS);
+	ATF_REQUIRE(close(tfd) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+	print_measurement("timer", "shim", &m);
+}
+
+/* Triggers a user event (an eventfd for the shim) and consumes it. */
+
+static void
+run_user_event(void)
+{
+	Measurement m;
+
+#ifdef EVFILT_USER
+	int kq = kqueue();
+	ATF_REQUIRE(kq >= 0);
+	kevent_add(kq, 0, EVFILT_USER, EV_CLEAR, 0, 0);
+	measure_begin(&m);
+	for (int i = 0; i < NR_ITERATIONS; ++i) {
+		struct kevent kev;
+		EV_SET(&kev, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, 0);
+		kevent_wait_one(kq, &kev, EVFILT_USER);
+	}
+	measure_end(&m, NR_ITERATIONS);
+	ATF_REQUIRE(kqueue_close(kq) == 0);
+	print_measurement("user_event", "kevent", &m);
+#endif
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+	int efd = eventfd(0, EFD_CLOEXEC);
+	ATF_REQUIRE(efd >= 0);
+	epoll_add(ep, efd);
+	measure_begin(&m);
+	for (int i = 0; i < NR_ITERATIONS; ++i) {
+		eventfd_t value;
+		ATF_REQUIRE(eventfd_write(efd, 1) == 0);
+		epoll_wait_one(ep);
+		ATF_REQUIRE(eventfd_read(efd, &value) == 0);
+	}
+	measure_end(&m, NR_ITERATIONS);
+	ATF_REQUIRE(close(efd) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+	print_measurement("user_event", "shim", &m);
+}
+
+ATF_TC(perf_overhead__attribution);
+ATF_TC_HEAD(perf_overhead__attribution, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "120");
+}
+ATF_TC_BODY(perf_overhead__attribution, tc)
+{
+	run_accept();
+	run_read_write();
+	run_timer();
+	run_user_event();
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_overhead__attribution);
+
+	return atf_no_error();
+}
@@ -0,0 +1,278 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define NR_ROUND_TRIPS (10000)
+#define MAX_CONNECTIONS (64)
+
+/*
+ * Bounces single bytes over socketpair connections between two threads that
+ * both wait with 'epoll_wait', in level triggered, edge triggered and oneshot
+ * mode. Reports round trip latency percentiles and the number of events
+ * handled per second as one JSON object per line. This also builds against
+ * native epoll on Linux, which gives a baseline to compare with.
+ */
+
+typedef enum {
+	MODE_LEVEL,
+	MODE_EDGE,
+	MODE_ONESHOT,
+} Mode;
+
+static char const *const mode_names[] = {
+	[MODE_LEVEL] = "level",
+	[MODE_EDGE] = "edge",
+	[MODE_ONESHOT] = "oneshot",
+};
+
+static uint32_t const mode_events[] = {
+	[MODE_LEVEL] = EPOLLIN,
+	[MODE_EDGE] = EPOLLIN | EPOLLET,
+	[MODE_ONESHOT] = EPOLLIN | EPOLLONESHOT,
+};
+
+typedef struct {
+	Mode mode;
+	int nr_connections;
+	int fds[MAX_CONNECTIONS];
+	long nr_events;
+} Echoer;
+
+static int64_t
+now_ns(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+compare_int64(void const *a, void const *b)
+{
+	int64_t x = *(int64_t const *)a;
+	int64_t y = *(int64_t const *)b;
+	return (x > y) - (x < y);
+}
+
+static int
+create_epoll(Mode mode, int const *fds, int nr_fds)
+{
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	for (int i = 0; i < nr_fds; ++i) {
+		struct epoll_event event = {
+			.events = mode_events[mode],
+			.data.u32 = (uint32_t)i,
+		};
+		ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &event) == 0);
+	}
+
+	return ep;
+}
+
+static void
+rearm(Mode mode, int ep, int fd, int i)
+{
+	if (mode != MODE_ONESHOT) {
+		return;
+	}
+
+	struct epoll_event event = {
+		.events = mode_events[mode],
+		.data.u32 = (uint32_t)i,
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_MOD, fd, &event) == 0);
+}
+
+/*
+ * Reads what is available on 'fd'. In edge triggered mode, the socket must be
+ * drained until EAGAIN. Returns -1 on EOF.
+ */
+static ssize_t
+read_available(Mode mode, int fd)
+{
+	char buf[64];
+	ssize_t total = 0;
+
+	for (;;) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n == 0) {
+			return -1;
+		}
+		if (n < 0) {
+			ATF_REQUIRE(errno == EAGAIN || errno == EWOULDBLOCK);
+			return total;
+		}
+		total += n;
+		if (mode != MODE_EDGE) {
+			return total;
+		}
+	}
+}
+
+static void *
+echoer_thread_fun(void *arg)
+{
+	Echoer *echoer = arg;
+	struct epoll_event events[MAX_CONNECTIONS];
+
+	int ep = create_epoll(echoer->mode, echoer->fds,
+	    echoer->nr_connections);
+
+	int nr_open = echoer->nr_connections;
+	while (nr_open > 0) {
+		int n = epoll_wait(ep, events, (int)nitems(events), -1);
+		ATF_REQUIRE(n > 0);
+		echoer->nr_events += n;
+
+		for (int i = 0; i < n; ++i) {
+			int c = (int)events[i].data.u32;
+			int fd = echoer->fds[c];
+
+			ssize_t r = read_available(echoer->mode, fd);
+			if (r < 0) {
+				ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_DEL, fd,
+						NULL) == 0);
+				--nr_open;
+				continue;
+			}
+			for (ssize_t j = 0; j < r; ++j) {
+				ATF_REQUIRE(write(fd, "", 1) == 1);
+			}
+			rearm(echoer->mode, ep, fd, c);
+		}
+	}
+
+	ATF_REQUIRE(close(ep) == 0);
+	return NULL;
+}
+
+static void
+run_benchmark(Mode mode, int nr_connections)
+{
+	int fds[MAX_CONNECTIONS];
+	int64_t sent_at[MAX_CONNECTIONS];
+	struct epoll_event events[MAX_CONNECTIONS];
+	Echoer echoer = { .mode = mode, .nr_connections = nr_connections };
+
+	int64_t *latencies = malloc(NR_ROUND_TRIPS * sizeof(int64_t));
+	ATF_REQUIRE(latencies);
+
+	for (int i = 0; i < nr_connections; ++i) {
+		int sv[2];
+		ATF_REQUIRE(socketpair(PF_LOCAL,
+				SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0,
+				sv) == 0);
+		fds[i] = sv[0];
+		echoer.fds[i] = sv[1];
+	}
+
+	pthread_t thread;
+	ATF_REQUIRE(pthread_create(&thread, NULL, echoer_thread_fun,
+			&echoer) == 0);
+
+	int ep = create_epoll(mode, fds, nr_connections);
+
+	int64_t begin = now_ns();
+
+	/* Keep one byte in flight per connection. */
+	int nr_sent = 0;
+	for (int i = 0; i < nr_connections && nr_sent < NR_ROUND_TRIPS; ++i) {
+		sent_at[i] = now_ns();
+		ATF_REQUIRE(write(fds[i], "", 1) == 1);
+		++nr_sent;
+	}
+
+	long nr_events = 0;
+	int nr_received = 0;
+	while (nr_received < NR_ROUND_TRIPS) {
+		int n = epoll_wait(ep, events, (int)nitems(events), -1);
+		ATF_REQUIRE(n > 0);
+		nr_events += n;
+
+		for (int i = 0; i < n; ++i) {
+			int c = (int)events[i].data.u32;
+
+			ssize_t r = read_available(mode, fds[c]);
+			ATF_REQUIRE(r >= 0);
+			if (r == 0) {
+				rearm(mode, ep, fds[c], c);
+				continue;
+			}
+			ATF_REQUIRE(r == 1);
+
+			int64_t now = now_ns();
+			latencies[nr_received++] = now - sent_at[c];
+
+			if (nr_sent < NR_ROUND_TRIPS) {
+				sent_at[c] = now;
+				ATF_REQUIRE(write(fds[c], "", 1) == 1);
+				++nr_sent;
+			}
+			rearm(mode, ep, fds[c], c);
+		}
+	}
+
+	int64_t elapsed = now_ns() - begin;
+
+	for (int i = 0; i < nr_connections; ++i) {
+		ATF_REQUIRE(close(fds[i]) == 0);
+	}
+	ATF_REQUIRE(pthread_join(thread, NULL) == 0);
+	for (int i = 0; i < nr_connections; ++i) {
+		ATF_REQUIRE(close(echoer.fds[i]) == 0);
+	}
+	ATF_REQUIRE(close(ep) == 0);
+
+	qsort(latencies, NR_ROUND_TRIPS, sizeof(int64_t), compare_int64);
+
+	printf("{\"benchmark\": \"pingpong\", \"mode\": \"%s\", "
+	       "\"connections\": %d, \"round_trips\": %d, "
+	       "\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld, "
+	       "\"events_per_s\": %.0f}\n",
+	    mode_names[mode], nr_connections, NR_ROUND_TRIPS,
+	    (long long)latencies[NR_ROUND_TRIPS / 2],
+	    (long long)latencies[NR_ROUND_TRIPS * 99 / 100],
+	    (long long)latencies[NR_ROUND_TRIPS * 999 / 1000],
+	    (double)(nr_events + echoer.nr_events) * 1e9 / (double)elapsed);
+
+	free(latencies);
+}
+
+ATF_TC(perf_pingpong__latency);
+ATF_TC_HEAD(perf_pingpong__latency, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "60");
+}
+ATF_TC_BODY(perf_pingpong__latency, tc)
+{
+	static const int nr_connections[] = { 1, 8, MAX_CONNECTIONS };
+
+	for (int m = 0; m < (int)nitems(mode_names); ++m) {
+		for (int c = 0; c < (int)nitems(nr_connections); ++c) {
+			run_benchmark((Mode)m, nr_connections[c]);
+		}
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_pingpong__latency);
+
+	return atf_no_error();
+}
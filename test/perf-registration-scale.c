@@ -0,0 +1,205 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define NR_WAITS (1000)
+
+/*
+ * Measures how the cost of epoll_ctl, epoll_wait and close grows with the
+ * number of registered descriptors when only a few of them are active.
+ * Every registered descriptor is the read end of a pipe. Active ones have a
+ * byte in them.
+ */
+
+static int64_t
+now_ns(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the resident set size in KiB, or -1 if unknown. */
+static long
+rss_kib(void)
+{
+#ifdef __linux__
+	long pages;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f == NULL) {
+		return -1;
+	}
+	if (fscanf(f, "%*s %ld", &pages) != 1) {
+		pages = -1;
+	}
+	(void)fclose(f);
+	return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+	/* Only the maximum is available. Good enough for a growing heap. */
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) < 0) {
+		return -1;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static void
+close_fds(int const *fds, int nr_fds)
+{
+	for (int i = 0; i < nr_fds; ++i) {
+		ATF_REQUIRE(close(fds[i]) == 0);
+	}
+}
+
+/*
+ * Creates 'nr_fds' pipes of which 'nr_active' are readable. Returns false if
+ * the descriptor limit was hit.
+ */
+static bool
+create_fds(int *fds, int *write_fds, int nr_fds, int nr_active)
+{
+	for (int i = 0; i < nr_fds; ++i) {
+		int p[2];
+		if (pipe(p) < 0) {
+			close_fds(fds, i);
+			close_fds(write_fds, i);
+			return false;
+		}
+		fds[i] = p[0];
+		write_fds[i] = p[1];
+		if (i < nr_active) {
+			ATF_REQUIRE(write(write_fds[i], "", 1) == 1);
+		}
+	}
+
+	return true;
+}
+
+static void
+ctl_all(int ep, int op, int const *fds, int nr_fds, uint32_t events)
+{
+	for (int i = 0; i < nr_fds; ++i) {
+		struct epoll_event event = {
+			.events = events,
+			.data.fd = fds[i],
+		};
+		ATF_REQUIRE(epoll_ctl(ep, op, fds[i], &event) == 0);
+	}
+}
+
+static void
+run_benchmark(int nr_fds, double active_ratio)
+{
+	struct epoll_event events[1024];
+
+	int nr_active = (int)(nr_fds * active_ratio);
+	if (nr_active < 1) {
+		nr_active = 1;
+	}
+
+	int *fds = malloc((size_t)nr_fds * sizeof(int));
+	int *write_fds = malloc((size_t)nr_fds * sizeof(int));
+	ATF_REQUIRE(fds && write_fds);
+
+	if (!create_fds(fds, write_fds, nr_fds, nr_active)) {
+		printf("%8d fds: skipped, descriptor limit reached\n", nr_fds);
+		free(write_fds);
+		free(fds);
+		return;
+	}
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	long rss_before = rss_kib();
+
+	int64_t begin = now_ns();
+	ctl_all(ep, EPOLL_CTL_ADD, fds, nr_fds, EPOLLIN);
+	double add_ns = (double)(now_ns() - begin) / nr_fds;
+
+	long rss_after = rss_kib();
+
+	int expected = nr_active < (int)nitems(events) ? nr_active
+						       : (int)nitems(events);
+	begin = now_ns();
+	for (int i = 0; i < NR_WAITS; ++i) {
+		ATF_REQUIRE(epoll_wait(ep, events, (int)nitems(events), 0) ==
+		    expected);
+	}
+	double wait_ns = (double)(now_ns() - begin) / NR_WAITS;
+
+	begin = now_ns();
+	ctl_all(ep, EPOLL_CTL_MOD, fds, nr_fds, EPOLLIN | EPOLLOUT);
+	double mod_ns = (double)(now_ns() - begin) / nr_fds;
+
+	begin = now_ns();
+	ctl_all(ep, EPOLL_CTL_DEL, fds, nr_fds, 0);
+	double del_ns = (double)(now_ns() - begin) / nr_fds;
+
+	/* Closing a descriptor must remove it from the epoll instance. */
+	ctl_all(ep, EPOLL_CTL_ADD, fds, nr_fds, EPOLLIN);
+	begin = now_ns();
+	close_fds(fds, nr_fds);
+	double close_ns = (double)(now_ns() - begin) / nr_fds;
+
+	printf("%8d fds, %6d active: ADD %8.0f ns, MOD %8.0f ns, "
+	       "DEL %8.0f ns, close %8.0f ns, wait %10.0f ns, "
+	       "%6.0f bytes/fd\n",
+	    nr_fds, nr_active, add_ns, mod_ns, del_ns, close_ns, wait_ns,
+	    rss_before < 0 || rss_after < 0 ?
+		0.0 :
+		(double)(rss_after - rss_before) * 1024.0 / nr_fds);
+
+	ATF_REQUIRE(close(ep) == 0);
+	close_fds(write_fds, nr_fds);
+	free(write_fds);
+	free(fds);
+}
+
+ATF_TC(perf_registration_scale__sweep);
+ATF_TC_HEAD(perf_registration_scale__sweep, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "300");
+}
+ATF_TC_BODY(perf_registration_scale__sweep, tc)
+{
+	static const int sizes[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+	static const double active_ratios[] = { 0.001, 0.01, 0.1 };
+
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+	    rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	for (int s = 0; s < (int)nitems(sizes); ++s) {
+		for (int r = 0; r < (int)nitems(active_ratios); ++r) {
+			run_benchmark(sizes[s], active_ratios[r]);
+		}
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_registration_scale__sweep);
+
+	return atf_no_error();
+}
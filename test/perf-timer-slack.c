@@ -0,0 +1,169 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define NR_TIMERFDS (100000)
+#define RUN_TIME_MS (2000)
+
+/*
+ * Keeps lots of timerfds with jittered timeouts of about a second busy, like
+ * retransmission timers, and reports the number of times 'epoll_wait' woke
+ * up with and without timer slack.
+ */
+
+#ifdef TFD_WHEEL
+static long
+now_ms(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+arm_jittered(int fd, unsigned int *seed)
+{
+	struct itimerspec time = {
+		.it_value.tv_nsec = 500000000 + rand_r(seed) % 500000000,
+	};
+	ATF_REQUIRE(timerfd_settime(fd, 0, &time, NULL) == 0);
+}
+
+static void
+run_benchmark(int const *fds, int nr_fds, long slack_ms)
+{
+	unsigned int seed = 42;
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	for (int i = 0; i < nr_fds; ++i) {
+		ATF_REQUIRE(timerfd_set_slack(fds[i],
+				&(struct timespec) {
+				    .tv_nsec = slack_ms * 1000000,
+				}) == 0);
+
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data.fd = fds[i],
+		};
+		ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &event) == 0);
+
+		arm_jittered(fds[i], &seed);
+	}
+
+	long nr_wakeups = 0;
+	long nr_expirations = 0;
+	struct epoll_event events[4096];
+
+	long start = now_ms();
+	long elapsed;
+	while ((elapsed = now_ms() - start) < RUN_TIME_MS) {
+		int n = epoll_wait(ep, events, (int)nitems(events),
+		    (int)(RUN_TIME_MS - elapsed));
+		ATF_REQUIRE(n >= 0);
+		if (n == 0) {
+			continue;
+		}
+
+		++nr_wakeups;
+		for (int i = 0; i < n; ++i) {
+			uint64_t timeouts;
+			if (read(events[i].data.fd, &timeouts,
+				sizeof(timeouts)) != (ssize_t)sizeof(timeouts)) {
+				ATF_REQUIRE(errno == EAGAIN);
+				continue;
+			}
+			nr_expirations += (long)timeouts;
+			arm_jittered(events[i].data.fd, &seed);
+		}
+	}
+
+	printf("slack %3ldms: %d timers, %8.0f wakeups/s, "
+	       "%8.0f expirations/s\n",
+	    slack_ms, nr_fds, (double)nr_wakeups * 1000.0 / (double)elapsed,
+	    (double)nr_expirations * 1000.0 / (double)elapsed);
+
+	for (int i = 0; i < nr_fds; ++i) {
+		ATF_REQUIRE(timerfd_settime(fds[i], 0,
+				&(struct itimerspec) { .it_value.tv_nsec = 0 },
+				NULL) == 0);
+	}
+	ATF_REQUIRE(close(ep) == 0);
+}
+#endif
+
+ATF_TC(perf_timer_slack__wakeups);
+ATF_TC_HEAD(perf_timer_slack__wakeups, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "60");
+}
+ATF_TC_BODY(perf_timer_slack__wakeups, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("timerfd_set_slack not supported");
+#else
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+	    rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	int *fds = malloc(NR_TIMERFDS * sizeof(int));
+	ATF_REQUIRE(fds);
+
+	int nr_fds = 0;
+	while (nr_fds < NR_TIMERFDS) {
+		int fd = timerfd_create(CLOCK_MONOTONIC,
+		    TFD_CLOEXEC | TFD_NONBLOCK);
+		if (fd < 0) {
+			break;
+		}
+
+		/* Armed timers might need additional resources. */
+		if (timerfd_settime(fd, 0,
+			&(struct itimerspec) { .it_value.tv_sec = 3600 },
+			NULL) < 0) {
+			ATF_REQUIRE(close(fd) == 0);
+			break;
+		}
+		fds[nr_fds++] = fd;
+	}
+	/* Leave some descriptors for epoll itself. */
+	for (int i = 0; i < 64 && nr_fds > 0; ++i) {
+		ATF_REQUIRE(close(fds[--nr_fds]) == 0);
+	}
+	if (nr_fds == 0) {
+		atf_tc_skip("could not create timerfds: %d", errno);
+	}
+
+	run_benchmark(fds, nr_fds, 0);
+	run_benchmark(fds, nr_fds, 10);
+
+	for (int i = 0; i < nr_fds; ++i) {
+		ATF_REQUIRE(close(fds[i]) == 0);
+	}
+	free(fds);
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_timer_slack__wakeups);
+
+	return atf_no_error();
+}
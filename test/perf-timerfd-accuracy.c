@@ -0,0 +1,116 @@
+#include <atf-c.h>
+
+#include <sys/timerfd.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define NR_SAMPLES (200)
+
+/*
+ * Arms a timerfd over and over with a short timeout and reports how late the
+ * expirations were observed (p50/p99/max), for different clocks and timeout
+ * resolutions.
+ */
+
+static int64_t
+now_ns(int clockid)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(clockid, &ts) == 0);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+compare_int64(void const *a, void const *b)
+{
+	int64_t x = *(int64_t const *)a;
+	int64_t y = *(int64_t const *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+run_benchmark(int clockid, char const *clock_name, bool is_abstime,
+    long timeout_ns)
+{
+	int64_t lateness[NR_SAMPLES];
+
+	int fd = timerfd_create(clockid, TFD_CLOEXEC);
+	ATF_REQUIRE(fd >= 0);
+
+	for (int i = 0; i < NR_SAMPLES; ++i) {
+		int64_t deadline = now_ns(clockid) + timeout_ns;
+
+		struct itimerspec time = {
+			.it_value.tv_sec = timeout_ns / 1000000000,
+			.it_value.tv_nsec = timeout_ns % 1000000000,
+		};
+		if (is_abstime) {
+			time.it_value.tv_sec = deadline / 1000000000;
+			time.it_value.tv_nsec = deadline % 1000000000;
+		}
+		ATF_REQUIRE(timerfd_settime(fd,
+				is_abstime ? TFD_TIMER_ABSTIME : 0, &time,
+				NULL) == 0);
+
+		uint64_t timeouts;
+		ATF_REQUIRE(read(fd, &timeouts, sizeof(timeouts)) ==
+		    (ssize_t)sizeof(timeouts));
+		ATF_REQUIRE(timeouts == 1);
+
+		lateness[i] = now_ns(clockid) - deadline;
+	}
+
+	qsort(lateness, nitems(lateness), sizeof(lateness[0]), compare_int64);
+
+	printf("%-9s %-8s %9ldns: lateness p50 %9lldns, p99 %9lldns, "
+	       "max %9lldns\n",
+	    clock_name, is_abstime ? "absolute" : "relative", timeout_ns,
+	    (long long)lateness[NR_SAMPLES / 2],
+	    (long long)lateness[NR_SAMPLES * 99 / 100],
+	    (long long)lateness[NR_SAMPLES - 1]);
+
+	ATF_REQUIRE(close(fd) == 0);
+}
+
+ATF_TC(perf_timerfd_accuracy__lateness);
+ATF_TC_HEAD(perf_timerfd_accuracy__lateness, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "60");
+}
+ATF_TC_BODY(perf_timerfd_accuracy__lateness, tc)
+{
+	static const struct {
+		int clockid;
+		char const *name;
+	} clocks[] = {
+		{ CLOCK_MONOTONIC, "MONOTONIC" },
+		{ CLOCK_REALTIME, "REALTIME" },
+	};
+	/* Timeouts that are not whole micro- or milliseconds. */
+	static const long timeouts_ns[] = { 1500, 50333, 1000777, 10000000 };
+
+	for (int c = 0; c < (int)nitems(clocks); ++c) {
+		for (int t = 0; t < (int)nitems(timeouts_ns); ++t) {
+			run_benchmark(clocks[c].clockid, clocks[c].name, false,
+			    timeouts_ns[t]);
+			run_benchmark(clocks[c].clockid, clocks[c].name, true,
+			    timeouts_ns[t]);
+		}
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_timerfd_accuracy__lateness);
+
+	return atf_no_error();
+}
@@ -0,0 +1,106 @@
+#include <atf-c.h>
+
+#include <sys/timerfd.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NR_TIMERFDS (1000)
+#define NR_ROUNDS (200)
+
+/*
+ * Re-arms lots of timerfds per "tick", like a scheduler would, and compares
+ * a loop of 'timerfd_settime' calls with 'timerfd_settime_many'.
+ */
+
+#ifdef TFD_WHEEL
+static double
+now_ns(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void
+fill_times(struct itimerspec *times, int round)
+{
+	for (int i = 0; i < NR_TIMERFDS; ++i) {
+		times[i] = (struct itimerspec) {
+			.it_value.tv_sec = 10 + (i + round) % 10,
+		};
+	}
+}
+
+static void
+run_benchmark(int tfd_flags, char const *name)
+{
+	int *fds = malloc(NR_TIMERFDS * sizeof(int));
+	struct itimerspec *times = malloc(
+	    NR_TIMERFDS * sizeof(struct itimerspec));
+	int *errors = malloc(NR_TIMERFDS * sizeof(int));
+	ATF_REQUIRE(fds && times && errors);
+
+	for (int i = 0; i < NR_TIMERFDS; ++i) {
+		fds[i] = timerfd_create(CLOCK_MONOTONIC,
+		    TFD_CLOEXEC | TFD_NONBLOCK | tfd_flags);
+		if (fds[i] < 0) {
+			atf_tc_skip("could not create timerfd: %d", errno);
+		}
+	}
+
+	double begin = now_ns();
+	for (int round = 0; round < NR_ROUNDS; ++round) {
+		fill_times(times, round);
+		for (int i = 0; i < NR_TIMERFDS; ++i) {
+			ATF_REQUIRE(timerfd_settime(fds[i], 0, &times[i],
+					NULL) == 0);
+		}
+	}
+	double loop_ns = (now_ns() - begin) / (NR_ROUNDS * NR_TIMERFDS);
+
+	begin = now_ns();
+	for (int round = 0; round < NR_ROUNDS; ++round) {
+		fill_times(times, round);
+		ATF_REQUIRE(timerfd_settime_many(fds, 0, times, errors,
+				NR_TIMERFDS) == 0);
+	}
+	double many_ns = (now_ns() - begin) / (NR_ROUNDS * NR_TIMERFDS);
+
+	printf("%s: timerfd_settime loop: %8.0f ns/timer, "
+	       "timerfd_settime_many: %8.0f ns/timer\n",
+	    name, loop_ns, many_ns);
+
+	for (int i = 0; i < NR_TIMERFDS; ++i) {
+		ATF_REQUIRE(close(fds[i]) == 0);
+	}
+	free(errors);
+	free(times);
+	free(fds);
+}
+#endif
+
+ATF_TC(perf_timerfd_settime__many);
+ATF_TC_HEAD(perf_timerfd_settime__many, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "60");
+}
+ATF_TC_BODY(perf_timerfd_settime__many, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("timerfd_settime_many not supported");
+#else
+	run_benchmark(0, "kernel timers");
+	run_benchmark(TFD_WHEEL, "TFD_WHEEL");
+#endif
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_timerfd_settime__many);
+
+	return atf_no_error();
+}
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define NR_WAKEUPS (2000)
+#define MAX_PRODUCERS (8)
+
+/*
+ * Measures how long it takes until a thread sleeping in 'epoll_wait' notices
+ * that another thread has signalled it. Each producer has its own eventfd or
+ * pipe, signals it and waits until the consumer has seen the wakeup before it
+ * signals again. The "self-pipe" variant waits in 'poll' instead of
+ * 'epoll_wait' and shows the cost of the underlying descriptor alone.
+ *
+ * The eventfd variant goes through the shim's 'KQueueEvent', which is
+ * triggered with EVFILT_USER if the kernel has it. Configure with
+ * '-DENABLE_EVFILT_USER=OFF' to measure the self-pipe fallback instead.
+ */
+
+typedef enum {
+	MECHANISM_EVENTFD,
+	MECHANISM_PIPE,
+	MECHANISM_SELF_PIPE,
+} Mechanism;
+
+static char const *const mechanism_names[] = {
+	[MECHANISM_EVENTFD] = "eventfd",
+	[MECHANISM_PIPE] = "pipe",
+	[MECHANISM_SELF_PIPE] = "self-pipe",
+};
+
+typedef struct {
+	Mechanism mechanism;
+	int read_fd;
+	int write_fd;
+	_Atomic int64_t sent_at;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool is_acked;
+} Producer;
+
+static int64_t
+now_ns(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+compare_int64(void const *a, void const *b)
+{
+	int64_t x = *(int64_t const *)a;
+	int64_t y = *(int64_t const *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+producer_init(Producer *producer, Mechanism mechanism)
+{
+	*producer = (Producer) { .mechanism = mechanism };
+
+	if (mechanism == MECHANISM_EVENTFD) {
+		int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		ATF_REQUIRE(fd >= 0);
+		producer->read_fd = producer->write_fd = fd;
+	} else {
+		int p[2];
+		ATF_REQUIRE(pipe2(p, O_CLOEXEC | O_NONBLOCK) == 0);
+		producer->read_fd = p[0];
+		producer->write_fd = p[1];
+	}
+
+	ATF_REQUIRE(pthread_mutex_init(&producer->mutex, NULL) == 0);
+	ATF_REQUIRE(pthread_cond_init(&producer->cond, NULL) == 0);
+}
+
+static void
+producer_terminate(Producer *producer)
+{
+	ATF_REQUIRE(pthread_cond_destroy(&producer->cond) == 0);
+	ATF_REQUIRE(pthread_mutex_destroy(&producer->mutex) == 0);
+
+	ATF_REQUIRE(close(producer->read_fd) == 0);
+	if (producer->write_fd != producer->read_fd) {
+		ATF_REQUIRE(close(producer->write_fd) == 0);
+	}
+}
+
+static void
+producer_signal(Producer *producer)
+{
+	if (producer->mechanism == MECHANISM_EVENTFD) {
+		ATF_REQUIRE(eventfd_write(producer->write_fd, 1) == 0);
+	} else {
+		ATF_REQUIRE(write(producer->write_fd, "", 1) == 1);
+	}
+}
+
+static void
+producer_drain(Producer *producer)
+{
+	if (producer->mechanism == MECHANISM_EVENTFD) {
+		eventfd_t value;
+		ATF_REQUIRE(eventfd_read(producer->read_fd, &value) == 0);
+		ATF_REQUIRE(value == 1);
+	} else {
+		char c;
+		ATF_REQUIRE(read(producer->read_fd, &c, 1) == 1);
+	}
+}
+
+static void *
+producer_thread_fun(void *arg)
+{
+	Producer *producer = arg;
+
+	for (int i = 0; i < NR_WAKEUPS; ++i) {
+		ATF_REQUIRE(pthread_mutex_lock(&producer->mutex) == 0);
+		producer->is_acked = false;
+		ATF_REQUIRE(pthread_mutex_unlock(&producer->mutex) == 0);
+
+		atomic_store(&producer->sent_at, now_ns());
+		producer_signal(producer);
+
+		ATF_REQUIRE(pthread_mutex_lock(&producer->mutex) == 0);
+		while (!producer->is_acked) {
+			ATF_REQUIRE(pthread_cond_wait(&producer->cond,
+					&producer->mutex) == 0);
+		}
+		ATF_REQUIRE(pthread_mutex_unlock(&producer->mutex) == 0);
+	}
+
+	return NULL;
+}
+
+static void
+consume(Producer *producer, int64_t *latencies, int *nr_latencies)
+{
+	producer_drain(producer);
+	latencies[(*nr_latencies)++] = now_ns() -
+	    atomic_load(&producer->sent_at);
+
+	ATF_REQUIRE(pthread_mutex_lock(&producer->mutex) == 0);
+	producer->is_acked = true;
+	ATF_REQUIRE(pthread_cond_signal(&producer->cond) == 0);
+	ATF_REQUIRE(pthread_mutex_unlock(&producer->mutex) == 0);
+}
+
+static void
+run_benchmark(Mechanism mechanism, int nr_producers)
+{
+	Producer producers[MAX_PRODUCERS];
+	pthread_t threads[MAX_PRODUCERS];
+	struct pollfd pfds[MAX_PRODUCERS];
+	struct epoll_event events[MAX_PRODUCERS];
+
+	int nr_expected = nr_producers * NR_WAKEUPS;
+	int64_t *latencies = malloc((size_t)nr_expected * sizeof(int64_t));
+	ATF_REQUIRE(latencies);
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	for (int i = 0; i < nr_producers; ++i) {
+		producer_init(&producers[i], mechanism);
+
+		if (mechanism != MECHANISM_SELF_PIPE) {
+			struct epoll_event event = {
+				.events = EPOLLIN,
+				.data.u32 = (uint32_t)i,
+			};
+			ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD,
+					producers[i].read_fd, &event) == 0);
+		}
+
+		pfds[i] = (struct pollfd) {
+			.fd = producers[i].read_fd,
+			.events = POLLIN,
+		};
+	}
+
+	int64_t begin = now_ns();
+
+	for (int i = 0; i < nr_producers; ++i) {
+		ATF_REQUIRE(pthread_create(&threads[i], NULL,
+				producer_thread_fun, &producers[i]) == 0);
+	}
+
+	long nr_wakeups = 0;
+	int nr_latencies = 0;
+	while (nr_latencies < nr_expected) {
+		if (mechanism == MECHANISM_SELF_PIPE) {
+			int n = poll(pfds, (nfds_t)nr_producers, -1);
+			ATF_REQUIRE(n > 0);
+			for (int i = 0; i < nr_producers; ++i) {
+				if (pfds[i].revents & POLLIN) {
+					consume(&producers[i], latencies,
+					    &nr_latencies);
+				}
+			}
+		} else {
+			int n = epoll_wait(ep, events, (int)nitems(events),
+			    -1);
+			ATF_REQUIRE(n > 0);
+			for (int i = 0; i < n; ++i) {
+				consume(&producers[events[i].data.u32],
+				    latencies, &nr_latencies);
+			}
+		}
+		++nr_wakeups;
+	}
+
+	int64_t elapsed = now_ns() - begin;
+
+	for (int i = 0; i < nr_producers; ++i) {
+		ATF_REQUIRE(pthread_join(threads[i], NULL) == 0);
+	}
+	ATF_REQUIRE(close(ep) == 0);
+	for (int i = 0; i < nr_producers; ++i) {
+		producer_terminate(&producers[i]);
+	}
+
+	qsort(latencies, (size_t)nr_expected, sizeof(int64_t), compare_int64);
+
+	printf("{\"benchmark\": \"wakeup\", \"mechanism\": \"%s\", "
+	       "\"producers\": %d, \"signals\": %d, \"wakeups\": %ld, "
+	       "\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld, "
+	       "\"signals_per_s\": %.0f}\n",
+	    mechanism_names[mechanism], nr_producers, nr_expected, nr_wakeups,
+	    (long long)latencies[nr_expected / 2],
+	    (long long)latencies[nr_expected * 99 / 100],
+	    (long long)latencies[nr_expected * 999 / 1000],
+	    (double)nr_expected * 1e9 / (double)elapsed);
+
+	free(latencies);
+}
+
+ATF_TC(perf_wakeup__latency);
+ATF_TC_HEAD(perf_wakeup__latency, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "120");
+}
+ATF_TC_BODY(perf_wakeup__latency, tc)
+{
+	static const int nr_producers[] = { 1, 2, 4, MAX_PRODUCERS };
+
+	for (int m = 0; m < (int)nitems(mechanism_names); ++m) {
+		for (int p = 0; p < (int)nitems(nr_producers); ++p) {
+			run_benchmark((Mechanism)m, nr_producers[p]);
+		}
+	}
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, perf_wakeup__latency);
+
+	return atf_no_error();
+}
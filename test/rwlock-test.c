@@ -1,5 +1,6 @@
 #include <atf-c.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include <rwlock.h>
@@ -102,9 +103,108 @@ ATF_TC_BODY(stress, tc)
 	}
 }
 
+#define NR_READ_OPS (200000)
+
+struct scaling_data {
+	RWLock *lock;
+	pthread_rwlock_t *pthread_lock;
+};
+
+static void *
+scaling_reader(void *arg)
+{
+	struct scaling_data *scaling_data = arg;
+
+	for (int i = 0; i < NR_READ_OPS; ++i) {
+		rwlock_lock_read(scaling_data->lock);
+		rwlock_unlock_read(scaling_data->lock);
+	}
+
+	return NULL;
+}
+
+static void *
+scaling_pthread_reader(void *arg)
+{
+	struct scaling_data *scaling_data = arg;
+
+	for (int i = 0; i < NR_READ_OPS; ++i) {
+		ATF_REQUIRE(pthread_rwlock_rdlock(scaling_data->pthread_lock) ==
+		    0);
+		ATF_REQUIRE(pthread_rwlock_unlock(scaling_data->pthread_lock) ==
+		    0);
+	}
+
+	return NULL;
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double
+run_scaling(void *(*reader)(void *), struct scaling_data *scaling_data,
+    int nr_threads)
+{
+	pthread_t threads[64];
+
+	double begin = now_ns();
+	for (int i = 0; i < nr_threads; ++i) {
+		ATF_REQUIRE(pthread_create(&threads[i], NULL, /**/
+				reader, scaling_data) == 0);
+	}
+	for (int i = 0; i < nr_threads; ++i) {
+		ATF_REQUIRE(pthread_join(threads[i], NULL) == 0);
+	}
+	double elapsed_ns = now_ns() - begin;
+
+	return (double)nr_threads * NR_READ_OPS / elapsed_ns * 1e3;
+}
+
+/*
+ * Only readers, so any slowdown with more threads comes from cache line
+ * bouncing inside the lock.
+ */
+ATF_TC(read_scaling);
+ATF_TC_HEAD(read_scaling, tc)
+{
+	atf_tc_set_md_var(tc, "timeout", "120");
+}
+ATF_TC_BODY(read_scaling, tc)
+{
+	RWLock rwlock;
+	ATF_REQUIRE(rwlock_init(&rwlock) == 0);
+	pthread_rwlock_t pthread_rwlock;
+	ATF_REQUIRE(pthread_rwlock_init(&pthread_rwlock, NULL) == 0);
+
+	struct scaling_data scaling_data = {
+		.lock = &rwlock,
+		.pthread_lock = &pthread_rwlock,
+	};
+
+	for (int nr_threads = 1; nr_threads <= 64; nr_threads *= 2) {
+		double ops = run_scaling(scaling_reader, &scaling_data,
+		    nr_threads);
+		double pthread_ops = run_scaling(scaling_pthread_reader,
+		    &scaling_data, nr_threads);
+
+		printf("%2d threads: rwlock %8.2f Mops/s, "
+		       "pthread_rwlock %8.2f Mops/s\n",
+		    nr_threads, ops, pthread_ops);
+	}
+
+	ATF_REQUIRE(pthread_rwlock_destroy(&pthread_rwlock) == 0);
+	rwlock_terminate(&rwlock);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, stress);
+	ATF_TP_ADD_TC(tp, read_scaling);
 
 	return atf_no_error();
 }
@@ -4,6 +4,7 @@
 
 #include <sys/types.h>
 
+#include <sys/epoll.h>
 #include <sys/param.h>
 #include <sys/resource.h>
 #include <sys/select.h>
@@ -189,6 +190,94 @@ ATF_TC_BODY_FD_LEAKCHECK(signalfd__multiple_signals, tcptr)
 	ATF_REQUIRE(close(sfd) == 0);
 }
 
+ATF_TC_WITHOUT_HEAD(signalfd__batched_read);
+ATF_TC_BODY_FD_LEAKCHECK(signalfd__batched_read, tcptr)
+{
+#ifndef SIGRTMIN
+	atf_tc_skip("no realtime signals");
+#else
+	sigset_t mask;
+	struct signalfd_siginfo fdsi[64];
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGRTMIN);
+
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+
+	int sfd = signalfd(-1, &mask, SFD_NONBLOCK);
+	ATF_REQUIRE(sfd >= 0);
+
+	/* More than fit into a single batch. */
+	for (int i = 0; i < 40; ++i) {
+		ATF_REQUIRE(sigqueue(getpid(), SIGRTMIN,
+				(union sigval) { .sival_int = i }) == 0);
+	}
+
+	{
+		struct pollfd pfd = { .fd = sfd, .events = POLLIN };
+		ATF_REQUIRE(poll(&pfd, 1, -1) == 1);
+		ATF_REQUIRE(pfd.revents == POLLIN);
+	}
+
+	ssize_t s = read(sfd, fdsi, sizeof(fdsi));
+	ATF_REQUIRE(s == 40 * (ssize_t)sizeof(struct signalfd_siginfo));
+	for (int i = 0; i < 40; ++i) {
+		ATF_REQUIRE(fdsi[i].ssi_signo == (uint32_t)SIGRTMIN);
+		ATF_REQUIRE(fdsi[i].ssi_int == i);
+	}
+
+	{
+		struct pollfd pfd = { .fd = sfd, .events = POLLIN };
+		ATF_REQUIRE(poll(&pfd, 1, 0) == 0);
+	}
+	ATF_REQUIRE_ERRNO(EAGAIN, read(sfd, fdsi, sizeof(fdsi)) < 0);
+
+	ATF_REQUIRE(close(sfd) == 0);
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(signalfd__disjoint_masks);
+ATF_TC_BODY_FD_LEAKCHECK(signalfd__disjoint_masks, tcptr)
+{
+	sigset_t mask1;
+	sigset_t mask2;
+	struct signalfd_siginfo fdsi;
+
+	sigemptyset(&mask1);
+	sigaddset(&mask1, SIGUSR1);
+	sigemptyset(&mask2);
+	sigaddset(&mask2, SIGUSR2);
+
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &mask1, NULL) == 0);
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &mask2, NULL) == 0);
+
+	int sfd1 = signalfd(-1, &mask1, SFD_NONBLOCK);
+	ATF_REQUIRE(sfd1 >= 0);
+	int sfd2 = signalfd(-1, &mask2, SFD_NONBLOCK);
+	ATF_REQUIRE(sfd2 >= 0);
+
+	ATF_REQUIRE(kill(getpid(), SIGUSR1) == 0);
+
+	struct pollfd pfds[2] = {
+		{ .fd = sfd1, .events = POLLIN },
+		{ .fd = sfd2, .events = POLLIN },
+	};
+	ATF_REQUIRE(poll(pfds, 2, -1) == 1);
+	ATF_REQUIRE(pfds[0].revents == POLLIN);
+	ATF_REQUIRE(pfds[1].revents == 0);
+
+	ATF_REQUIRE_ERRNO(EAGAIN,
+	    read(sfd2, &fdsi, sizeof(struct signalfd_siginfo)) < 0);
+	ATF_REQUIRE(read(sfd1, &fdsi, sizeof(struct signalfd_siginfo)) ==
+	    (ssize_t)sizeof(struct signalfd_siginfo));
+	ATF_REQUIRE(fdsi.ssi_signo == SIGUSR1);
+
+	ATF_REQUIRE(poll(pfds, 2, 0) == 0);
+
+	ATF_REQUIRE(close(sfd1) == 0);
+	ATF_REQUIRE(close(sfd2) == 0);
+}
+
 ATF_TC_WITHOUT_HEAD(signalfd__modify_signalmask);
 ATF_TC_BODY_FD_LEAKCHECK(signalfd__modify_signalmask, tcptr)
 {
@@ -203,16 +292,70 @@ ATF_TC_BODY_FD_LEAKCHECK(signalfd__modify_signalmask, tcptr)
 
 	sigaddset(&mask, SIGUSR1);
 
-#ifndef __linux__
-	atf_tc_expect_fail("modifying an existing signalfd descriptor is "
-			   "not currently supported");
-#endif
-
 	ATF_REQUIRE(sfd == signalfd(sfd, &mask, 0));
 
 	ATF_REQUIRE(close(sfd) == 0);
 }
 
+ATF_TC_WITHOUT_HEAD(signalfd__modify_signalmask_readiness);
+ATF_TC_BODY_FD_LEAKCHECK(signalfd__modify_signalmask_readiness, tcptr)
+{
+	sigset_t mask;
+	struct signalfd_siginfo fdsi;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	int sfd = signalfd(-1, &mask, SFD_NONBLOCK);
+	ATF_REQUIRE(sfd >= 0);
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+	struct epoll_event event = { .events = EPOLLIN, .data.fd = sfd };
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &event) == 0);
+
+	ATF_REQUIRE(kill(getpid(), SIGUSR2) == 0);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 100) == 0);
+
+	/* A signal that is already pending makes the signalfd readable. */
+	sigaddset(&mask, SIGUSR2);
+	ATF_REQUIRE(signalfd(sfd, &mask, SFD_CLOEXEC) == sfd);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+	ATF_REQUIRE(event.data.fd == sfd);
+	ATF_REQUIRE(read(sfd, &fdsi, sizeof(fdsi)) == (ssize_t)sizeof(fdsi));
+	ATF_REQUIRE(fdsi.ssi_signo == SIGUSR2);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 0);
+
+	/* Removed signals are not reported anymore. */
+	sigdelset(&mask, SIGUSR1);
+	ATF_REQUIRE(signalfd(sfd, &mask, 0) == sfd);
+	ATF_REQUIRE(kill(getpid(), SIGUSR1) == 0);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 100) == 0);
+	ATF_REQUIRE_ERRNO(EAGAIN, read(sfd, &fdsi, sizeof(fdsi)) < 0);
+
+	ATF_REQUIRE(kill(getpid(), SIGUSR2) == 0);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+	ATF_REQUIRE(read(sfd, &fdsi, sizeof(fdsi)) == (ssize_t)sizeof(fdsi));
+	ATF_REQUIRE(fdsi.ssi_signo == SIGUSR2);
+
+	/* Clean up the pending SIGUSR1. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	ATF_REQUIRE(signalfd(sfd, &mask, 0) == sfd);
+	ATF_REQUIRE(read(sfd, &fdsi, sizeof(fdsi)) == (ssize_t)sizeof(fdsi));
+	ATF_REQUIRE(fdsi.ssi_signo == SIGUSR1);
+
+	/* Other descriptors are rejected. */
+	ATF_REQUIRE_ERRNO(EINVAL, signalfd(ep, &mask, 0) < 0);
+
+	ATF_REQUIRE(close(ep) == 0);
+	ATF_REQUIRE(close(sfd) == 0);
+}
+
 ATF_TC_WITHOUT_HEAD(signalfd__argument_checks);
 ATF_TC_BODY_FD_LEAKCHECK(signalfd__argument_checks, tcptr)
 {
@@ -642,13 +785,98 @@ ATF_TC_BODY_FD_LEAKCHECK(signalfd__multiple_readers, tcptr)
 #endif
 }
 
+ATF_TC_WITHOUT_HEAD(signalfd__fork);
+ATF_TC_BODY_FD_LEAKCHECK(signalfd__fork, tcptr)
+{
+	sigset_t mask;
+	sigset_t parent_mask;
+
+	ATF_REQUIRE(sigemptyset(&mask) == 0);
+	ATF_REQUIRE(sigaddset(&mask, SIGUSR1) == 0);
+	ATF_REQUIRE(sigemptyset(&parent_mask) == 0);
+	ATF_REQUIRE(sigaddset(&parent_mask, SIGUSR2) == 0);
+
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &parent_mask, NULL) == 0);
+
+	/* Make sure the parent has a live signal router. */
+	int sfd = signalfd(-1, &parent_mask, SFD_NONBLOCK);
+	ATF_REQUIRE(sfd >= 0);
+
+	pid_t pid = fork();
+	ATF_REQUIRE(pid >= 0);
+	if (pid == 0) {
+		int child_sfd = signalfd(-1, &mask, SFD_NONBLOCK);
+		if (child_sfd < 0) {
+			_Exit(1);
+		}
+
+		int ep = epoll_create1(EPOLL_CLOEXEC);
+		if (ep < 0) {
+			_Exit(2);
+		}
+
+		struct epoll_event event = { .events = EPOLLIN };
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, child_sfd, &event) < 0) {
+			_Exit(3);
+		}
+
+		if (kill(getpid(), SIGUSR1) < 0) {
+			_Exit(4);
+		}
+
+		/* The readiness must come from the child's router. */
+		if (epoll_wait(ep, &event, 1, 5000) != 1) {
+			_Exit(5);
+		}
+
+		struct signalfd_siginfo fdsi;
+		if (read(child_sfd, &fdsi, sizeof(fdsi)) !=
+			(ssize_t)sizeof(fdsi) ||
+		    fdsi.ssi_signo != SIGUSR1) {
+			_Exit(6);
+		}
+
+		if (close(ep) < 0 || close(child_sfd) < 0) {
+			_Exit(7);
+		}
+
+		_Exit(0);
+	}
+
+	int status;
+	ATF_REQUIRE(waitpid(pid, &status, 0) == pid);
+	ATF_REQUIRE(WIFEXITED(status));
+	ATF_REQUIRE_MSG(WEXITSTATUS(status) == 0, "%d", WEXITSTATUS(status));
+
+	/* The router of the parent is still intact. */
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	struct epoll_event event = { .events = EPOLLIN };
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, sfd, &event) == 0);
+
+	ATF_REQUIRE(kill(getpid(), SIGUSR2) == 0);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 5000) == 1);
+
+	struct signalfd_siginfo fdsi;
+	ATF_REQUIRE(read(sfd, &fdsi, sizeof(fdsi)) == (ssize_t)sizeof(fdsi));
+	ATF_REQUIRE(fdsi.ssi_signo == SIGUSR2);
+
+	ATF_REQUIRE(close(ep) == 0);
+	ATF_REQUIRE(close(sfd) == 0);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, signalfd__simple_signalfd);
 	ATF_TP_ADD_TC(tp, signalfd__blocking_read);
 	ATF_TP_ADD_TC(tp, signalfd__nonblocking_read);
 	ATF_TP_ADD_TC(tp, signalfd__multiple_signals);
+	ATF_TP_ADD_TC(tp, signalfd__batched_read);
+	ATF_TP_ADD_TC(tp, signalfd__disjoint_masks);
 	ATF_TP_ADD_TC(tp, signalfd__modify_signalmask);
+	ATF_TP_ADD_TC(tp, signalfd__modify_signalmask_readiness);
 	ATF_TP_ADD_TC(tp, signalfd__argument_checks);
 	ATF_TP_ADD_TC(tp, signalfd__signal_disposition);
 	ATF_TP_ADD_TC(tp, signalfd__sigwaitinfo);
@@ -656,6 +884,7 @@ ATF_TP_ADD_TCS(tp)
 	ATF_TP_ADD_TC(tp, signalfd__sigchld);
 	ATF_TP_ADD_TC(tp, signalfd__sigwinch);
 	ATF_TP_ADD_TC(tp, signalfd__multiple_readers);
+	ATF_TP_ADD_TC(tp, signalfd__fork);
 
 	return atf_no_error();
 }
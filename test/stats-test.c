@@ -0,0 +1,128 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <epoll-shim/stats.h>
+
+#define NR_THREAD_OPS 100
+
+ATF_TC_WITHOUT_HEAD(stats__epoll_wait);
+ATF_TC_BODY(stats__epoll_wait, tc)
+{
+	struct epoll_shim_stats before, after, epollfd_stats;
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	ATF_REQUIRE(epoll_shim_get_stats(&before) == 0);
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.fd = fds[0],
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &event) == 0);
+	ATF_REQUIRE(write(fds[1], "", 1) == 1);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+
+	ATF_REQUIRE(epoll_shim_get_stats(&after) == 0);
+	ATF_REQUIRE(after.epoll_wait_calls - before.epoll_wait_calls == 1);
+	ATF_REQUIRE(after.kevent_calls - before.kevent_calls >= 2);
+	ATF_REQUIRE(after.kevent_changes - before.kevent_changes >= 1);
+
+	ATF_REQUIRE(epoll_shim_get_epollfd_stats(ep, &epollfd_stats) == 0);
+	ATF_REQUIRE(epollfd_stats.epoll_wait_calls == 1);
+	ATF_REQUIRE(epollfd_stats.kevent_calls ==
+	    after.kevent_calls - before.kevent_calls);
+	ATF_REQUIRE(epollfd_stats.kevent_changes ==
+	    after.kevent_changes - before.kevent_changes);
+	ATF_REQUIRE(epollfd_stats.eventfd_ops == 0);
+
+	/* A second epoll instance starts from zero. */
+	int ep2 = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep2 >= 0);
+	ATF_REQUIRE(epoll_shim_get_epollfd_stats(ep2, &epollfd_stats) == 0);
+	ATF_REQUIRE(epollfd_stats.epoll_wait_calls == 0);
+	ATF_REQUIRE(epollfd_stats.kevent_calls == 0);
+
+	ATF_REQUIRE(close(ep2) == 0);
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+}
+
+static void *
+epoll_thread_fun(void *arg)
+{
+	int ep = *(int *)arg;
+	struct epoll_event event;
+
+	for (int i = 0; i < NR_THREAD_OPS; ++i) {
+		ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 0);
+	}
+
+	return NULL;
+}
+
+ATF_TC_WITHOUT_HEAD(stats__exited_threads);
+ATF_TC_BODY(stats__exited_threads, tc)
+{
+	struct epoll_shim_stats before, after;
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	ATF_REQUIRE(epoll_shim_get_stats(&before) == 0);
+
+	pthread_t threads[4];
+	for (int i = 0; i < 4; ++i) {
+		ATF_REQUIRE(pthread_create(&threads[i], NULL,
+				epoll_thread_fun, &ep) == 0);
+	}
+	for (int i = 0; i < 4; ++i) {
+		ATF_REQUIRE(pthread_join(threads[i], NULL) == 0);
+	}
+
+	/* Counts of exited threads must not get lost. */
+	ATF_REQUIRE(epoll_shim_get_stats(&after) == 0);
+	ATF_REQUIRE(after.epoll_wait_calls - before.epoll_wait_calls ==
+	    4 * NR_THREAD_OPS);
+
+	ATF_REQUIRE(close(ep) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(stats__invalid_fd);
+ATF_TC_BODY(stats__invalid_fd, tc)
+{
+	struct epoll_shim_stats stats;
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_get_epollfd_stats(-1, &stats) < 0);
+	ATF_REQUIRE(errno == EBADF);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_get_epollfd_stats(fds[0], &stats) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, stats__epoll_wait);
+	ATF_TP_ADD_TC(tp, stats__exited_threads);
+	ATF_TP_ADD_TC(tp, stats__invalid_fd);
+
+	return atf_no_error();
+}
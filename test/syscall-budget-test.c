@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+
+#include <atf-c.h>
+
+#include <sys/types.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atf-c-leakcheck.h"
+#include "syscall-counter.h"
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+/*
+ * The number of calls into the kernel that the shim may make per operation,
+ * as measured with the userspace kqueue on Linux. If a change makes one of
+ * the tests below fail, the operation got more expensive. Lower the numbers
+ * here if it got cheaper.
+ */
+static struct {
+	char const *op;
+	SyscallCounts budget;
+} const budgets[] = {
+#define BUDGET(op_, kqueue_, kevent_, poll_, fstat_, fcntl_, close_) \
+	{                                                            \
+		.op = (op_),                                         \
+		.budget.n = {                                        \
+			[SYSCALL_KQUEUE] = (kqueue_),                \
+			[SYSCALL_KEVENT] = (kevent_),                \
+			[SYSCALL_POLL] = (poll_),                    \
+			[SYSCALL_FSTAT] = (fstat_),                  \
+			[SYSCALL_FCNTL] = (fcntl_),                  \
+			[SYSCALL_CLOSE] = (close_),                  \
+		},                                                   \
+	}
+	/* Operation, then kqueue, kevent, poll, fstat, fcntl and close. */
+	BUDGET("epoll_create1",         1, 0, 0, 0, 2, 0),
+	BUDGET("epoll_ctl ADD pipe",    0, 1, 0, 1, 1, 0),
+	BUDGET("epoll_ctl MOD pipe",    0, 2, 0, 1, 0, 0),
+	BUDGET("epoll_ctl DEL pipe",    0, 1, 0, 1, 0, 0),
+	BUDGET("epoll_ctl ADD socket",  0, 1, 0, 1, 0, 0),
+	BUDGET("epoll_ctl MOD socket",  0, 2, 0, 1, 0, 0),
+	BUDGET("epoll_ctl DEL socket",  0, 1, 0, 1, 0, 0),
+	BUDGET("epoll_ctl ADD eventfd", 0, 2, 0, 1, 0, 0),
+	BUDGET("epoll_ctl MOD eventfd", 0, 2, 0, 1, 0, 0),
+	BUDGET("epoll_ctl DEL eventfd", 0, 1, 0, 1, 0, 0),
+	BUDGET("epoll_ctl ADD timerfd", 0, 2, 0, 1, 0, 0),
+	BUDGET("epoll_ctl MOD timerfd", 0, 2, 0, 1, 0, 0),
+	BUDGET("epoll_ctl DEL timerfd", 0, 1, 0, 1, 0, 0),
+	BUDGET("epoll_wait empty",      0, 0, 1, 0, 0, 0),
+	BUDGET("epoll_wait level",      0, 1, 1, 0, 0, 0),
+	BUDGET("epoll_wait edge",       0, 1, 1, 0, 0, 0),
+	BUDGET("close epoll",           0, 0, 0, 0, 0, 1),
+	BUDGET("eventfd write",         0, 1, 0, 0, 0, 0),
+	BUDGET("eventfd read",          0, 2, 0, 0, 0, 0),
+	BUDGET("timerfd_settime",       0, 1, 0, 0, 0, 0),
+	BUDGET("timerfd read",          0, 1, 0, 0, 0, 0),
+	BUDGET("signalfd read",         0, 0, 0, 0, 0, 0),
+#undef BUDGET
+};
+
+static void
+check_budget(char const *op, SyscallCounts const *counts)
+{
+	SyscallCounts const *budget = NULL;
+	for (size_t i = 0; i < nitems(budgets); ++i) {
+		if (strcmp(budgets[i].op, op) == 0) {
+			budget = &budgets[i].budget;
+			break;
+		}
+	}
+	ATF_REQUIRE_MSG(budget != NULL, "no budget for \"%s\"", op);
+
+	printf("%-24s", op);
+	for (int i = 0; i < SYSCALL_NR; ++i) {
+		printf(" %s %u", syscall_counter_names[i], counts->n[i]);
+	}
+	printf("\n");
+
+	for (int i = 0; i < SYSCALL_NR; ++i) {
+		ATF_CHECK_MSG(counts->n[i] <= budget->n[i],
+		    "%s: %u calls to %s, budget is %u", op, counts->n[i],
+		    syscall_counter_names[i], budget->n[i]);
+	}
+}
+
+#define MEASURE(op, ...)                                 \
+	do {                                             \
+		SyscallCounts counts_;                   \
+		syscall_counter_start();                 \
+		__VA_ARGS__;                             \
+		syscall_counter_stop(&counts_);          \
+		check_budget((op), &counts_);            \
+	} while (0)
+
+static int
+create_epoll(void)
+{
+	SyscallCounts counts;
+
+	syscall_counter_start();
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	syscall_counter_stop(&counts);
+	ATF_REQUIRE(ep >= 0);
+
+	if (counts.n[SYSCALL_KQUEUE] == 0) {
+		ATF_REQUIRE(close(ep) == 0);
+		atf_tc_skip("kqueue could not be mocked");
+	}
+	check_budget("epoll_create1", &counts);
+
+	return ep;
+}
+
+static void
+ctl_budget(char const *type, int fd)
+{
+	char op[64];
+
+	int ep = create_epoll();
+
+	struct epoll_event event = { .events = EPOLLIN };
+
+	(void)snprintf(op, sizeof(op), "epoll_ctl ADD %s", type);
+	MEASURE(op,
+	    ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fd, &event) == 0));
+
+	event.events = EPOLLIN | EPOLLOUT;
+	(void)snprintf(op, sizeof(op), "epoll_ctl MOD %s", type);
+	MEASURE(op,
+	    ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_MOD, fd, &event) == 0));
+
+	(void)snprintf(op, sizeof(op), "epoll_ctl DEL %s", type);
+	MEASURE(op,
+	    ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_DEL, fd, NULL) == 0));
+
+	ATF_REQUIRE(close(ep) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(syscall_budget__epoll_ctl);
+ATF_TC_BODY_FD_LEAKCHECK(syscall_budget__epoll_ctl, tcptr)
+{
+	int p[2];
+	ATF_REQUIRE(pipe2(p, O_CLOEXEC) == 0);
+	ctl_budget("pipe", p[0]);
+	ATF_REQUIRE(close(p[0]) == 0);
+	ATF_REQUIRE(close(p[1]) == 0);
+
+	int s[2];
+	ATF_REQUIRE(
+	    socketpair(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0, s) == 0);
+	ctl_budget("socket", s[0]);
+	ATF_REQUIRE(close(s[0]) == 0);
+	ATF_REQUIRE(close(s[1]) == 0);
+
+	int efd = eventfd(0, EFD_CLOEXEC);
+	ATF_REQUIRE(efd >= 0);
+	ctl_budget("eventfd", efd);
+	ATF_REQUIRE(close(efd) == 0);
+
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	ATF_REQUIRE(tfd >= 0);
+	ctl_budget("timerfd", tfd);
+	ATF_REQUIRE(close(tfd) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(syscall_budget__epoll_wait);
+ATF_TC_BODY_FD_LEAKCHECK(syscall_budget__epoll_wait, tcptr)
+{
+	struct epoll_event event;
+
+	int ep = create_epoll();
+
+	int p[2];
+	ATF_REQUIRE(pipe2(p, O_CLOEXEC) == 0);
+	ATF_REQUIRE(write(p[1], "", 1) == 1);
+
+	MEASURE("epoll_wait empty",
+	    ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 0));
+
+	event = (struct epoll_event) { .events = EPOLLIN };
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, p[0], &event) == 0);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 1);
+	MEASURE("epoll_wait level",
+	    ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 1));
+
+	event = (struct epoll_event) { .events = EPOLLIN | EPOLLET };
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_MOD, p[0], &event) == 0);
+	MEASURE("epoll_wait edge",
+	    ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 1));
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 0);
+
+	MEASURE("close epoll", ATF_REQUIRE(close(ep) == 0));
+
+	ATF_REQUIRE(close(p[0]) == 0);
+	ATF_REQUIRE(close(p[1]) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(syscall_budget__eventfd);
+ATF_TC_BODY_FD_LEAKCHECK(syscall_budget__eventfd, tcptr)
+{
+	uint64_t value = 1;
+
+	/* Makes sure that mocking works. */
+	ATF_REQUIRE(close(create_epoll()) == 0);
+
+	int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ATF_REQUIRE(efd >= 0);
+
+	MEASURE("eventfd write",
+	    ATF_REQUIRE(write(efd, &value, sizeof(value)) ==
+		(ssize_t)sizeof(value)));
+	MEASURE("eventfd read",
+	    ATF_REQUIRE(read(efd, &value, sizeof(value)) ==
+		(ssize_t)sizeof(value)));
+	ATF_REQUIRE(value == 1);
+
+	ATF_REQUIRE(close(efd) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(syscall_budget__timerfd);
+ATF_TC_BODY_FD_LEAKCHECK(syscall_budget__timerfd, tcptr)
+{
+	uint64_t value;
+
+	ATF_REQUIRE(close(create_epoll()) == 0);
+
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	ATF_REQUIRE(tfd >= 0);
+
+	struct itimerspec time = { .it_value.tv_nsec = 1000000 };
+	MEASURE("timerfd_settime",
+	    ATF_REQUIRE(timerfd_settime(tfd, 0, &time, NULL) == 0));
+
+	/* Do not count the time spent blocking. */
+	struct timespec sleep_time = { .tv_nsec = 10000000 };
+	ATF_REQUIRE(nanosleep(&sleep_time, NULL) == 0);
+
+	MEASURE("timerfd read",
+	    ATF_REQUIRE(read(tfd, &value, sizeof(value)) ==
+		(ssize_t)sizeof(value)));
+	ATF_REQUIRE(value == 1);
+
+	ATF_REQUIRE(close(tfd) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(syscall_budget__signalfd);
+ATF_TC_BODY_FD_LEAKCHECK(syscall_budget__signalfd, tcptr)
+{
+	sigset_t mask;
+	struct signalfd_siginfo fdsi;
+
+	ATF_REQUIRE(close(create_epoll()) == 0);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	ATF_REQUIRE(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
+
+	int sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	ATF_REQUIRE(sfd >= 0);
+
+	ATF_REQUIRE(kill(getpid(), SIGINT) == 0);
+
+	MEASURE("signalfd read",
+	    ATF_REQUIRE(read(sfd, &fdsi, sizeof(fdsi)) ==
+		(ssize_t)sizeof(fdsi)));
+	ATF_REQUIRE(fdsi.ssi_signo == SIGINT);
+
+	ATF_REQUIRE(close(sfd) == 0);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, syscall_budget__epoll_ctl);
+	ATF_TP_ADD_TC(tp, syscall_budget__epoll_wait);
+	ATF_TP_ADD_TC(tp, syscall_budget__eventfd);
+	ATF_TP_ADD_TC(tp, syscall_budget__timerfd);
+	ATF_TP_ADD_TC(tp, syscall_budget__signalfd);
+
+	return atf_no_error();
+}
@@ -0,0 +1,55 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <time.h>
+
+#include "syscall-counter.h"
+
+/*
+ * With the userspace kqueue on Linux, 'compat_kqueue', 'compat_kevent' and
+ * 'compat_kqueue_close' play the role of the system calls. Everything they
+ * do internally is part of the "kernel". This must be linked into the test
+ * executable itself, because the definitions in libepoll-shim would win over
+ * the ones in the counter library.
+ */
+struct kevent;
+
+int compat_kqueue(void);
+int compat_kevent(int kq, struct kevent const *changelist, int nchanges,
+    struct kevent *eventlist, int nevents, struct timespec const *timeout);
+int compat_kqueue_close(int fd);
+
+int
+compat_kqueue(void)
+{
+	syscall_counter_count(SYSCALL_KQUEUE);
+	syscall_counter_kernel_enter();
+	int ret = ((typeof(compat_kqueue) *)dlsym(RTLD_NEXT,
+	    "compat_kqueue"))();
+	syscall_counter_kernel_leave();
+	return ret;
+}
+
+int
+compat_kevent(int kq, struct kevent const *changelist, int nchanges,
+    struct kevent *eventlist, int nevents, struct timespec const *timeout)
+{
+	syscall_counter_count(SYSCALL_KEVENT);
+	syscall_counter_kernel_enter();
+	int ret = ((typeof(compat_kevent) *)dlsym(RTLD_NEXT,
+	    "compat_kevent"))(kq, changelist, nchanges, eventlist, nevents,
+	    timeout);
+	syscall_counter_kernel_leave();
+	return ret;
+}
+
+int
+compat_kqueue_close(int fd)
+{
+	syscall_counter_count(SYSCALL_CLOSE);
+	syscall_counter_kernel_enter();
+	int ret = ((typeof(compat_kqueue_close) *)dlsym(RTLD_NEXT,
+	    "compat_kqueue_close"))(fd);
+	syscall_counter_kernel_leave();
+	return ret;
+}
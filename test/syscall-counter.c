@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+
+#include "syscall-counter.h"
+
+#include <sys/types.h>
+
+#ifndef __linux__
+#include <sys/event.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+char const *const syscall_counter_names[SYSCALL_NR] = {
+	[SYSCALL_KQUEUE] = "kqueue",
+	[SYSCALL_KEVENT] = "kevent",
+	[SYSCALL_POLL] = "poll",
+	[SYSCALL_FSTAT] = "fstat",
+	[SYSCALL_FCNTL] = "fcntl",
+	[SYSCALL_CLOSE] = "close",
+};
+
+static SyscallCounts counts;
+static _Thread_local bool is_counting;
+static _Thread_local int kernel_depth;
+
+void
+syscall_counter_start(void)
+{
+	memset(&counts, 0, sizeof(counts));
+	is_counting = true;
+}
+
+void
+syscall_counter_stop(SyscallCounts *result)
+{
+	is_counting = false;
+	*result = counts;
+}
+
+void
+syscall_counter_count(int syscall)
+{
+	if (is_counting && kernel_depth == 0) {
+		++counts.n[syscall];
+	}
+}
+
+static void
+syscall_counter_count_allocation(void)
+{
+	if (is_counting && kernel_depth == 0) {
+		++counts.allocations;
+	}
+}
+
+void
+syscall_counter_kernel_enter(void)
+{
+	++kernel_depth;
+}
+
+void
+syscall_counter_kernel_leave(void)
+{
+	--kernel_depth;
+}
+
+static void *
+real_symbol(char const *name)
+{
+	void *sym = dlsym(RTLD_NEXT, name);
+	if (sym == NULL) {
+		abort();
+	}
+	return sym;
+}
+
+/*
+ * Some of the symbols are versioned on NetBSD. The system headers take care
+ * of the definitions below, but 'dlsym' needs the real names.
+ */
+#ifdef __NetBSD__
+#define SYM_KEVENT "__kevent50"
+#define SYM_FSTAT "__fstat50"
+#define kevent_n_type size_t
+#else
+#define SYM_KEVENT "kevent"
+#define SYM_FSTAT "fstat"
+#define kevent_n_type int
+#endif
+
+#ifndef __linux__
+int
+kqueue(void)
+{
+	syscall_counter_count(SYSCALL_KQUEUE);
+	return ((typeof(kqueue) *)real_symbol("kqueue"))();
+}
+
+#if defined(__NetBSD__) || defined(__FreeBSD__)
+int
+kqueue1(int flags)
+{
+	syscall_counter_count(SYSCALL_KQUEUE);
+	return ((typeof(kqueue1) *)real_symbol("kqueue1"))(flags);
+}
+#endif
+
+int
+kevent(int kq, const struct kevent *changelist, kevent_n_type nchanges,
+    struct kevent *eventlist, kevent_n_type nevents,
+    const struct timespec *timeout)
+{
+	syscall_counter_count(SYSCALL_KEVENT);
+	return ((typeof(kevent) *)real_symbol(SYM_KEVENT))(kq, changelist,
+	    nchanges, eventlist, nevents, timeout);
+}
+#endif
+
+int
+poll(struct pollfd fds[], nfds_t nfds, int timeout)
+{
+	syscall_counter_count(SYSCALL_POLL);
+	return ((typeof(poll) *)real_symbol("poll"))(fds, nfds, timeout);
+}
+
+#ifdef __NetBSD__
+int
+pollts(struct pollfd *restrict fds, nfds_t nfds,
+    struct timespec const *restrict tmo_p, sigset_t const *restrict sigmask)
+{
+	syscall_counter_count(SYSCALL_POLL);
+	return ((typeof(pollts) *)real_symbol("__pollts50"))(fds, nfds,
+	    tmo_p, sigmask);
+}
+#else
+int
+ppoll(struct pollfd *fds, nfds_t nfds, struct timespec const *tmo_p,
+    sigset_t const *sigmask)
+{
+	syscall_counter_count(SYSCALL_POLL);
+	return ((typeof(ppoll) *)real_symbol("ppoll"))(fds, nfds, tmo_p,
+	    sigmask);
+}
+#endif
+
+int
+fstat(int fd, struct stat *sb)
+{
+	syscall_counter_count(SYSCALL_FSTAT);
+	return ((typeof(fstat) *)real_symbol(SYM_FSTAT))(fd, sb);
+}
+
+int
+fcntl(int fd, int cmd, ...)
+{
+	va_list ap;
+
+	va_start(ap, cmd);
+	void *arg = va_arg(ap, void *);
+	va_end(ap);
+
+	syscall_counter_count(SYSCALL_FCNTL);
+	return ((typeof(fcntl) *)real_symbol("fcntl"))(fd, cmd, arg);
+}
+
+int
+close(int fd)
+{
+	syscall_counter_count(SYSCALL_CLOSE);
+	return ((typeof(close) *)real_symbol("close"))(fd);
+}
+
+/*
+ * glibc's 'dlsym' may allocate memory itself, so go to the allocator
+ * directly there.
+ */
+#ifdef __GLIBC__
+void *__libc_malloc(size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+#define real_malloc __libc_malloc
+#define real_realloc __libc_realloc
+#else
+#define real_malloc ((typeof(malloc) *)real_symbol("malloc"))
+#define real_realloc ((typeof(realloc) *)real_symbol("realloc"))
+#endif
+
+void *
+malloc(size_t size)
+{
+	syscall_counter_count_allocation();
+	return real_malloc(size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	syscall_counter_count_allocation();
+	return real_realloc(ptr, size);
+}
@@ -0,0 +1,42 @@
+#ifndef SYSCALL_COUNTER_H_
+#define SYSCALL_COUNTER_H_
+
+/*
+ * Counts the calls the shim makes into the kernel. The counting functions
+ * live in a shared library that is linked after libepoll-shim, so that it
+ * sees both the calls that are resolved normally ('kevent', 'fstat') and the
+ * ones the shim looks up with 'dlsym(RTLD_NEXT, ...)' ('close', 'poll', ...).
+ */
+
+enum {
+	SYSCALL_KQUEUE,
+	SYSCALL_KEVENT,
+	SYSCALL_POLL, /* 'poll', 'ppoll' and 'pollts' */
+	SYSCALL_FSTAT,
+	SYSCALL_FCNTL,
+	SYSCALL_CLOSE,
+	SYSCALL_NR,
+};
+
+typedef struct {
+	unsigned int n[SYSCALL_NR];
+	/* Not a system call: calls to 'malloc' and 'realloc'. */
+	unsigned int allocations;
+} SyscallCounts;
+
+extern char const *const syscall_counter_names[SYSCALL_NR];
+
+/* Only calls made by the calling thread are counted. */
+void syscall_counter_start(void);
+void syscall_counter_stop(SyscallCounts *counts);
+
+void syscall_counter_count(int syscall);
+
+/*
+ * Calls made between 'enter' and 'leave' are not counted. This is used when
+ * the "kernel" is implemented in userspace itself.
+ */
+void syscall_counter_kernel_enter(void);
+void syscall_counter_kernel_leave(void);
+
+#endif
@@ -0,0 +1,212 @@
+#include <atf-c.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <timer_wheel.h>
+
+#ifndef nitems
+#define nitems(x) (sizeof((x)) / sizeof((x)[0]))
+#endif
+
+struct fire_record {
+	uint64_t now;
+	int nr_fired;
+	uint64_t fired_at[1024];
+	TimerWheelEntry *entries;
+};
+
+static void
+record_fire(TimerWheelEntry *entry, void *arg)
+{
+	struct fire_record *record = arg;
+
+	ATF_REQUIRE(!entry->is_pending);
+	ATF_REQUIRE(entry->expiry <= record->now);
+	record->fired_at[entry - record->entries] = record->now;
+	++record->nr_fired;
+}
+
+static void
+advance_to(TimerWheel *wheel, struct fire_record *record, uint64_t now)
+{
+	uint64_t next;
+	if (timer_wheel_next_event(wheel, &next)) {
+		ATF_REQUIRE(next >= wheel->now);
+	}
+
+	record->now = now;
+	timer_wheel_advance(wheel, now, record_fire, record);
+	ATF_REQUIRE(wheel->now == now + 1);
+}
+
+ATF_TC_WITHOUT_HEAD(timer_wheel__fire_in_order);
+ATF_TC_BODY(timer_wheel__fire_in_order, tc)
+{
+	TimerWheel wheel;
+	TimerWheelEntry entries[1024];
+	struct fire_record record = { .entries = entries };
+	unsigned int seed = 42;
+
+	timer_wheel_init(&wheel, 1000);
+
+	for (int i = 0; i < (int)nitems(entries); ++i) {
+		timer_wheel_entry_init(&entries[i]);
+		timer_wheel_add(&wheel, &entries[i],
+		    1000 + (uint64_t)(rand_r(&seed) % 300000));
+	}
+	ATF_REQUIRE(wheel.nr_entries == nitems(entries));
+
+	for (uint64_t now = 1000; now <= 301000; ++now) {
+		advance_to(&wheel, &record, now);
+	}
+
+	ATF_REQUIRE(record.nr_fired == (int)nitems(entries));
+	ATF_REQUIRE(wheel.nr_entries == 0);
+	for (int i = 0; i < (int)nitems(entries); ++i) {
+		ATF_REQUIRE(record.fired_at[i] == entries[i].expiry);
+	}
+}
+
+ATF_TC_WITHOUT_HEAD(timer_wheel__large_steps);
+ATF_TC_BODY(timer_wheel__large_steps, tc)
+{
+	TimerWheel wheel;
+	TimerWheelEntry entries[512];
+	struct fire_record record = { .entries = entries };
+	unsigned int seed = 7;
+
+	timer_wheel_init(&wheel, 0);
+
+	for (int i = 0; i < (int)nitems(entries); ++i) {
+		timer_wheel_entry_init(&entries[i]);
+		timer_wheel_add(&wheel, &entries[i],
+		    (uint64_t)rand_r(&seed) * 1000);
+	}
+
+	uint64_t now = 0;
+	while (record.nr_fired < (int)nitems(entries)) {
+		uint64_t next;
+		ATF_REQUIRE(timer_wheel_next_event(&wheel, &next));
+		now = next + (uint64_t)(rand_r(&seed) % 100000);
+		advance_to(&wheel, &record, now);
+
+		for (int i = 0; i < (int)nitems(entries); ++i) {
+			ATF_REQUIRE(entries[i].is_pending ==
+			    (entries[i].expiry > now));
+		}
+	}
+
+	ATF_REQUIRE(!timer_wheel_next_event(&wheel, &now));
+}
+
+ATF_TC_WITHOUT_HEAD(timer_wheel__far_future);
+ATF_TC_BODY(timer_wheel__far_future, tc)
+{
+	TimerWheel wheel;
+	TimerWheelEntry entries[2];
+	struct fire_record record = { .entries = entries };
+
+	timer_wheel_init(&wheel, 5);
+
+	/* Beyond the range of the top level. */
+	timer_wheel_entry_init(&entries[0]);
+	timer_wheel_add(&wheel, &entries[0], (uint64_t)1 << 40);
+	timer_wheel_entry_init(&entries[1]);
+	timer_wheel_add(&wheel, &entries[1], ((uint64_t)1 << 40) + 3);
+
+	uint64_t next;
+	while (timer_wheel_next_event(&wheel, &next)) {
+		ATF_REQUIRE(next <= entries[1].expiry);
+		advance_to(&wheel, &record, next);
+	}
+
+	ATF_REQUIRE(record.nr_fired == 2);
+	ATF_REQUIRE(record.fired_at[0] == entries[0].expiry);
+	ATF_REQUIRE(record.fired_at[1] == entries[1].expiry);
+}
+
+ATF_TC_WITHOUT_HEAD(timer_wheel__remove);
+ATF_TC_BODY(timer_wheel__remove, tc)
+{
+	TimerWheel wheel;
+	TimerWheelEntry entries[256];
+	struct fire_record record = { .entries = entries };
+
+	timer_wheel_init(&wheel, 0);
+
+	for (int i = 0; i < (int)nitems(entries); ++i) {
+		timer_wheel_entry_init(&entries[i]);
+		timer_wheel_add(&wheel, &entries[i], (uint64_t)i * 97);
+	}
+	for (int i = 0; i < (int)nitems(entries); i += 2) {
+		timer_wheel_remove(&wheel, &entries[i]);
+		ATF_REQUIRE(!entries[i].is_pending);
+	}
+	/* Removing twice is fine. */
+	timer_wheel_remove(&wheel, &entries[0]);
+	ATF_REQUIRE(wheel.nr_entries == nitems(entries) / 2);
+
+	advance_to(&wheel, &record, 256 * 97);
+	ATF_REQUIRE(record.nr_fired == (int)nitems(entries) / 2);
+	for (int i = 1; i < (int)nitems(entries); i += 2) {
+		ATF_REQUIRE(record.fired_at[i] == 256 * 97);
+	}
+}
+
+ATF_TC_WITHOUT_HEAD(timer_wheel__expired_on_add);
+ATF_TC_BODY(timer_wheel__expired_on_add, tc)
+{
+	TimerWheel wheel;
+	TimerWheelEntry entries[1];
+	struct fire_record record = { .entries = entries };
+
+	timer_wheel_init(&wheel, 100000);
+
+	timer_wheel_entry_init(&entries[0]);
+	timer_wheel_add(&wheel, &entries[0], 10);
+
+	uint64_t next;
+	ATF_REQUIRE(timer_wheel_next_event(&wheel, &next));
+	ATF_REQUIRE(next == 100000);
+
+	advance_to(&wheel, &record, 100000);
+	ATF_REQUIRE(record.nr_fired == 1);
+}
+
+static void
+rearm_fire(TimerWheelEntry *entry, void *arg)
+{
+	TimerWheel *wheel = arg;
+	timer_wheel_add(wheel, entry, entry->expiry + 10);
+}
+
+ATF_TC_WITHOUT_HEAD(timer_wheel__rearm_from_callback);
+ATF_TC_BODY(timer_wheel__rearm_from_callback, tc)
+{
+	TimerWheel wheel;
+	TimerWheelEntry entry;
+
+	timer_wheel_init(&wheel, 0);
+	timer_wheel_entry_init(&entry);
+	timer_wheel_add(&wheel, &entry, 10);
+
+	for (uint64_t now = 0; now < 10000; ++now) {
+		timer_wheel_advance(&wheel, now, rearm_fire, &wheel);
+		ATF_REQUIRE(entry.is_pending);
+		ATF_REQUIRE(entry.expiry == (now / 10 + 1) * 10);
+	}
+	ATF_REQUIRE(wheel.nr_entries == 1);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, timer_wheel__fire_in_order);
+	ATF_TP_ADD_TC(tp, timer_wheel__large_steps);
+	ATF_TP_ADD_TC(tp, timer_wheel__far_future);
+	ATF_TP_ADD_TC(tp, timer_wheel__remove);
+	ATF_TP_ADD_TC(tp, timer_wheel__expired_on_add);
+	ATF_TP_ADD_TC(tp, timer_wheel__rearm_from_callback);
+
+	return atf_no_error();
+}
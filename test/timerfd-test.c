@@ -11,6 +11,7 @@
 #include <sys/param.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include <errno.h>
 #include <signal.h>
@@ -19,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <dirent.h>
 #include <err.h>
 #include <poll.h>
 #include <time.h>
@@ -1023,6 +1025,561 @@ ATF_TC_BODY_FD_LEAKCHECK(timerfd__reset_to_very_long, tc)
 	ATF_REQUIRE(errno == EAGAIN);
 }
 
+#if defined(EPOLL_SHIM_TEST_REALTIME_NOTE_ABSTIME) || defined(TFD_WHEEL)
+static int
+count_threads(void)
+{
+#ifdef __linux__
+	DIR *tasks = opendir("/proc/self/task");
+	ATF_REQUIRE(tasks != NULL);
+
+	int nr_threads = 0;
+	struct dirent *de;
+	while ((de = readdir(tasks)) != NULL) {
+		if (de->d_name[0] != '.') {
+			++nr_threads;
+		}
+	}
+
+	ATF_REQUIRE(closedir(tasks) == 0);
+	return nr_threads;
+#else
+	return -1;
+#endif
+}
+#endif
+
+ATF_TC_WITHOUT_HEAD(timerfd__realtime_note_abstime);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__realtime_note_abstime, tc)
+{
+#ifndef EPOLL_SHIM_TEST_REALTIME_NOTE_ABSTIME
+	atf_tc_skip("built without ENABLE_REALTIME_NOTE_ABSTIME");
+#else
+	int nr_threads = count_threads();
+
+	int timerfd = timerfd_create(CLOCK_REALTIME, /**/
+	    TFD_CLOEXEC | TFD_NONBLOCK);
+	ATF_REQUIRE(timerfd >= 0);
+
+	struct itimerspec time = { .it_value.tv_nsec = 0 };
+	ATF_REQUIRE(clock_gettime(CLOCK_REALTIME, &time.it_value) == 0);
+	time.it_value.tv_nsec += 100000000;
+	if (time.it_value.tv_nsec >= 1000000000) {
+		++time.it_value.tv_sec;
+		time.it_value.tv_nsec -= 1000000000;
+	}
+	ATF_REQUIRE(timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &time,
+			NULL) == 0);
+
+	/* The kernel schedules the timer, no step detector is started. */
+	if (nr_threads >= 0) {
+		ATF_REQUIRE(count_threads() == nr_threads);
+	}
+
+	ATF_REQUIRE(wait_for_timerfd(timerfd) == 1);
+
+	struct timespec e;
+	ATF_REQUIRE(clock_gettime(CLOCK_REALTIME, &e) == 0);
+	ATF_REQUIRE(e.tv_sec > time.it_value.tv_sec ||
+	    (e.tv_sec == time.it_value.tv_sec &&
+		e.tv_nsec >= time.it_value.tv_nsec));
+
+	/* TFD_TIMER_CANCEL_ON_SET still needs the step detector. */
+	time.it_value.tv_sec += 10;
+	ATF_REQUIRE(timerfd_settime(timerfd,
+			TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &time,
+			NULL) == 0);
+	if (nr_threads >= 0) {
+		ATF_REQUIRE(count_threads() == nr_threads + 1);
+	}
+
+	ATF_REQUIRE(close(timerfd) == 0);
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__wheel_many_timers);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__wheel_many_timers, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("TFD_WHEEL not supported");
+#else
+	int timer_fds[64];
+	struct pollfd pfds[nitems(timer_fds)];
+
+	struct timespec b, e;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &b) == 0);
+
+	for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+		timer_fds[i] = timerfd_create(CLOCK_MONOTONIC, /**/
+		    TFD_CLOEXEC | TFD_NONBLOCK | TFD_WHEEL);
+		ATF_REQUIRE(timer_fds[i] >= 0);
+
+		/* Arm in reverse order, so that the earliest deadline
+		 * changes all the time. */
+		struct itimerspec time = {
+		    .it_value.tv_nsec = (long)(nitems(timer_fds) - (size_t)i) *
+			5000000,
+		};
+		ATF_REQUIRE(timerfd_settime(timer_fds[i], 0, &time, NULL) == 0);
+
+		pfds[i] = (struct pollfd) {
+			.fd = timer_fds[i],
+			.events = POLLIN,
+		};
+	}
+
+	int nr_fired = 0;
+	while (nr_fired < (int)nitems(timer_fds)) {
+		int n = poll(pfds, nitems(pfds), -1);
+		ATF_REQUIRE(n > 0);
+
+		ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &e) == 0);
+		timespecsub(&e, &b, &e);
+
+		for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+			if (pfds[i].revents == 0) {
+				continue;
+			}
+			ATF_REQUIRE(pfds[i].revents == POLLIN);
+
+			/* Must not fire early. */
+			long deadline = (long)(nitems(timer_fds) - (size_t)i) *
+			    5000000;
+			ATF_REQUIRE(e.tv_sec > 0 || e.tv_nsec >= deadline);
+
+			uint64_t timeouts;
+			ATF_REQUIRE(read(timer_fds[i], &timeouts,
+					sizeof(timeouts)) ==
+			    (ssize_t)sizeof(timeouts));
+			ATF_REQUIRE(timeouts == 1);
+
+			pfds[i].fd = -1;
+			++nr_fired;
+		}
+	}
+
+	for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+		ATF_REQUIRE(close(timer_fds[i]) == 0);
+	}
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__wheel_rearm);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__wheel_rearm, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("TFD_WHEEL not supported");
+#else
+	int timerfd = timerfd_create(CLOCK_MONOTONIC, /**/
+	    TFD_CLOEXEC | TFD_NONBLOCK | TFD_WHEEL);
+	ATF_REQUIRE(timerfd >= 0);
+
+	struct itimerspec time = {
+		.it_value.tv_nsec = 100000000,
+	};
+
+	/* Keep pushing the deadline out, like an idle timeout. */
+	for (int i = 0; i < 5; ++i) {
+		ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+		struct pollfd pfd = { .fd = timerfd, .events = POLLIN };
+		ATF_REQUIRE(poll(&pfd, 1, 50) == 0);
+	}
+
+	struct timespec b, e;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &b) == 0);
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+	ATF_REQUIRE(wait_for_timerfd(timerfd) == 1);
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &e) == 0);
+	timespecsub(&e, &b, &e);
+	ATF_REQUIRE((e.tv_sec == 0 && e.tv_nsec >= 100000000) || e.tv_sec > 0);
+
+	/* A timer that has fired is not readable after re-arming. */
+	time.it_value.tv_nsec = 10000000;
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+	usleep(50000);
+	time.it_value.tv_nsec = 200000000;
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+	struct pollfd pfd = { .fd = timerfd, .events = POLLIN };
+	ATF_REQUIRE(poll(&pfd, 1, 0) == 0);
+	ATF_REQUIRE(wait_for_timerfd(timerfd) == 1);
+
+	/* Disarming works, too. */
+	time.it_value.tv_nsec = 10000000;
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+	usleep(50000);
+	ATF_REQUIRE(timerfd_settime(timerfd, 0,
+			&(struct itimerspec) { .it_value.tv_nsec = 0 },
+			NULL) == 0);
+	ATF_REQUIRE(poll(&pfd, 1, 0) == 0);
+
+	ATF_REQUIRE(close(timerfd) == 0);
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__wheel_periodic);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__wheel_periodic, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("TFD_WHEEL not supported");
+#else
+	int timerfd = timerfd_create(CLOCK_MONOTONIC, /**/
+	    TFD_CLOEXEC | TFD_NONBLOCK | TFD_WHEEL);
+	ATF_REQUIRE(timerfd >= 0);
+
+	struct itimerspec time = {
+		.it_value.tv_nsec = 50000000,
+		.it_interval.tv_nsec = 50000000,
+	};
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+
+	uint64_t total = 0;
+	for (int i = 0; i < 4; ++i) {
+		total += wait_for_timerfd(timerfd);
+	}
+	ATF_REQUIRE(total >= 4);
+
+	usleep(120000);
+
+	uint64_t timeouts;
+	ATF_REQUIRE(read(timerfd, &timeouts, sizeof(timeouts)) ==
+	    (ssize_t)sizeof(timeouts));
+	ATF_REQUIRE(timeouts >= 2);
+
+	ATF_REQUIRE(close(timerfd) == 0);
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__wheel_fork);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__wheel_fork, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("TFD_WHEEL not supported");
+#else
+	/* Make sure the parent has a live timer wheel. */
+	int timerfd = timerfd_create(CLOCK_MONOTONIC, /**/
+	    TFD_CLOEXEC | TFD_NONBLOCK | TFD_WHEEL);
+	ATF_REQUIRE(timerfd >= 0);
+
+	struct itimerspec time = {
+		.it_value.tv_nsec = 10000000,
+	};
+
+	pid_t pid = fork();
+	ATF_REQUIRE(pid >= 0);
+	if (pid == 0) {
+		int child_timerfd = timerfd_create(CLOCK_MONOTONIC, /**/
+		    TFD_CLOEXEC | TFD_NONBLOCK | TFD_WHEEL);
+		if (child_timerfd < 0) {
+			_Exit(1);
+		}
+
+		if (timerfd_settime(child_timerfd, 0, &time, NULL) < 0) {
+			_Exit(2);
+		}
+
+		struct pollfd pfd = { .fd = child_timerfd, .events = POLLIN };
+		if (poll(&pfd, 1, 5000) != 1) {
+			_Exit(3);
+		}
+
+		uint64_t timeouts;
+		if (read(child_timerfd, &timeouts, sizeof(timeouts)) !=
+			(ssize_t)sizeof(timeouts) ||
+		    timeouts != 1) {
+			_Exit(4);
+		}
+
+		if (close(child_timerfd) < 0) {
+			_Exit(5);
+		}
+
+		_Exit(0);
+	}
+
+	int status;
+	ATF_REQUIRE(waitpid(pid, &status, 0) == pid);
+	ATF_REQUIRE(WIFEXITED(status));
+	ATF_REQUIRE_MSG(WEXITSTATUS(status) == 0, "%d", WEXITSTATUS(status));
+
+	/* The wheel of the parent is still intact. */
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+	ATF_REQUIRE(wait_for_timerfd(timerfd) == 1);
+
+	ATF_REQUIRE(close(timerfd) == 0);
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__periodic_timer_expiration_count);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__periodic_timer_expiration_count, tc)
+{
+	int timerfd = timerfd_create(CLOCK_MONOTONIC, /**/
+	    TFD_CLOEXEC | TFD_NONBLOCK);
+	ATF_REQUIRE(timerfd >= 0);
+
+	struct itimerspec time = {
+		.it_value.tv_nsec = 10000000,
+		.it_interval.tv_nsec = 10000000,
+	};
+
+	struct timespec b, e;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &b) == 0);
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+
+	uint64_t total = 0;
+	for (int i = 0; i < 5; ++i) {
+		usleep(100000);
+
+		/* Querying the timer must not lose any expirations. */
+		struct itimerspec cur;
+		ATF_REQUIRE(timerfd_gettime(timerfd, &cur) == 0);
+		ATF_REQUIRE(cur.it_interval.tv_sec == 0 &&
+		    cur.it_interval.tv_nsec == 10000000);
+		ATF_REQUIRE(cur.it_value.tv_sec == 0 &&
+		    cur.it_value.tv_nsec > 0 &&
+		    cur.it_value.tv_nsec <= 10000000);
+
+		uint64_t timeouts;
+		ATF_REQUIRE(read(timerfd, &timeouts, sizeof(timeouts)) ==
+		    (ssize_t)sizeof(timeouts));
+		ATF_REQUIRE(timeouts >= 9);
+		total += timeouts;
+	}
+
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &e) == 0);
+	timespecsub(&e, &b, &e);
+
+	uint64_t max_expirations = (uint64_t)e.tv_sec * 100 +
+	    (uint64_t)e.tv_nsec / 10000000;
+	ATF_REQUIRE_MSG(total >= 49 && total <= max_expirations,
+	    "%d %d", (int)total, (int)max_expirations);
+
+	ATF_REQUIRE(close(timerfd) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__slack);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__slack, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("timerfd_set_slack not supported");
+#else
+	int timer_fds[2];
+	struct pollfd pfds[nitems(timer_fds)];
+
+	for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+		timer_fds[i] = timerfd_create(CLOCK_MONOTONIC, /**/
+		    TFD_CLOEXEC | TFD_NONBLOCK);
+		ATF_REQUIRE(timer_fds[i] >= 0);
+
+		ATF_REQUIRE_ERRNO(EINVAL,
+		    timerfd_set_slack(timer_fds[i],
+			&(struct timespec) { .tv_nsec = -1 }) < 0);
+		ATF_REQUIRE(timerfd_set_slack(timer_fds[i],
+				&(struct timespec) { .tv_nsec = 100000000 }) ==
+		    0);
+
+		pfds[i] = (struct pollfd) {
+			.fd = timer_fds[i],
+			.events = POLLIN,
+		};
+	}
+
+	/*
+	 * Both deadlines lie in the same 100ms window, so both timers must
+	 * fire at the end of it. The window must lie in the future.
+	 */
+	struct timespec window_end;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &window_end) == 0);
+	window_end.tv_sec += 2;
+	window_end.tv_nsec = 0;
+
+	for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+		struct itimerspec time = {
+			.it_value = window_end,
+		};
+		time.it_value.tv_sec -= 1;
+		time.it_value.tv_nsec = 910000000 + (long)i * 50000000;
+		ATF_REQUIRE(timerfd_settime(timer_fds[i], TFD_TIMER_ABSTIME,
+				&time, NULL) == 0);
+	}
+
+	/*
+	 * Neither timer may fire before the end of the window, even though
+	 * both deadlines lie before it. How long after that the process
+	 * gets to see them depends on the load of the machine.
+	 */
+	for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+		ATF_REQUIRE(poll(&pfds[i], 1, 5000) == 1);
+
+		struct timespec e;
+		ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &e) == 0);
+		ATF_REQUIRE_MSG(e.tv_sec >= window_end.tv_sec,
+		    "timer %d fired at %lld.%09ld, window ends at %lld", i,
+		    (long long)e.tv_sec, e.tv_nsec,
+		    (long long)window_end.tv_sec);
+
+		uint64_t timeouts;
+		ATF_REQUIRE(read(timer_fds[i], &timeouts, sizeof(timeouts)) ==
+		    (ssize_t)sizeof(timeouts));
+		ATF_REQUIRE(timeouts == 1);
+	}
+
+	/*
+	 * Each expiration of a periodic timer is rounded up as well. The
+	 * slack is below one millisecond, so the timer does not move to the
+	 * wheel.
+	 */
+	ATF_REQUIRE(timerfd_set_slack(timer_fds[0],
+			&(struct timespec) { .tv_nsec = 900000 }) == 0);
+	for (int i = 0; i < 10; ++i) {
+		struct timespec b;
+		ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &b) == 0);
+		struct itimerspec time = {
+			.it_value.tv_nsec = 100000,
+			.it_interval.tv_nsec = 100000,
+		};
+		ATF_REQUIRE(timerfd_settime(timer_fds[0], 0, &time, NULL) ==
+		    0);
+
+		int64_t boundary = ((int64_t)b.tv_sec * 1000000000 +
+					   b.tv_nsec + 100000 + 899999) /
+		    900000 * 900000;
+
+		ATF_REQUIRE(poll(&pfds[0], 1, 5000) == 1);
+
+		struct timespec e;
+		ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &e) == 0);
+		ATF_REQUIRE_MSG((int64_t)e.tv_sec * 1000000000 + e.tv_nsec >=
+			boundary,
+		    "periodic timer fired at %lld.%09ld, before %lld",
+		    (long long)e.tv_sec, e.tv_nsec, (long long)boundary);
+
+		uint64_t timeouts;
+		ATF_REQUIRE(read(timer_fds[0], &timeouts, sizeof(timeouts)) ==
+		    (ssize_t)sizeof(timeouts));
+		ATF_REQUIRE(timeouts >= 1);
+	}
+
+	for (int i = 0; i < (int)nitems(timer_fds); ++i) {
+		ATF_REQUIRE(close(timer_fds[i]) == 0);
+	}
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__slack_reset);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__slack_reset, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("timerfd_set_slack not supported");
+#else
+	int nr_threads = count_threads();
+
+	int timerfd = timerfd_create(CLOCK_MONOTONIC, /**/
+	    TFD_CLOEXEC | TFD_NONBLOCK);
+	ATF_REQUIRE(timerfd >= 0);
+
+	struct itimerspec time = { .it_value.tv_sec = 10 };
+	ATF_REQUIRE(timerfd_set_slack(timerfd,
+			&(struct timespec) { .tv_nsec = 5000000 }) == 0);
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+	if (nr_threads >= 0) {
+		ATF_REQUIRE(count_threads() == nr_threads + 1);
+	}
+
+	/* Without slack, the armed timer leaves the wheel again. */
+	ATF_REQUIRE(timerfd_set_slack(timerfd,
+			&(struct timespec) { .tv_nsec = 0 }) == 0);
+	if (nr_threads >= 0) {
+		int n;
+		for (int i = 0; (n = count_threads()) != nr_threads && i < 100;
+		     ++i) {
+			usleep(10000);
+		}
+		ATF_REQUIRE(n == nr_threads);
+	}
+
+	struct itimerspec cur;
+	ATF_REQUIRE(timerfd_gettime(timerfd, &cur) == 0);
+	ATF_REQUIRE(cur.it_value.tv_sec == 9 || cur.it_value.tv_sec == 10);
+
+	struct timespec b, e;
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &b) == 0);
+	time = (struct itimerspec) { .it_value.tv_nsec = 32100000 };
+	ATF_REQUIRE(timerfd_settime(timerfd, 0, &time, NULL) == 0);
+
+	ATF_REQUIRE(wait_for_timerfd(timerfd) == 1);
+	ATF_REQUIRE(clock_gettime(CLOCK_MONOTONIC, &e) == 0);
+
+	int64_t elapsed = (int64_t)(e.tv_sec - b.tv_sec) * 1000000000 +
+	    (e.tv_nsec - b.tv_nsec);
+	ATF_REQUIRE(elapsed >= 32100000);
+
+	ATF_REQUIRE(close(timerfd) == 0);
+#endif
+}
+
+ATF_TC_WITHOUT_HEAD(timerfd__settime_many);
+ATF_TC_BODY_FD_LEAKCHECK(timerfd__settime_many, tc)
+{
+#ifndef TFD_WHEEL
+	atf_tc_skip("timerfd_settime_many not supported");
+#else
+	int fds[4];
+	struct itimerspec times[nitems(fds)];
+	int errors[nitems(fds)];
+
+	for (int i = 0; i < (int)nitems(fds); ++i) {
+		fds[i] = timerfd_create(CLOCK_MONOTONIC, /**/
+		    TFD_CLOEXEC | TFD_NONBLOCK);
+		ATF_REQUIRE(fds[i] >= 0);
+
+		times[i] = (struct itimerspec) {
+			.it_value.tv_nsec = (i + 1) * 100000000,
+		};
+	}
+
+	int invalid_fd = fds[2];
+	fds[2] = -1;
+
+	ATF_REQUIRE_ERRNO(EBADF,
+	    timerfd_settime_many(fds, 0, times, errors, nitems(fds)) < 0);
+	ATF_REQUIRE(errors[0] == 0);
+	ATF_REQUIRE(errors[1] == 0);
+	ATF_REQUIRE(errors[2] == EBADF);
+	ATF_REQUIRE(errors[3] == 0);
+
+	fds[2] = invalid_fd;
+
+	/* The other timers have been armed, relative to the same time. */
+	struct itimerspec cur[nitems(fds)];
+	for (int i = 0; i < (int)nitems(fds); ++i) {
+		ATF_REQUIRE(timerfd_gettime(fds[i], &cur[i]) == 0);
+	}
+	ATF_REQUIRE(cur[2].it_value.tv_sec == 0 &&
+	    cur[2].it_value.tv_nsec == 0);
+	ATF_REQUIRE(cur[0].it_value.tv_nsec > 0);
+	ATF_REQUIRE(cur[3].it_value.tv_nsec - cur[0].it_value.tv_nsec >
+	    290000000);
+
+	ATF_REQUIRE(wait_for_timerfd(fds[0]) == 1);
+	struct pollfd pfd = { .fd = fds[3], .events = POLLIN };
+	ATF_REQUIRE(poll(&pfd, 1, 0) == 0);
+
+	/* Disarm all of them. */
+	for (int i = 0; i < (int)nitems(fds); ++i) {
+		times[i] = (struct itimerspec) {};
+	}
+	ATF_REQUIRE(timerfd_settime_many(fds, 0, times, NULL, nitems(fds)) ==
+	    0);
+	ATF_REQUIRE(poll(&pfd, 1, 500) == 0);
+
+	ATF_REQUIRE(timerfd_settime_many(NULL, 0, NULL, NULL, 0) == 0);
+
+	for (int i = 0; i < (int)nitems(fds); ++i) {
+		ATF_REQUIRE(close(fds[i]) == 0);
+	}
+#endif
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, timerfd__many_timers);
@@ -1044,6 +1601,15 @@ ATF_TP_ADD_TCS(tp)
 	ATF_TP_ADD_TC(tp, timerfd__short_evfilt_timer_timeout);
 	ATF_TP_ADD_TC(tp, timerfd__unmodified_errno);
 	ATF_TP_ADD_TC(tp, timerfd__reset_to_very_long);
+	ATF_TP_ADD_TC(tp, timerfd__realtime_note_abstime);
+	ATF_TP_ADD_TC(tp, timerfd__wheel_many_timers);
+	ATF_TP_ADD_TC(tp, timerfd__wheel_rearm);
+	ATF_TP_ADD_TC(tp, timerfd__wheel_periodic);
+	ATF_TP_ADD_TC(tp, timerfd__wheel_fork);
+	ATF_TP_ADD_TC(tp, timerfd__periodic_timer_expiration_count);
+	ATF_TP_ADD_TC(tp, timerfd__slack);
+	ATF_TP_ADD_TC(tp, timerfd__slack_reset);
+	ATF_TP_ADD_TC(tp, timerfd__settime_many);
 
 	return atf_no_error();
 }
@@ -0,0 +1,157 @@
+#include <atf-c.h>
+
+#include <sys/epoll.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <epoll-shim/wait_profile.h>
+
+static void
+get_histogram(int ep, int kind, struct epoll_shim_wait_histogram *histogram)
+{
+	if (epoll_shim_get_wait_histogram(ep, kind, histogram) < 0) {
+		ATF_REQUIRE(errno == ENOTSUP);
+		atf_tc_skip("epoll-shim was built without lock profiling");
+	}
+}
+
+static uint64_t
+histogram_sum(struct epoll_shim_wait_histogram const *histogram)
+{
+	uint64_t sum = 0;
+	for (int i = 0; i < EPOLL_SHIM_WAIT_HISTOGRAM_BUCKETS; ++i) {
+		sum += histogram->buckets[i];
+	}
+	return sum;
+}
+
+static void *
+delayed_write_fun(void *arg)
+{
+	int fd = *(int *)arg;
+
+	ATF_REQUIRE(nanosleep(&(struct timespec) { .tv_nsec = 50000000 },
+			NULL) == 0);
+	ATF_REQUIRE(write(fd, "", 1) == 1);
+
+	return NULL;
+}
+
+ATF_TC_WITHOUT_HEAD(wait_profile__histograms);
+ATF_TC_BODY(wait_profile__histograms, tc)
+{
+	struct epoll_shim_wait_histogram histogram;
+
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	ATF_REQUIRE(ep >= 0);
+
+	get_histogram(ep, EPOLL_SHIM_WAIT_HISTOGRAM_EVENTS, &histogram);
+	ATF_REQUIRE(histogram.count == 0);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.fd = fds[0],
+	};
+	ATF_REQUIRE(epoll_ctl(ep, EPOLL_CTL_ADD, fds[0], &event) == 0);
+
+	/* Does not block. */
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, 0) == 0);
+
+	/* Blocks for about 50ms. */
+	pthread_t thread;
+	ATF_REQUIRE(pthread_create(&thread, NULL, delayed_write_fun,
+			&fds[1]) == 0);
+	ATF_REQUIRE(epoll_wait(ep, &event, 1, -1) == 1);
+	ATF_REQUIRE(pthread_join(thread, NULL) == 0);
+
+	get_histogram(ep, EPOLL_SHIM_WAIT_HISTOGRAM_EVENTS, &histogram);
+	ATF_REQUIRE(histogram.count == 2);
+	ATF_REQUIRE(histogram.sum == 1);
+	ATF_REQUIRE(histogram.max == 1);
+	ATF_REQUIRE(histogram.buckets[0] == 1);
+	ATF_REQUIRE(histogram.buckets[1] == 1);
+
+	get_histogram(ep, EPOLL_SHIM_WAIT_HISTOGRAM_BLOCK, &histogram);
+	ATF_REQUIRE(histogram.count >= 1);
+	ATF_REQUIRE(histogram_sum(&histogram) == histogram.count);
+	ATF_REQUIRE(histogram.max >= 40000000);
+
+	get_histogram(ep, EPOLL_SHIM_WAIT_HISTOGRAM_WAKEUP_TO_RETURN,
+	    &histogram);
+	ATF_REQUIRE(histogram.count == 1);
+	ATF_REQUIRE(histogram.max < 1000000000);
+
+	get_histogram(ep, EPOLL_SHIM_WAIT_HISTOGRAM_MUTEX_WAIT, &histogram);
+	ATF_REQUIRE(histogram.count >= 2);
+	ATF_REQUIRE(histogram_sum(&histogram) == histogram.count);
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_get_wait_histogram(ep,
+			EPOLL_SHIM_WAIT_HISTOGRAM_COUNT, &histogram) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+	ATF_REQUIRE(close(ep) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(wait_profile__bucket_min);
+ATF_TC_BODY(wait_profile__bucket_min, tc)
+{
+	for (int i = 0; i < 4; ++i) {
+		ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(i) ==
+		    (uint64_t)i);
+	}
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(4) == 4);
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(7) == 7);
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(8) == 8);
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(9) == 10);
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(12) == 16);
+
+	for (int i = 1; i < EPOLL_SHIM_WAIT_HISTOGRAM_BUCKETS; ++i) {
+		ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(i) >
+		    epoll_shim_wait_histogram_bucket_min(i - 1));
+	}
+
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(-1) == 0);
+	ATF_REQUIRE(epoll_shim_wait_histogram_bucket_min(
+			EPOLL_SHIM_WAIT_HISTOGRAM_BUCKETS) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(wait_profile__invalid_fd);
+ATF_TC_BODY(wait_profile__invalid_fd, tc)
+{
+	struct epoll_shim_wait_histogram histogram;
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_get_wait_histogram(-1,
+			EPOLL_SHIM_WAIT_HISTOGRAM_BLOCK, &histogram) < 0);
+	ATF_REQUIRE(errno == EBADF);
+
+	int fds[2];
+	ATF_REQUIRE(pipe(fds) == 0);
+
+	errno = 0;
+	ATF_REQUIRE(epoll_shim_get_wait_histogram(fds[0],
+			EPOLL_SHIM_WAIT_HISTOGRAM_BLOCK, &histogram) < 0);
+	ATF_REQUIRE(errno == EINVAL);
+
+	ATF_REQUIRE(close(fds[0]) == 0);
+	ATF_REQUIRE(close(fds[1]) == 0);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, wait_profile__histograms);
+	ATF_TP_ADD_TC(tp, wait_profile__bucket_min);
+	ATF_TP_ADD_TC(tp, wait_profile__invalid_fd);
+
+	return atf_no_error();
+}